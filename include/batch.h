@@ -0,0 +1,148 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "frame.h"
+
+/*
+ * A batch of encoded frames. Frames are packed back to back into one arena
+ * and described by an iovec and a mmsghdr each, so msgs can be handed to
+ * sendmmsg as is.
+ */
+typedef struct {
+  uint8_t *arena;            /* encoded frames, back to back */
+  size_t arena_size;         /* bytes allocated for arena */
+  size_t arena_used;         /* bytes of arena in use */
+  struct iovec *iov;         /* iov[i] is frame i inside arena */
+  struct mmsghdr *msgs;      /* sendmmsg table, msgs[i] sends iov[i] */
+  struct sockaddr_in *addrs; /* destination of frame i */
+  size_t count;              /* frames in the batch */
+  size_t sent;               /* frames already handed to the kernel */
+  size_t capacity;           /* maximum amount of frames */
+  uint64_t syscalls;         /* sendmmsg calls made, kept across resets */
+} lifx_batch_t;
+
+/**
+ * @brief Allocate a batch.
+ *
+ * @param batch
+ * @param capacity maximum amount of frames the batch holds
+ */
+int lifx_batch_init(lifx_batch_t *batch, size_t capacity);
+
+/**
+ * @brief Free the memory held by a batch.
+ *
+ * @param batch
+ */
+void lifx_batch_free(lifx_batch_t *batch);
+
+/**
+ * @brief Empty a batch so it can be refilled, keeping its memory.
+ *
+ * @param batch
+ */
+void lifx_batch_reset(lifx_batch_t *batch);
+
+/**
+ * @brief Encode a frame onto the end of a batch.
+ *
+ * Returns the index of the frame in the batch or -1 if the batch is full or
+ * the frame failed to encode.
+ *
+ * @param batch
+ * @param frame
+ * @param addr destination, NULL when sending on a connected socket
+ */
+int lifx_batch_add(lifx_batch_t *batch, const lifx_frame_t *frame,
+                   const struct sockaddr_in *addr);
+
+/**
+ * @brief Encode a frame from a header template onto the end of a batch.
+ *
+ * See lifx_encode_templated_frame and lifx_batch_add.
+ */
+int lifx_batch_add_templated(lifx_batch_t *batch,
+                             const lifx_header_template_t *tmpl,
+                             uint8_t sequence, lifx_message_type type,
+                             const lifx_payload_t *payload,
+                             const struct sockaddr_in *addr);
+
+/**
+ * @brief Copy an encoded frame onto the end of a batch.
+ *
+ * Returns the index of the frame in the batch or -1 if the batch is full or
+ * size is 0 or above FRAME_SIZE_MAX.
+ *
+ * @param batch
+ * @param packet
+ * @param size bytes in packet
+ * @param addr destination, NULL when sending on a connected socket
+ */
+int lifx_batch_add_packet(lifx_batch_t *batch, const uint8_t *packet,
+                          size_t size, const struct sockaddr_in *addr);
+
+/**
+ * @brief Encode an array of frames onto the end of a batch.
+ *
+ * Returns the amount of frames encoded, which is less than n when the batch
+ * fills up or a frame fails to encode.
+ *
+ * @param batch
+ * @param frames
+ * @param addrs destination of each frame, NULL when sending on a connected
+ * socket
+ * @param n amount of frames
+ */
+int lifx_batch_encode(lifx_batch_t *batch, const lifx_frame_t *frames,
+                      const struct sockaddr_in *addrs, size_t n);
+
+/**
+ * @brief Encode a SetColor per light onto the end of a batch.
+ *
+ * Light i gets colors[i] through its header template tmpls[i], with sequence
+ * plus i as sequence, so the output of lifx_color_from_rgb goes out as is.
+ * Returns the amount of frames encoded, which is less than n when the batch
+ * fills up.
+ *
+ * @param batch
+ * @param tmpls n header templates
+ * @param sequence of the first frame
+ * @param colors n payloads
+ * @param addrs destination of each frame, NULL when sending on a connected
+ * socket
+ * @param n amount of lights
+ */
+int lifx_batch_add_colors(lifx_batch_t *batch,
+                          const lifx_header_template_t *tmpls,
+                          uint8_t sequence,
+                          const lifx_set_color_payload_t *colors,
+                          const struct sockaddr_in *addrs, size_t n);
+
+/**
+ * @brief Send the unsent frames of a batch.
+ *
+ * Sends with as few sendmmsg calls as the kernel allows. On a non-blocking
+ * socket this stops early when the socket would block, calling it again
+ * resumes where it stopped. Every sendmmsg is counted in syscalls. Returns
+ * the amount of frames sent by this call or -1 on error.
+ *
+ * @param sfd
+ * @param batch
+ */
+int lifx_batch_send(int sfd, lifx_batch_t *batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BATCH_H */
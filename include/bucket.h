@@ -0,0 +1,78 @@
+#ifndef BUCKET_H
+#define BUCKET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Token bucket counting in thousandths of a token so a rate given per second
+ * refills exactly with millisecond timestamps.
+ */
+typedef struct {
+  uint32_t rate;   /* tokens per second */
+  uint32_t burst;  /* maximum tokens */
+  uint64_t tokens; /* thousandths of a token */
+  uint64_t last;   /* millisecond timestamp of the last refill */
+} lifx_bucket_t;
+
+/**
+ * @brief Initialise a full bucket.
+ *
+ * @param bucket
+ * @param rate tokens per second
+ * @param burst maximum tokens
+ * @param now milliseconds
+ */
+static inline void lifx_bucket_init(lifx_bucket_t *bucket, uint32_t rate,
+                                    uint32_t burst, uint64_t now) {
+  bucket->rate = rate;
+  bucket->burst = burst;
+  bucket->tokens = (uint64_t)burst * 1000;
+  bucket->last = now;
+}
+
+static inline void lifx_bucket_refill(lifx_bucket_t *bucket, uint64_t now) {
+  if (now <= bucket->last) {
+    return;
+  }
+  bucket->tokens += (now - bucket->last) * bucket->rate;
+  if (bucket->tokens > (uint64_t)bucket->burst * 1000) {
+    bucket->tokens = (uint64_t)bucket->burst * 1000;
+  }
+  bucket->last = now;
+}
+
+/* Take one token, returns 0 when the bucket is empty */
+static inline int lifx_bucket_take(lifx_bucket_t *bucket, uint64_t now) {
+  lifx_bucket_refill(bucket, now);
+  if (bucket->tokens < 1000) {
+    return 0;
+  }
+  bucket->tokens -= 1000;
+  return 1;
+}
+
+/* Milliseconds from now until a token is available */
+static inline uint64_t lifx_bucket_wait(const lifx_bucket_t *bucket,
+                                        uint64_t now) {
+  uint64_t tokens = bucket->tokens;
+  if (now > bucket->last) {
+    tokens += (now - bucket->last) * bucket->rate;
+  }
+  if (tokens >= 1000) {
+    return 0;
+  }
+  if (bucket->rate == 0) {
+    return UINT64_MAX;
+  }
+  return (1000 - tokens + bucket->rate - 1) / bucket->rate;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BUCKET_H */
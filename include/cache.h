@@ -0,0 +1,73 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "registry.h"
+
+/*
+ * On disk device cache. A 16 byte header (magic "LIFXDEV1", record count and
+ * record size as little endian uint32) followed by one 64 byte record per
+ * device:
+ *
+ *   0  target[8]
+ *   8  IPv4 address, network order
+ *   12 service port, little endian
+ *   14 flags
+ *   15 reserved
+ *   16 last seen in milliseconds since the epoch, little endian
+ *   24 label[32]
+ *   56 reserved
+ */
+#define LIFX_CACHE_MAGIC "LIFXDEV1"
+#define LIFX_CACHE_HEADER_SIZE 16
+#define LIFX_CACHE_RECORD_SIZE 64
+
+/**
+ * @brief Write every device of a registry to path.
+ *
+ * The file is replaced atomically, readers see either the old or the new
+ * cache.
+ *
+ * @param registry
+ * @param path
+ */
+int lifx_cache_save(const lifx_registry_t *registry, const char *path);
+
+/**
+ * @brief Load the devices of a cache file into a registry.
+ *
+ * The file is memory mapped and its records inserted with LIFX_DEVICE_CACHED
+ * set, they are usable right away. A StateService from the device confirms it
+ * and clears the flag. Devices already in the registry are left alone.
+ * Returns the amount of devices loaded or -1 when the file is missing or
+ * malformed.
+ *
+ * @param registry
+ * @param path
+ */
+int lifx_cache_load(lifx_registry_t *registry, const char *path);
+
+/**
+ * @brief Remove devices loaded from a cache that were not confirmed.
+ *
+ * Meant to run once a rediscovery round is over. Only unconfirmed devices
+ * last seen before the given time are removed, so a device missing a single
+ * round is kept. Returns the amount of devices removed.
+ *
+ * @param registry
+ * @param before see lifx_registry_now, UINT64_MAX removes every unconfirmed
+ * device
+ */
+size_t lifx_cache_expire(lifx_registry_t *registry, uint64_t before);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CACHE_H */
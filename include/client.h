@@ -0,0 +1,198 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+#include "receiver.h"
+#include "registry.h"
+#include "timer.h"
+
+/* Defaults of lifx_client_init */
+#define LIFX_CLIENT_TIMEOUT_DEFAULT 200
+#define LIFX_CLIENT_MAX_TIMEOUT_DEFAULT 2000
+#define LIFX_CLIENT_RETRIES_DEFAULT 3
+
+typedef enum {
+  LIFX_CLIENT_OK = 0,    /* reply received, or sent when none was asked for */
+  LIFX_CLIENT_CANCELLED, /* client closed before the request completed */
+  LIFX_CLIENT_TIMEOUT,   /* no reply after the last retry, or lost unsent */
+} lifx_client_status;
+
+/*
+ * How a request waiting for a reply is retransmitted. The first attempt
+ * waits timeout milliseconds, every retry doubles the wait up to max_timeout.
+ * The request is given up on after retries retransmissions.
+ */
+typedef struct {
+  uint32_t timeout;
+  uint32_t max_timeout;
+  uint8_t retries;
+} lifx_retry_policy_t;
+
+typedef struct lifx_client lifx_client_t;
+
+/**
+ * @brief Completion callback of a request.
+ *
+ * reply is the decoded reply, or NULL when no reply was asked for or the
+ * request did not complete. It is only valid for the duration of the call.
+ * The callback may send new requests.
+ */
+typedef void (*lifx_client_callback)(lifx_client_t *client, int status,
+                                     const lifx_frame_t *reply, void *ctx);
+
+typedef enum {
+  LIFX_REQUEST_FREE = 0,
+  LIFX_REQUEST_UNSENT,   /* waiting for the socket to become writable */
+  LIFX_REQUEST_INFLIGHT, /* sent, waiting for its reply */
+} lifx_request_state;
+
+/* An outstanding request. Kept encoded so it can be (re)sent as is. */
+typedef struct {
+  uint64_t target;  /* target bytes as a little endian integer */
+  uint8_t sequence;
+  uint8_t state;
+  uint8_t tagged;
+  uint8_t response;
+  uint8_t acknowledgement;
+  uint8_t attempts; /* retransmissions so far */
+  uint16_t size;
+  uint32_t timeout; /* wait of the current attempt in milliseconds */
+  lifx_retry_policy_t policy;
+  lifx_timer_t timer;
+  struct sockaddr_in addr;
+  lifx_client_callback callback;
+  void *ctx;
+  uint32_t next;    /* free list or unsent queue link */
+  uint64_t sent_at; /* microseconds, first transmission when metrics are on */
+  uint8_t packet[FRAME_SIZE_MAX];
+} lifx_request_t;
+
+typedef struct {
+  uint64_t sent;      /* datagrams handed to the kernel */
+  uint64_t received;  /* datagrams received */
+  uint64_t completed; /* requests completed */
+  uint64_t unmatched; /* replies matching no request */
+  uint64_t retries;   /* retransmissions */
+  uint64_t giveups;   /* requests completed with LIFX_CLIENT_TIMEOUT */
+  uint64_t dropped;   /* sends refused with ENOBUFS, handled as lost */
+} lifx_client_stats_t;
+
+/*
+ * Asynchronous client. One non-blocking UDP socket driven by epoll, with
+ * every outstanding request indexed by (target, sequence) so replies are
+ * matched in O(1). Replies from another source are ignored. Requests waiting
+ * for a reply are retransmitted from a timer wheel ticking in milliseconds.
+ */
+struct lifx_client {
+  int sfd;
+  int epfd;
+  uint32_t source;
+  uint8_t sequence;              /* next sequence to hand out */
+  lifx_request_t *requests;      /* request pool */
+  uint32_t *index;               /* open addressing table of request slot + 1 */
+  size_t capacity;               /* size of the request pool */
+  size_t index_mask;             /* index size - 1, the size is a power of 2 */
+  size_t inflight;               /* requests in use */
+  uint32_t free_head;            /* free list of request slots */
+  uint32_t unsent_head;          /* requests waiting for EPOLLOUT */
+  uint32_t unsent_tail;
+  int writable;                  /* EPOLLOUT is not armed */
+  lifx_retry_policy_t policy;    /* used by lifx_client_send */
+  lifx_wheel_t wheel;
+  lifx_registry_t *registry;     /* optional, learns from every reply */
+  lifx_metrics_shard_t *metrics; /* optional, shard of the polling thread */
+  lifx_receiver_t receiver;
+  lifx_client_stats_t stats;
+};
+
+/**
+ * @brief Open a client.
+ *
+ * Creates a non-blocking UDP socket bound to an ephemeral port with broadcast
+ * enabled and an epoll instance watching it. The retry policy starts out with
+ * the LIFX_CLIENT_*_DEFAULT values and may be changed through policy.
+ *
+ * @param client
+ * @param source non zero identifier put in every frame sent
+ * @param capacity maximum amount of outstanding requests
+ */
+int lifx_client_init(lifx_client_t *client, uint32_t source, size_t capacity);
+
+/**
+ * @brief Close a client.
+ *
+ * Outstanding requests complete with LIFX_CLIENT_CANCELLED.
+ *
+ * @param client
+ */
+void lifx_client_close(lifx_client_t *client);
+
+/**
+ * @brief Send a request.
+ *
+ * The source and sequence of frame are filled in by the client. When the
+ * response or acknowledgement bit is set the request stays outstanding until
+ * the matching reply arrives, a response takes precedence over the
+ * acknowledgement when both are asked for, and is retransmitted following
+ * the client retry policy. Otherwise it completes as soon as it is sent. A
+ * tagged request completes with the first reply.
+ *
+ * Returns the sequence used or -1 when the client is full or frame fails to
+ * encode.
+ *
+ * @param client
+ * @param frame
+ * @param addr destination
+ * @param callback may be NULL
+ * @param ctx passed to callback
+ */
+int lifx_client_send(lifx_client_t *client, const lifx_frame_t *frame,
+                     const struct sockaddr_in *addr,
+                     lifx_client_callback callback, void *ctx);
+
+/**
+ * @brief Send a request with its own retry policy.
+ *
+ * See lifx_client_send.
+ */
+int lifx_client_send_policy(lifx_client_t *client, const lifx_frame_t *frame,
+                            const struct sockaddr_in *addr,
+                            const lifx_retry_policy_t *policy,
+                            lifx_client_callback callback, void *ctx);
+
+/**
+ * @brief Run the client.
+ *
+ * Waits up to timeout milliseconds (-1 waits forever, 0 not at all) for
+ * socket events, waking early for due retransmissions. Then flushes unsent
+ * requests, drains and dispatches every received reply and fires expired
+ * timers. Returns the amount of requests completed or -1 on error.
+ *
+ * @param client
+ * @param timeout in milliseconds
+ */
+int lifx_client_poll(lifx_client_t *client, int timeout);
+
+/**
+ * @brief The epoll descriptor of a client.
+ *
+ * Readable whenever lifx_client_poll has work to do, so the client can be
+ * nested in another event loop.
+ *
+ * @param client
+ */
+int lifx_client_fd(const lifx_client_t *client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLIENT_H */
@@ -0,0 +1,114 @@
+#ifndef COLOR_H
+#define COLOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+typedef enum {
+  LIFX_COLOR_AUTO = 0, /* the widest kernel the CPU runs */
+  LIFX_COLOR_SCALAR,   /* plain C, on every CPU */
+  LIFX_COLOR_SSE2,     /* 4 pixels at a time, x86 only */
+  LIFX_COLOR_AVX2,     /* 8 pixels at a time, x86 with AVX2 only */
+} lifx_color_kernel;
+
+/**
+ * @brief Convert RGB pixels to SetColor payloads.
+ *
+ * Reads n pixels of channels floats each, red, green and blue from 0 to 1
+ * followed by alpha when channels is 4. Values outside of 0 to 1 are
+ * clamped. Alpha scales brightness, as if the pixel was drawn over black.
+ * Hue, saturation and brightness follow the HSV model and every payload
+ * gets kelvin and duration, so out can go to lifx_batch_add_colors as is.
+ * Every kernel gives the same payloads for the same pixels.
+ *
+ * Returns -1 with errno set to EINVAL when channels is not 3 or 4 and to
+ * ENOTSUP when the CPU does not run kernel.
+ *
+ * @param kernel
+ * @param rgb
+ * @param channels 3 for RGB, 4 for RGBA
+ * @param n amount of pixels
+ * @param kelvin
+ * @param duration milliseconds
+ * @param out n payloads
+ */
+int lifx_color_from_rgb_kernel(lifx_color_kernel kernel, const float *rgb,
+                               size_t channels, size_t n, uint16_t kelvin,
+                               uint32_t duration,
+                               lifx_set_color_payload_t *out);
+
+/**
+ * @brief lifx_color_from_rgb_kernel with LIFX_COLOR_AUTO.
+ */
+int lifx_color_from_rgb(const float *rgb, size_t channels, size_t n,
+                        uint16_t kelvin, uint32_t duration,
+                        lifx_set_color_payload_t *out);
+
+/**
+ * @brief Convert 8 bit RGB pixels to SetColor payloads.
+ *
+ * Like lifx_color_from_rgb_kernel with channels from 0 to 255, as effects
+ * rendered into an 8 bit frame buffer produce them. Every kernel scales them
+ * by 1.0f / 255 and converts them the same way, so a float pixel holding
+ * channel * (1.0f / 255) gives the same payload.
+ *
+ * @param kernel
+ * @param rgb
+ * @param channels 3 for RGB, 4 for RGBA
+ * @param n amount of pixels
+ * @param kelvin
+ * @param duration milliseconds
+ * @param out n payloads
+ */
+int lifx_color_from_rgb8_kernel(lifx_color_kernel kernel, const uint8_t *rgb,
+                                size_t channels, size_t n, uint16_t kelvin,
+                                uint32_t duration,
+                                lifx_set_color_payload_t *out);
+
+/**
+ * @brief lifx_color_from_rgb8_kernel with LIFX_COLOR_AUTO.
+ */
+int lifx_color_from_rgb8(const uint8_t *rgb, size_t channels, size_t n,
+                         uint16_t kelvin, uint32_t duration,
+                         lifx_set_color_payload_t *out);
+
+/**
+ * @brief The kernel LIFX_COLOR_AUTO stands for on this CPU.
+ */
+lifx_color_kernel lifx_color_kernel_best(void);
+
+/**
+ * @brief Whether the CPU runs a kernel.
+ *
+ * @param kernel
+ */
+int lifx_color_kernel_supported(lifx_color_kernel kernel);
+
+/**
+ * @brief Name of a kernel, "auto", "scalar", "sse2" or "avx2".
+ *
+ * @param kernel
+ */
+const char *lifx_color_kernel_name(lifx_color_kernel kernel);
+
+/**
+ * @brief Parse a kernel name, see lifx_color_kernel_name.
+ *
+ * Returns -1 when the name is unknown.
+ *
+ * @param name
+ * @param kernel
+ */
+int lifx_color_kernel_parse(const char *name, lifx_color_kernel *kernel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COLOR_H */
@@ -0,0 +1,147 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "io.h"
+#include "registry.h"
+#include "scheduler.h"
+
+#define LIFX_DISCOVERY_INTERFACES_MAX 32
+
+typedef void (*lifx_discovery_callback)(const lifx_device_t *device,
+                                        void *ctx);
+
+typedef struct {
+  uint32_t source;
+  uint16_t port;           /* port devices listen on */
+  uint32_t expected;       /* stop once this many answered, 0 for no limit */
+  uint32_t timeout;        /* milliseconds to give up after */
+  uint32_t interval;       /* milliseconds to the second probe */
+  uint32_t max_interval;   /* the interval doubles up to this */
+  uint32_t quiet;          /* milliseconds without a new responder to stop */
+  uint32_t min_probes;     /* probes to send before stopping when quiet */
+  lifx_io_backend backend; /* socket I/O, LIFX_IO_AUTO by default */
+  lifx_discovery_callback callback; /* called for every new responder */
+  void *ctx;
+  uint32_t refresh;        /* milliseconds between lifx_discovery_step rounds */
+  uint32_t stale;          /* milliseconds unseen before a unicast probe */
+  uint32_t dead;           /* milliseconds unseen before removal */
+} lifx_discovery_config_t;
+
+/*
+ * Keeps a registry fresh from the event loop of a long running process,
+ * see lifx_discovery_step. Replies come in on the socket of the caller, which
+ * hands them to lifx_registry_observe.
+ */
+typedef struct {
+  uint32_t source;
+  uint64_t refresh;    /* milliseconds between rounds */
+  uint64_t stale;      /* see lifx_discovery_config_t */
+  uint64_t dead;       /* see lifx_discovery_config_t */
+  uint64_t started;    /* lifx_registry_now at init, devices get dead from it */
+  uint64_t next;       /* when the next round is due, milliseconds */
+  int probing;         /* a round stopped at a frame emit refused */
+  int broadcasts_sent; /* broadcasts of the current round emitted */
+  size_t cursor;       /* registry cursor of the current round */
+  struct sockaddr_in broadcasts[LIFX_DISCOVERY_INTERFACES_MAX];
+  int interfaces;      /* amount of broadcasts */
+  uint64_t probes;     /* GetService frames emitted */
+  uint64_t removed;    /* devices removed as dead */
+} lifx_discovery_t;
+
+/**
+ * @brief Fill in the default discovery configuration.
+ *
+ * Probes at 0, ~50, ~150, ~350 ms and so on, stopping 100 ms after the
+ * responders last changed or after 2 seconds. lifx_discovery_step runs a
+ * round every minute, probes devices unseen for a minute and removes those
+ * unseen for three.
+ *
+ * @param config
+ */
+void lifx_discovery_config_init(lifx_discovery_config_t *config);
+
+/**
+ * @brief Find the broadcast addresses of the local IPv4 interfaces.
+ *
+ * Falls back to 255.255.255.255 when no interface has one. Returns the amount
+ * of addresses written to addrs.
+ *
+ * @param addrs
+ * @param n maximum amount of addresses
+ * @param port set in every address
+ */
+int lifx_discovery_interfaces(struct sockaddr_in *addrs, size_t n,
+                              uint16_t port);
+
+/**
+ * @brief Discover devices into a registry.
+ *
+ * Sends GetService to the broadcast address of every interface at once and
+ * repeats it with a jittered, doubling interval. Stops early when the
+ * expected amount of devices answered or the set of responders stopped
+ * changing. Returns the amount of devices that answered or -1 on error.
+ *
+ * @param registry
+ * @param config
+ */
+int lifx_discover(lifx_registry_t *registry,
+                  const lifx_discovery_config_t *config);
+
+/**
+ * @brief Set up refreshing a registry without blocking.
+ *
+ * Takes source, port, refresh, stale and dead from config. The first round
+ * is due refresh milliseconds after now, run lifx_discover first to start
+ * from a full registry.
+ *
+ * @param discovery
+ * @param config
+ * @param now milliseconds
+ */
+int lifx_discovery_init(lifx_discovery_t *discovery,
+                        const lifx_discovery_config_t *config, uint64_t now);
+
+/**
+ * @brief Run a refresh round when one is due.
+ *
+ * A round removes every device unseen for dead milliseconds, cached or not,
+ * then emits a GetService to the broadcast address of every interface and
+ * one to each device unseen for stale milliseconds, which reaches devices
+ * broadcasts do not and confirms cached ones. Devices loaded before init get
+ * dead milliseconds from init to answer. Ages are measured with
+ * lifx_registry_now.
+ *
+ * The round stops at the first frame emit refuses and resumes there with the
+ * next call. Returns the amount of devices removed.
+ *
+ * @param discovery
+ * @param registry
+ * @param now milliseconds
+ * @param emit a batch to send directly, or the scheduler
+ * @param ctx passed to emit
+ */
+int lifx_discovery_step(lifx_discovery_t *discovery,
+                        lifx_registry_t *registry, uint64_t now,
+                        lifx_scheduler_emit emit, void *ctx);
+
+/**
+ * @brief Milliseconds until lifx_discovery_step has work, 0 when it has now.
+ *
+ * @param discovery
+ * @param now milliseconds
+ */
+int64_t lifx_discovery_next(const lifx_discovery_t *discovery, uint64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DISCOVERY_H */
@@ -8,10 +8,6 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 
-/* NOTE: this will need to be updated to the actual amount */
-#define PAYLOAD_MAX 64
-#define FRAME_SIZE_MAX FRAME_HEADER_SIZE + PAYLOAD_MAX
-
 #define FRAME_HEADER_SIZE 36
 #define FRAME_PROTOCOL 1024
 #define FRAME_ADDRESSABLE 1
@@ -26,22 +22,89 @@ typedef enum {
   RESERVED4,
 } lifx_service;
 
-typedef enum {
-  GetService = 2,
-  StateService = 3,
-  SetPower = 21,
-  GetLabel = 23,
-  StateLabel = 25,
-  Acknowledgement = 45,
-  EchoRequest = 58,
-  EchoResponse = 59,
-  SetColor = 102,
-} lifx_message_type;
+/*
+ * Every message the library knows, one X(name, id, payload size, payload
+ * member) per type. The type enum, the sizes and the codec in frame.c are
+ * generated from it, adding a message takes a line here, its LIFX_FIELDS_
+ * list below and its payload struct.
+ */
+#define LIFX_MESSAGES(X)                                                       \
+  X(GetService, 2, 0, none)                                                    \
+  X(StateService, 3, 5, state_service_payload)                                 \
+  X(SetPower, 21, 2, set_power_payload)                                        \
+  X(StatePower, 22, 2, state_power_payload)                                    \
+  X(GetLabel, 23, 0, none)                                                     \
+  X(StateLabel, 25, 32, state_label_payload)                                   \
+  X(Acknowledgement, 45, 0, none)                                              \
+  X(EchoRequest, 58, 64, echo_request_payload)                                 \
+  X(EchoResponse, 59, 64, echo_response_payload)                               \
+  X(Get, 101, 0, none)                                                         \
+  X(SetColor, 102, 13, set_color_payload)                                      \
+  X(LightState, 107, 52, light_state_payload)
+
+/*
+ * Wire layout of every payload, one F(member, kind, field, offset, length)
+ * per field, member being the payload member of the message. kind is U8, U16
+ * or U32 for little endian integers, BYTES for a fixed size string the
+ * decoder terminates and RESERVED for bytes sent as 0 and ignored.
+ */
+#define LIFX_FIELDS_GetService(F, m)
+#define LIFX_FIELDS_StateService(F, m)                                         \
+  F(m, U8, service, 0, 1)                                                      \
+  F(m, U32, port, 1, 4)
+#define LIFX_FIELDS_SetPower(F, m) F(m, U16, level, 0, 2)
+#define LIFX_FIELDS_StatePower(F, m) F(m, U16, level, 0, 2)
+#define LIFX_FIELDS_GetLabel(F, m)
+#define LIFX_FIELDS_StateLabel(F, m) F(m, BYTES, label, 0, 32)
+#define LIFX_FIELDS_Acknowledgement(F, m)
+#define LIFX_FIELDS_EchoRequest(F, m) F(m, BYTES, echoing, 0, 64)
+#define LIFX_FIELDS_EchoResponse(F, m) F(m, BYTES, echoing, 0, 64)
+#define LIFX_FIELDS_SetColor(F, m)                                             \
+  F(m, RESERVED, reserved, 0, 1)                                               \
+  F(m, U16, hue, 1, 2)                                                         \
+  F(m, U16, saturation, 3, 2)                                                  \
+  F(m, U16, brightness, 5, 2)                                                  \
+  F(m, U16, kelvin, 7, 2)                                                      \
+  F(m, U32, duration, 9, 4)
+#define LIFX_FIELDS_Get(F, m)
+#define LIFX_FIELDS_LightState(F, m)                                           \
+  F(m, U16, hue, 0, 2)                                                         \
+  F(m, U16, saturation, 2, 2)                                                  \
+  F(m, U16, brightness, 4, 2)                                                  \
+  F(m, U16, kelvin, 6, 2)                                                      \
+  F(m, RESERVED, reserved0, 8, 2)                                              \
+  F(m, U16, power, 10, 2)                                                      \
+  F(m, BYTES, label, 12, 32)                                                   \
+  F(m, RESERVED, reserved1, 44, 8)
+
+#define LIFX_MESSAGE_TYPE(name, id, size, member) name = id,
+typedef enum { LIFX_MESSAGES(LIFX_MESSAGE_TYPE) } lifx_message_type;
+
+/* LIFX_PAYLOAD_SIZE_SetColor and so on, the payload bytes on the wire */
+#define LIFX_PAYLOAD_SIZE(name, id, size, member)                              \
+  LIFX_PAYLOAD_SIZE_##name = size,
+enum { LIFX_MESSAGES(LIFX_PAYLOAD_SIZE) };
+
+/* Size of a frame of a type named at compile time, LIFX_FRAME_SIZE(SetColor) */
+#define LIFX_FRAME_SIZE(name) (FRAME_HEADER_SIZE + LIFX_PAYLOAD_SIZE_##name)
+
+/* As large as the largest payload, plus one so empty payloads are valid */
+#define LIFX_PAYLOAD_SPACE(name, id, size, member) uint8_t name[(size) + 1];
+union lifx_payload_space {
+  LIFX_MESSAGES(LIFX_PAYLOAD_SPACE)
+};
+
+#define PAYLOAD_MAX (sizeof(union lifx_payload_space) - 1)
+#define FRAME_SIZE_MAX (FRAME_HEADER_SIZE + PAYLOAD_MAX)
 
 typedef struct {
   uint16_t level;
 } lifx_set_power_payload_t;
 
+typedef struct {
+  uint16_t level;
+} lifx_state_power_payload_t;
+
 typedef struct {
   uint16_t hue;
   uint16_t saturation;
@@ -50,6 +113,15 @@ typedef struct {
   uint32_t duration;
 } lifx_set_color_payload_t;
 
+typedef struct {
+  uint16_t hue;
+  uint16_t saturation;
+  uint16_t brightness;
+  uint16_t kelvin;
+  uint16_t power;
+  uint8_t label[33];
+} lifx_light_state_payload_t;
+
 typedef struct {
   uint8_t label[33];
 } lifx_state_label_payload_t;
@@ -70,10 +142,12 @@ typedef struct {
 typedef union {
   lifx_state_service_payload_t state_service_payload;
   lifx_set_power_payload_t set_power_payload;
+  lifx_state_power_payload_t state_power_payload;
   lifx_state_label_payload_t state_label_payload;
   lifx_echo_request_payload_t echo_request_payload;
   lifx_echo_response_payload_t echo_response_payload;
   lifx_set_color_payload_t set_color_payload;
+  lifx_light_state_payload_t light_state_payload;
 } lifx_payload_t;
 
 typedef struct {
@@ -97,10 +171,21 @@ typedef struct {
   lifx_payload_t payload;
 } lifx_frame_t;
 
+/**
+ * @brief Size of a frame of a type on the wire, header included.
+ *
+ * Returns -1 for a type the library does not know.
+ *
+ * @param type
+ */
+int lifx_frame_size(lifx_message_type type);
+
 /**
  * @brief Encode a lifx frame.
  *
- * Encodes a frame into a buffer that can be sent over the wire.
+ * Encodes a frame into a buffer that can be sent over the wire. The size
+ * field is filled in from the type, header.size is ignored. Fails for types
+ * the library does not know.
  *
  * @param frame
  * @param buf
@@ -109,11 +194,57 @@ typedef struct {
 int lifx_encode_frame(const lifx_frame_t *frame, uint8_t *const *buf,
                       const size_t n);
 
+/**
+ * @brief Pre-encoded frame header.
+ *
+ * The wire bytes of a header that only differs between frames in size,
+ * sequence and type. Build one per device and reuse it for every frame sent
+ * to that device.
+ */
+typedef struct {
+  uint8_t bytes[FRAME_HEADER_SIZE];
+} lifx_header_template_t;
+
+/**
+ * @brief Encode a header template.
+ *
+ * Encodes the target, source, tagged and flag fields of header once. The
+ * size, sequence and type of header are ignored, they are patched in by
+ * lifx_encode_templated_frame.
+ *
+ * @param tmpl
+ * @param header
+ */
+int lifx_encode_header_template(lifx_header_template_t *tmpl,
+                                const lifx_header_t *header);
+
+/**
+ * @brief Encode a lifx frame from a header template.
+ *
+ * Copies the template into buf, patches in size, sequence and type and
+ * encodes the payload after it. Produces the same bytes as lifx_encode_frame
+ * given the header the template was built from.
+ *
+ * @param tmpl
+ * @param sequence
+ * @param type
+ * @param payload may be NULL for types without a payload
+ * @param buf
+ * @param n maximum amount of bytes in buf
+ */
+int lifx_encode_templated_frame(const lifx_header_template_t *tmpl,
+                                uint8_t sequence, lifx_message_type type,
+                                const lifx_payload_t *payload,
+                                uint8_t *const *buf, const size_t n);
+
 /**
  * @brief Decode a lifx buffer.
  *
+ * Decodes a buffer into a lifx frame. A frame of a type the library does not
+ * know only has its header decoded, its payload is skipped and left as is.
+ * Returns the amount of bytes decoded or -1 when buf is too short for the
+ * type.
  *
- * Decodes a buffer into a lifx frame
  *  @param frame
  *  @param buffer
  *  @param n maximum size of buffer
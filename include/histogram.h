@@ -0,0 +1,97 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Buckets are log-linear: values below 2^LIFX_HISTOGRAM_BITS get a bucket
+ * each, above that every power of two is split into 2^(LIFX_HISTOGRAM_BITS - 1)
+ * buckets, so any value is recorded within 1 / 2^(LIFX_HISTOGRAM_BITS - 1) of
+ * its real value. Values from 2^LIFX_HISTOGRAM_MAX_BITS up share the last
+ * bucket.
+ */
+#define LIFX_HISTOGRAM_BITS 6
+#define LIFX_HISTOGRAM_MAX_BITS 40
+#define LIFX_HISTOGRAM_BUCKETS                                                 \
+  ((LIFX_HISTOGRAM_MAX_BITS - LIFX_HISTOGRAM_BITS + 2)                         \
+   << (LIFX_HISTOGRAM_BITS - 1))
+
+/*
+ * A latency histogram with a fixed relative precision, in the style of
+ * HdrHistogram. Recording is a couple of shifts and an increment, there is
+ * nothing to allocate.
+ */
+typedef struct {
+  uint32_t counts[LIFX_HISTOGRAM_BUCKETS];
+  uint64_t count; /* values recorded */
+  uint64_t sum;   /* sum of the values recorded */
+  uint64_t min;   /* smallest value, UINT64_MAX when empty */
+  uint64_t max;   /* largest value */
+} lifx_histogram_t;
+
+/**
+ * @brief Empty a histogram.
+ *
+ * @param histogram
+ */
+void lifx_histogram_init(lifx_histogram_t *histogram);
+
+/**
+ * @brief Record a value.
+ *
+ * @param histogram
+ * @param value
+ */
+void lifx_histogram_record(lifx_histogram_t *histogram, uint64_t value);
+
+/**
+ * @brief Add every value recorded in src to dst.
+ *
+ * @param dst
+ * @param src
+ */
+void lifx_histogram_merge(lifx_histogram_t *dst, const lifx_histogram_t *src);
+
+/**
+ * @brief Value at a quantile.
+ *
+ * Returns the largest value in the bucket holding the quantile, clamped to
+ * the largest value recorded, or 0 when the histogram is empty.
+ *
+ * @param histogram
+ * @param quantile between 0 and 1, 0.99 for the 99th percentile
+ */
+uint64_t lifx_histogram_quantile(const lifx_histogram_t *histogram,
+                                 double quantile);
+
+/**
+ * @brief Mean of the recorded values, 0 when the histogram is empty.
+ *
+ * @param histogram
+ */
+double lifx_histogram_mean(const lifx_histogram_t *histogram);
+
+/**
+ * @brief Index of the bucket a value is recorded in.
+ *
+ * @param value
+ */
+size_t lifx_histogram_bucket(uint64_t value);
+
+/**
+ * @brief Largest value recorded in a bucket.
+ *
+ * @param index
+ */
+uint64_t lifx_histogram_bucket_value(size_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,133 @@
+#ifndef IO_H
+#define IO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "batch.h"
+#include "receiver.h"
+#include "view.h"
+
+typedef enum {
+  LIFX_IO_AUTO = 0, /* io_uring when the kernel allows it, epoll otherwise */
+  LIFX_IO_EPOLL,    /* epoll with recvmmsg and sendmmsg */
+  LIFX_IO_URING,    /* io_uring, only when built with LIFX_HAVE_IO_URING */
+} lifx_io_backend;
+
+/*
+ * Datagram I/O on one UDP socket behind a backend picked at runtime.
+ *
+ * The epoll backend waits on an epoll instance and then moves datagrams with
+ * recvmmsg and sendmmsg. The io_uring backend keeps one multishot receive
+ * armed over a ring of buffers registered with the kernel, so received
+ * datagrams land without any syscall per receive, and submits every frame of
+ * a batch in one io_uring_enter. Only the receive buffers are registered,
+ * frames are sent straight from the batch.
+ *
+ * Either way received frames are left as views, valid until the next
+ * lifx_io_recv.
+ */
+typedef struct {
+  lifx_io_backend backend;        /* backend in use, never LIFX_IO_AUTO */
+  int sfd;
+  size_t depth;                   /* maximum datagrams per lifx_io_recv */
+  lifx_frame_view_t *views;       /* views of the last lifx_io_recv */
+  struct sockaddr_storage *addrs; /* sender address of view i */
+  size_t count;                   /* amount of views */
+  size_t dropped;                 /* datagrams that failed to decode */
+  uint64_t syscalls;              /* syscalls made sending and receiving */
+  lifx_receiver_t receiver;       /* epoll backend */
+  int epfd;                       /* epoll backend */
+  int watch;                      /* see lifx_io_watch, -1 when unset */
+  struct lifx_uring *uring;       /* io_uring backend */
+} lifx_io_t;
+
+/**
+ * @brief Set up I/O on a socket.
+ *
+ * LIFX_IO_AUTO tries io_uring first and falls back to epoll when it is not
+ * built in or the kernel refuses it. Asking for LIFX_IO_URING fails instead,
+ * with errno set to ENOSYS when it is not built in.
+ *
+ * @param io
+ * @param sfd UDP socket, not owned by io
+ * @param depth maximum amount of datagrams received per call
+ * @param backend
+ */
+int lifx_io_init(lifx_io_t *io, int sfd, size_t depth,
+                 lifx_io_backend backend);
+
+/**
+ * @brief Free the memory held by an I/O set up.
+ *
+ * @param io
+ */
+void lifx_io_free(lifx_io_t *io);
+
+/**
+ * @brief Receive a batch of frames without decoding them.
+ *
+ * Waits up to timeout milliseconds (-1 waits forever, 0 not at all) for a
+ * datagram, then takes every one received up to depth. Datagrams that are
+ * not frames are skipped and counted in dropped. Returns the amount of
+ * views, 0 on timeout and -1 on error.
+ *
+ * @param io
+ * @param timeout in milliseconds
+ */
+int lifx_io_recv(lifx_io_t *io, int timeout);
+
+/**
+ * @brief Send the unsent frames of a batch.
+ *
+ * Frames go out in order, sending stops at the first one the socket would
+ * block on and calling it again resumes there, like lifx_batch_send. With
+ * io_uring on a blocking socket the frames of one call may leave out of
+ * order once the socket buffer fills up. Returns the amount of frames sent
+ * by this call or -1 on error.
+ *
+ * @param io
+ * @param batch
+ */
+int lifx_io_send(lifx_io_t *io, lifx_batch_t *batch);
+
+/**
+ * @brief Also wake lifx_io_recv when a descriptor becomes readable.
+ *
+ * Lets a loop sleeping on the socket be woken by another event source, such
+ * as an eventfd or a FIFO. lifx_io_recv then returns, with 0 views when
+ * nothing was received, and the caller checks fd itself. Only one
+ * descriptor can be watched, it must stay open while it is.
+ *
+ * @param io
+ * @param fd
+ */
+int lifx_io_watch(lifx_io_t *io, int fd);
+
+/**
+ * @brief Name of a backend, "epoll" or "io_uring".
+ *
+ * @param backend
+ */
+const char *lifx_io_backend_name(lifx_io_backend backend);
+
+/**
+ * @brief Parse a backend name, "auto", "epoll" or "io_uring".
+ *
+ * Returns -1 when the name is unknown.
+ *
+ * @param name
+ * @param backend
+ */
+int lifx_io_backend_parse(const char *name, lifx_io_backend *backend);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IO_H */
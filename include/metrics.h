@@ -0,0 +1,210 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+/* Message types counted one by one, higher ones are counted as type 0 */
+#define LIFX_METRICS_TYPES 128
+
+/* Counters kept globally and for every target */
+typedef enum {
+  LIFX_METRIC_SENT = 0,
+  LIFX_METRIC_RECEIVED,
+  LIFX_METRIC_ENCODE_ERRORS,
+  LIFX_METRIC_DECODE_ERRORS,
+  LIFX_METRIC_RETRIES,
+  LIFX_METRIC_TIMEOUTS,
+  LIFX_METRIC_DROPS,       /* frames the rate limiter refused */
+  LIFX_METRIC_COALESCED,   /* frames replaced by a newer one */
+  LIFX_METRIC_ACKS,        /* acknowledgements timed */
+  LIFX_METRIC_ACK_RTT_SUM, /* microseconds */
+  LIFX_METRIC_ACK_RTT_MAX, /* microseconds, merged by taking the largest */
+  LIFX_METRIC_COUNT,
+} lifx_metric;
+
+typedef struct {
+  uint64_t values[LIFX_METRIC_COUNT];
+} lifx_metrics_counters_t;
+
+/*
+ * Counters of one thread. Only the thread owning a shard writes to it, with
+ * relaxed atomic stores, so recording is a plain load, add and store with no
+ * locked instruction. Targets live in an open addressing table allocated up
+ * front, a target arriving when it is full is only counted globally.
+ */
+typedef struct lifx_metrics_shard lifx_metrics_shard_t;
+struct lifx_metrics_shard {
+  lifx_metrics_shard_t *next; /* next shard of the same metrics */
+  lifx_metrics_counters_t global;
+  uint64_t sent[LIFX_METRICS_TYPES];
+  uint64_t received[LIFX_METRICS_TYPES];
+  /* ack round trips by histogram bucket, in microseconds */
+  uint64_t ack_rtt[LIFX_HISTOGRAM_BUCKETS];
+  uint64_t *keys;  /* target of every slot, 0 when empty */
+  lifx_metrics_counters_t *targets;
+  size_t capacity; /* table size, a power of 2 */
+  size_t count;    /* targets in the table */
+  size_t max_targets;
+};
+
+/*
+ * A set of shards, one per recording thread, merged on read. Shards are
+ * pushed onto a lock-free list and never removed until lifx_metrics_free.
+ */
+typedef struct {
+  lifx_metrics_shard_t *shards;
+  size_t max_targets; /* targets tracked per shard */
+} lifx_metrics_t;
+
+/*
+ * Merged counters. Preallocated by lifx_metrics_snapshot_init so taking a
+ * snapshot allocates nothing.
+ */
+typedef struct {
+  lifx_metrics_counters_t global;
+  uint64_t sent[LIFX_METRICS_TYPES];     /* frames sent by message type */
+  uint64_t received[LIFX_METRICS_TYPES]; /* frames received by message type */
+  lifx_histogram_t ack_rtt;              /* microseconds */
+  uint64_t *keys;                        /* target, 0 when empty */
+  lifx_metrics_counters_t *targets;
+  size_t capacity;                       /* table size, a power of 2 */
+  size_t count;                          /* targets in the table */
+  size_t max_targets;
+  size_t shards;                         /* shards merged */
+} lifx_metrics_snapshot_t;
+
+/**
+ * @brief Set up an empty set of metrics.
+ *
+ * @param metrics
+ * @param max_targets maximum amount of targets each thread tracks
+ */
+int lifx_metrics_init(lifx_metrics_t *metrics, size_t max_targets);
+
+/**
+ * @brief Free every shard.
+ *
+ * No thread may record or snapshot anymore.
+ *
+ * @param metrics
+ */
+void lifx_metrics_free(lifx_metrics_t *metrics);
+
+/**
+ * @brief Add a shard for the calling thread.
+ *
+ * Safe to call from any thread at any time. Returns NULL when out of memory.
+ *
+ * @param metrics
+ */
+lifx_metrics_shard_t *lifx_metrics_shard(lifx_metrics_t *metrics);
+
+/**
+ * @brief Add to a counter of a target and to the global counter.
+ *
+ * A target of 0 only adds to the global counter.
+ *
+ * @param shard
+ * @param target target bytes as a little endian integer
+ * @param metric
+ * @param n
+ */
+void lifx_metrics_add(lifx_metrics_shard_t *shard, uint64_t target,
+                      lifx_metric metric, uint64_t n);
+
+/**
+ * @brief Count a frame sent.
+ *
+ * @param shard
+ * @param target target bytes as a little endian integer
+ * @param type
+ */
+void lifx_metrics_sent(lifx_metrics_shard_t *shard, uint64_t target,
+                       uint16_t type);
+
+/**
+ * @brief Count a frame received.
+ *
+ * @param shard
+ * @param target target bytes as a little endian integer
+ * @param type
+ */
+void lifx_metrics_received(lifx_metrics_shard_t *shard, uint64_t target,
+                           uint16_t type);
+
+/**
+ * @brief Record the round trip of an acknowledgement.
+ *
+ * @param shard
+ * @param target target bytes as a little endian integer
+ * @param rtt microseconds
+ */
+void lifx_metrics_ack(lifx_metrics_shard_t *shard, uint64_t target,
+                      uint64_t rtt);
+
+/**
+ * @brief Allocate a snapshot.
+ *
+ * @param snapshot
+ * @param max_targets maximum amount of targets merged, further ones are only
+ * counted globally
+ */
+int lifx_metrics_snapshot_init(lifx_metrics_snapshot_t *snapshot,
+                               size_t max_targets);
+
+/**
+ * @brief Free the memory held by a snapshot.
+ *
+ * @param snapshot
+ */
+void lifx_metrics_snapshot_free(lifx_metrics_snapshot_t *snapshot);
+
+/**
+ * @brief Merge every shard into a snapshot.
+ *
+ * Lock-free, may run on any thread while others record. Each counter is read
+ * atomically but counters are not read at one instant, so a snapshot may
+ * count a retry before the frame it resent.
+ *
+ * @param metrics
+ * @param snapshot overwritten
+ */
+void lifx_metrics_snapshot(const lifx_metrics_t *metrics,
+                           lifx_metrics_snapshot_t *snapshot);
+
+/**
+ * @brief Counters of a target in a snapshot, NULL when it has none.
+ *
+ * @param snapshot
+ * @param target
+ */
+const lifx_metrics_counters_t *
+lifx_metrics_snapshot_find(const lifx_metrics_snapshot_t *snapshot,
+                           const uint8_t target[8]);
+
+/**
+ * @brief Iterate the targets of a snapshot.
+ *
+ * Start with *cursor set to 0. Writes the target and returns its counters,
+ * or NULL once every target was visited.
+ *
+ * @param snapshot
+ * @param cursor
+ * @param target
+ */
+const lifx_metrics_counters_t *
+lifx_metrics_snapshot_next(const lifx_metrics_snapshot_t *snapshot,
+                           size_t *cursor, uint8_t target[8]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METRICS_H */
@@ -0,0 +1,197 @@
+#ifndef MIRROR_H
+#define MIRROR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+#include "registry.h"
+#include "scheduler.h"
+
+/* Fields of a light, as passed to subscribers */
+#define LIFX_MIRROR_HUE 1
+#define LIFX_MIRROR_SATURATION 2
+#define LIFX_MIRROR_BRIGHTNESS 4
+#define LIFX_MIRROR_KELVIN 8
+#define LIFX_MIRROR_POWER 16
+#define LIFX_MIRROR_COLOR                                                      \
+  (LIFX_MIRROR_HUE | LIFX_MIRROR_SATURATION | LIFX_MIRROR_BRIGHTNESS |        \
+   LIFX_MIRROR_KELVIN)
+
+#define LIFX_MIRROR_SUBSCRIBERS_MAX 8
+
+typedef struct lifx_mirror lifx_mirror_t;
+
+/**
+ * @brief Called when fields of a light changed.
+ *
+ * The new values are in row of the mirror.
+ *
+ * @param ctx given to lifx_mirror_subscribe
+ * @param mirror
+ * @param row
+ * @param changed LIFX_MIRROR_ fields that changed
+ */
+typedef void (*lifx_mirror_callback)(void *ctx, const lifx_mirror_t *mirror,
+                                     size_t row, uint8_t changed);
+
+typedef struct {
+  lifx_mirror_callback callback;
+  void *ctx;
+} lifx_mirror_subscriber_t;
+
+typedef struct {
+  uint64_t polled;  /* Get frames emitted */
+  uint64_t states;  /* LightState and StatePower frames observed */
+  uint64_t changes; /* states that changed a field */
+} lifx_mirror_stats_t;
+
+/*
+ * Last known state of every light, kept up to date by polling each one with
+ * Get. The state is a struct of arrays, one row per light: a pass over the
+ * brightness of every light reads only brightness. Rows are dense and never
+ * move, so row i of every array belongs to targets[i]. An open addressing
+ * index like the one of lifx_registry_t maps targets to rows. All memory is
+ * allocated by lifx_mirror_init.
+ *
+ * Polls are spread evenly over the interval, row i going out i / count of
+ * the way through it, so a thousand lights cost a steady trickle instead of
+ * a burst of a thousand frames and replies.
+ */
+struct lifx_mirror {
+  uint64_t *keys;              /* index, target as a little endian integer */
+  uint32_t *rows;              /* rows[i] is the row of keys[i] */
+  size_t capacity;             /* index size, a power of 2 */
+
+  uint64_t *targets;
+  struct sockaddr_in *addrs;
+  uint16_t *hue;
+  uint16_t *saturation;
+  uint16_t *brightness;
+  uint16_t *kelvin;
+  uint16_t *power;
+  uint8_t *known;              /* LIFX_MIRROR_ fields received at least once */
+  uint64_t *updated;           /* milliseconds of the last state, 0 if none */
+  size_t count;                /* rows in use */
+  size_t max_devices;
+
+  uint64_t interval;           /* milliseconds to poll every row once */
+  uint64_t round_start;        /* when the current round of polls began */
+  size_t cursor;               /* next row to poll in the round */
+  uint32_t source;
+  uint8_t sequence;
+
+  lifx_mirror_subscriber_t subscribers[LIFX_MIRROR_SUBSCRIBERS_MAX];
+  size_t subscriber_count;
+  lifx_mirror_stats_t stats;
+};
+
+/**
+ * @brief Allocate a mirror.
+ *
+ * @param mirror
+ * @param max_devices
+ * @param interval milliseconds between two polls of a light
+ * @param source of the Get frames, replies carry it back
+ */
+int lifx_mirror_init(lifx_mirror_t *mirror, size_t max_devices,
+                     uint64_t interval, uint32_t source);
+
+/**
+ * @brief Free the memory held by a mirror.
+ *
+ * @param mirror
+ */
+void lifx_mirror_free(lifx_mirror_t *mirror);
+
+/**
+ * @brief Start mirroring a light or update its address.
+ *
+ * Returns the row of the light, -1 when target is 0 or the mirror is full.
+ *
+ * @param mirror
+ * @param target
+ * @param addr where to send Get frames
+ */
+int lifx_mirror_add(lifx_mirror_t *mirror, const uint8_t target[8],
+                    const struct sockaddr_in *addr);
+
+/**
+ * @brief Add every device of a registry whose service is known.
+ *
+ * Returns the amount of rows added, -1 when the mirror is full.
+ *
+ * @param mirror
+ * @param registry
+ */
+int lifx_mirror_sync(lifx_mirror_t *mirror, const lifx_registry_t *registry);
+
+/**
+ * @brief Row of a light, -1 when it is not mirrored.
+ *
+ * @param mirror
+ * @param target
+ */
+int lifx_mirror_find(const lifx_mirror_t *mirror, const uint8_t target[8]);
+
+/**
+ * @brief Call callback whenever a field of a light changes.
+ *
+ * The first state received for a light counts as a change of every field it
+ * carries. Returns -1 when LIFX_MIRROR_SUBSCRIBERS_MAX are subscribed.
+ *
+ * @param mirror
+ * @param callback
+ * @param ctx passed to callback
+ */
+int lifx_mirror_subscribe(lifx_mirror_t *mirror,
+                          lifx_mirror_callback callback, void *ctx);
+
+/**
+ * @brief Emit a Get for every light due to be polled.
+ *
+ * Returns the amount of frames emitted. Polling stops at the first frame
+ * emit refuses, that light stays due and goes out with the next call.
+ *
+ * @param mirror
+ * @param now milliseconds
+ * @param emit lifx_scheduler_submit behind an emit function to share the rate
+ * limit of each device, or a batch to send directly
+ * @param ctx passed to emit
+ */
+int lifx_mirror_poll(lifx_mirror_t *mirror, uint64_t now,
+                     lifx_scheduler_emit emit, void *ctx);
+
+/**
+ * @brief Milliseconds until the next light is due, -1 when there are none.
+ *
+ * @param mirror
+ * @param now milliseconds
+ */
+int64_t lifx_mirror_next(const lifx_mirror_t *mirror, uint64_t now);
+
+/**
+ * @brief Learn from a received frame.
+ *
+ * LightState updates the color and power of a mirrored light and StatePower
+ * its power, whoever asked for them. Subscribers are called when a field
+ * changed. Returns the LIFX_MIRROR_ fields that changed, 0 for other frames
+ * and unknown lights.
+ *
+ * @param mirror
+ * @param frame
+ * @param now milliseconds
+ */
+int lifx_mirror_observe(lifx_mirror_t *mirror, const lifx_frame_t *frame,
+                        uint64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MIRROR_H */
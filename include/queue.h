@@ -0,0 +1,160 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "batch.h"
+#include "frame.h"
+
+/* Bytes between the producer and consumer ends, so they do not share a
+ * cache line */
+#define LIFX_QUEUE_PAD 64
+
+/* A frame to send, either decoded or already encoded */
+typedef struct {
+  struct sockaddr_in addr; /* destination */
+  uint16_t size;           /* bytes in packet, 0 when frame is set instead */
+  union {
+    lifx_frame_t frame;
+    uint8_t packet[FRAME_SIZE_MAX];
+  };
+} lifx_command_t;
+
+typedef struct {
+  uint64_t turn; /* position the cell is next written or read at, see below */
+  lifx_command_t command;
+} lifx_queue_cell_t;
+
+/*
+ * Bounded multi-producer single-consumer queue of send commands, so any
+ * amount of threads can hand frames to the one thread owning the socket.
+ *
+ * Every cell carries the position it is next valid at: producers claim a
+ * position with a compare and swap on head, write the cell and then publish
+ * it by moving its turn to position + 1. The consumer reads cells in order
+ * and hands them back by moving their turn a lap ahead. Pushing never
+ * blocks, a full queue fails instead.
+ *
+ * An eventfd wakes the consumer, producers only write to it when the
+ * consumer said it is about to sleep, so a busy consumer costs producers
+ * no syscall.
+ */
+typedef struct {
+  lifx_queue_cell_t *cells;
+  size_t mask;      /* cells - 1, the amount is a power of 2 */
+  int efd;          /* eventfd, readable when woken */
+  uint8_t pad0[LIFX_QUEUE_PAD];
+  uint64_t head;    /* next position producers claim */
+  uint64_t full;    /* pushes that found the queue full */
+  uint8_t pad1[LIFX_QUEUE_PAD];
+  uint64_t tail;    /* next position the consumer reads */
+  uint32_t waiting; /* consumer is about to sleep */
+  uint64_t invalid; /* commands that failed to encode */
+} lifx_queue_t;
+
+/**
+ * @brief Allocate a queue.
+ *
+ * @param queue
+ * @param capacity minimum amount of commands queued at once, rounded up to a
+ * power of 2
+ */
+int lifx_queue_init(lifx_queue_t *queue, size_t capacity);
+
+/**
+ * @brief Free the memory held by a queue.
+ *
+ * No thread may use the queue anymore.
+ *
+ * @param queue
+ */
+void lifx_queue_free(lifx_queue_t *queue);
+
+/**
+ * @brief Queue a frame, from any thread.
+ *
+ * The frame is encoded by the consumer. Returns -1 with errno set to EAGAIN
+ * when the queue is full.
+ *
+ * @param queue
+ * @param frame
+ * @param addr destination
+ */
+int lifx_queue_push(lifx_queue_t *queue, const lifx_frame_t *frame,
+                    const struct sockaddr_in *addr);
+
+/**
+ * @brief Queue an encoded frame, from any thread.
+ *
+ * Returns -1 with errno set to EAGAIN when the queue is full, or to EINVAL
+ * when size is 0 or above FRAME_SIZE_MAX.
+ *
+ * @param queue
+ * @param packet
+ * @param size bytes in packet
+ * @param addr destination
+ */
+int lifx_queue_push_packet(lifx_queue_t *queue, const uint8_t *packet,
+                           size_t size, const struct sockaddr_in *addr);
+
+/**
+ * @brief Move queued commands into a batch, consumer only.
+ *
+ * Takes commands until the queue is empty or the batch is full. Frames that
+ * fail to encode are skipped and counted in invalid. Returns the amount of
+ * commands taken.
+ *
+ * @param queue
+ * @param batch
+ */
+int lifx_queue_drain(lifx_queue_t *queue, lifx_batch_t *batch);
+
+/**
+ * @brief Announce the consumer is about to sleep on lifx_queue_fd.
+ *
+ * Returns 1 when commands are already queued and the consumer should drain
+ * instead of sleeping, 0 otherwise. Once the descriptor is readable call
+ * lifx_queue_wake.
+ *
+ * @param queue
+ */
+int lifx_queue_arm(lifx_queue_t *queue);
+
+/**
+ * @brief Clear the descriptor after the consumer woke up.
+ *
+ * @param queue
+ */
+void lifx_queue_wake(lifx_queue_t *queue);
+
+/**
+ * @brief Sleep until commands are queued, consumer only.
+ *
+ * Waits up to timeout milliseconds (-1 waits forever, 0 not at all). Returns
+ * 1 when commands are queued, 0 on timeout and -1 on error.
+ *
+ * @param queue
+ * @param timeout in milliseconds
+ */
+int lifx_queue_wait(lifx_queue_t *queue, int timeout);
+
+/**
+ * @brief The eventfd of a queue, readable once producers wake the consumer.
+ *
+ * Lets the consumer sleep in its own event loop, see lifx_queue_arm.
+ *
+ * @param queue
+ */
+int lifx_queue_fd(const lifx_queue_t *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUEUE_H */
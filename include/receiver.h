@@ -0,0 +1,87 @@
+#ifndef RECEIVER_H
+#define RECEIVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "frame.h"
+#include "metrics.h"
+#include "view.h"
+
+/*
+ * Batched receive engine. Drains a socket with recvmmsg into a set of
+ * datagram buffers allocated once and reused by every call, then decodes the
+ * whole batch in one pass.
+ */
+typedef struct {
+  uint8_t *buffers;                /* depth buffers of FRAME_SIZE_MAX bytes */
+  struct iovec *iov;               /* iov[i] is buffer i */
+  struct mmsghdr *msgs;            /* recvmmsg table */
+  struct sockaddr_storage *names;  /* sender address of datagram i */
+  lifx_frame_t *frames;            /* decoded frames of the last call */
+  lifx_frame_view_t *views;        /* views of the last call */
+  struct sockaddr_storage *addrs;  /* sender address of frame i */
+  size_t count;                    /* amount of frames or views */
+  size_t depth;                    /* maximum datagrams per call */
+  size_t dropped;                  /* datagrams that failed to decode */
+  size_t truncated;                /* datagrams over FRAME_SIZE_MAX, dropped */
+  lifx_metrics_shard_t *metrics;   /* optional, counts every datagram */
+} lifx_receiver_t;
+
+/**
+ * @brief Allocate a receiver.
+ *
+ * @param receiver
+ * @param depth maximum amount of datagrams read per call
+ */
+int lifx_receiver_init(lifx_receiver_t *receiver, size_t depth);
+
+/**
+ * @brief Free the memory held by a receiver.
+ *
+ * @param receiver
+ */
+void lifx_receiver_free(lifx_receiver_t *receiver);
+
+/**
+ * @brief Receive and decode a batch of frames.
+ *
+ * Waits up to timeout milliseconds (-1 waits forever, 0 not at all) for sfd
+ * to become readable, then reads every queued datagram up to depth and
+ * decodes them. Datagrams that fail to decode are skipped and counted in
+ * dropped, so are datagrams too large for a buffer, which are counted in
+ * truncated as well. The decoded frames and their senders are left in frames and addrs.
+ * When metrics is set every frame is counted in it.
+ *
+ * Returns the amount of frames decoded, 0 on timeout and -1 on error.
+ *
+ * @param receiver
+ * @param sfd
+ * @param timeout in milliseconds
+ */
+int lifx_receiver_recv(lifx_receiver_t *receiver, int sfd, int timeout);
+
+/**
+ * @brief Receive a batch of frames without decoding them.
+ *
+ * Like lifx_receiver_recv but leaves a view of each frame in views instead of
+ * decoding into frames. The views point into the receiver buffers and stay
+ * valid until the next call.
+ *
+ * @param receiver
+ * @param sfd
+ * @param timeout in milliseconds
+ */
+int lifx_receiver_recv_views(lifx_receiver_t *receiver, int sfd, int timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RECEIVER_H */
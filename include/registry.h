@@ -0,0 +1,122 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+#define LIFX_DEVICE_SERVICE 1 /* address and port known from StateService */
+#define LIFX_DEVICE_LABEL 2   /* label known from StateLabel */
+#define LIFX_DEVICE_CACHED 4  /* loaded from a cache, not confirmed yet */
+
+typedef struct {
+  uint8_t target[8];
+  struct sockaddr_in addr; /* where to send, port is the service port */
+  uint64_t last_seen;      /* milliseconds since the epoch */
+  uint8_t flags;
+  uint8_t label[33];
+} lifx_device_t;
+
+/*
+ * Devices by target. Open addressing with linear probing over an array of
+ * bare 8 byte keys, so a lookup walks one or two cache lines of keys before
+ * touching the device record it finds. Target 0 marks an empty slot, no
+ * device has it. All memory is allocated by lifx_registry_init, lookups and
+ * inserts never allocate.
+ */
+typedef struct {
+  uint64_t *keys;         /* target bytes as a little endian integer */
+  lifx_device_t *devices; /* devices[i] belongs to keys[i] */
+  size_t capacity;        /* table size, a power of 2 */
+  size_t count;           /* devices in the table */
+  size_t max_devices;
+} lifx_registry_t;
+
+/**
+ * @brief Allocate a registry.
+ *
+ * @param registry
+ * @param max_devices
+ */
+int lifx_registry_init(lifx_registry_t *registry, size_t max_devices);
+
+/**
+ * @brief Free the memory held by a registry.
+ *
+ * @param registry
+ */
+void lifx_registry_free(lifx_registry_t *registry);
+
+/**
+ * @brief Current time in the unit of last_seen.
+ */
+uint64_t lifx_registry_now(void);
+
+/**
+ * @brief Look up a device, NULL when unknown.
+ *
+ * @param registry
+ * @param target
+ */
+lifx_device_t *lifx_registry_find(const lifx_registry_t *registry,
+                                  const uint8_t target[8]);
+
+/**
+ * @brief Look up a device or add a blank one for target.
+ *
+ * NULL when target is 0 or the registry is full.
+ *
+ * @param registry
+ * @param target
+ */
+lifx_device_t *lifx_registry_insert(lifx_registry_t *registry,
+                                    const uint8_t target[8]);
+
+/**
+ * @brief Remove a device. Returns -1 when it is unknown.
+ *
+ * Pointers to other devices may move.
+ *
+ * @param registry
+ * @param target
+ */
+int lifx_registry_remove(lifx_registry_t *registry, const uint8_t target[8]);
+
+/**
+ * @brief Learn from a received frame.
+ *
+ * StateService adds the sender and its service port and confirms a cached
+ * device, StateLabel stores the label of a known device and any frame
+ * refreshes last_seen of a known device. Returns 1 when a device was added, 0
+ * when not and -1 when the registry is full.
+ *
+ * @param registry
+ * @param frame
+ * @param from sender of frame
+ * @param now see lifx_registry_now
+ */
+int lifx_registry_observe(lifx_registry_t *registry, const lifx_frame_t *frame,
+                          const struct sockaddr_in *from, uint64_t now);
+
+/**
+ * @brief Iterate over the devices.
+ *
+ * Start with *cursor at 0, returns NULL after the last device.
+ *
+ * @param registry
+ * @param cursor
+ */
+lifx_device_t *lifx_registry_next(const lifx_registry_t *registry,
+                                  size_t *cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REGISTRY_H */
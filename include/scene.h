@@ -0,0 +1,85 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mirror.h"
+#include "scheduler.h"
+
+/* Differences below which a light counts as already showing the scene */
+#define LIFX_SCENE_HUE_TOLERANCE 182 /* about 1 degree */
+#define LIFX_SCENE_SATURATION_TOLERANCE 655
+#define LIFX_SCENE_BRIGHTNESS_TOLERANCE 655
+#define LIFX_SCENE_KELVIN_TOLERANCE 50
+
+/* What a scene wants one light to show */
+typedef struct {
+  uint8_t target[8];
+  uint16_t hue;
+  uint16_t saturation;
+  uint16_t brightness;
+  uint16_t kelvin;
+  uint16_t power; /* 0 for off, on otherwise */
+} lifx_scene_light_t;
+
+typedef struct {
+  uint16_t hue;        /* largest ignored difference, around the circle */
+  uint16_t saturation; /* largest ignored difference */
+  uint16_t brightness; /* largest ignored difference */
+  uint16_t kelvin;     /* largest ignored difference */
+  uint32_t duration;   /* milliseconds of the SetColor transitions */
+} lifx_scene_config_t;
+
+typedef struct {
+  uint32_t colors;    /* SetColor frames queued */
+  uint32_t powers;    /* SetPower frames queued */
+  uint32_t unchanged; /* lights already showing the scene */
+  uint32_t unknown;   /* lights not in the mirror, nothing was sent */
+  uint32_t refused;   /* frames the scheduler had no room for */
+} lifx_scene_stats_t;
+
+/**
+ * @brief Fill a config with the LIFX_SCENE_ defaults and no transition.
+ *
+ * @param config
+ */
+void lifx_scene_config_init(lifx_scene_config_t *config);
+
+/**
+ * @brief Queue the frames that take lights from their mirrored state to a
+ * scene.
+ *
+ * A light gets a SetColor only when a field differs from the mirror by more
+ * than its tolerance or its color is not known yet, and a SetPower only when
+ * it is on and should be off or the other way around. The color of a light
+ * the scene turns off is left alone. Frames go to the scheduler, which
+ * paces them per device and replaces ones still queued from an earlier
+ * scene, run it to send them. The mirror only learns the new state from its
+ * next poll, until then applying the same scene again queues the same
+ * frames.
+ *
+ * Returns the amount of frames queued.
+ *
+ * @param mirror
+ * @param scheduler
+ * @param lights
+ * @param n amount of lights
+ * @param config NULL for the defaults
+ * @param now milliseconds
+ * @param stats NULL or filled in
+ */
+int lifx_scene_apply(const lifx_mirror_t *mirror, lifx_scheduler_t *scheduler,
+                     const lifx_scene_light_t *lights, size_t n,
+                     const lifx_scene_config_t *config, uint64_t now,
+                     lifx_scene_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCENE_H */
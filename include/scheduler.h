@@ -0,0 +1,156 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bucket.h"
+#include "frame.h"
+#include "metrics.h"
+
+/* Bulbs start dropping messages above about 20 per second */
+#define LIFX_SCHEDULER_RATE_DEFAULT 20
+#define LIFX_SCHEDULER_BURST_DEFAULT 5
+/* Frames queued per device */
+#define LIFX_SCHEDULER_QUEUE 8
+
+/* Per device send state */
+typedef struct {
+  uint64_t target; /* target bytes as a little endian integer */
+  uint8_t used;    /* table entry holds a device */
+  struct sockaddr_in addr;
+  lifx_bucket_t bucket;
+  uint8_t head;    /* oldest queued frame */
+  uint8_t len;     /* queued frames */
+  uint8_t active;  /* listed in the active devices */
+  lifx_frame_t queue[LIFX_SCHEDULER_QUEUE];
+} lifx_scheduled_device_t;
+
+typedef struct {
+  uint64_t queued;    /* frames accepted */
+  uint64_t coalesced; /* frames replaced by a newer one */
+  uint64_t dropped;   /* frames refused because a queue was full */
+  uint64_t emitted;   /* frames handed to emit */
+} lifx_scheduler_stats_t;
+
+/**
+ * @brief Sends a frame the scheduler releases.
+ *
+ * Returns -1 to stop the run, the frame then stays queued.
+ */
+typedef int (*lifx_scheduler_emit)(void *ctx, const lifx_frame_t *frame,
+                                   const struct sockaddr_in *addr);
+
+/*
+ * Per target send scheduler. Every device gets a token bucket and a small
+ * queue. A SetColor or SetPower replaces one of the same type still queued
+ * for that device, so only the newest state goes on the wire. Devices live
+ * in an open addressing table allocated up front, submitting does not
+ * allocate.
+ */
+typedef struct {
+  lifx_scheduled_device_t *devices;
+  size_t capacity;               /* table size, a power of 2 */
+  size_t count;                  /* devices in the table */
+  size_t max_devices;
+  uint32_t *active;              /* devices with queued frames */
+  size_t active_count;
+  uint32_t rate;
+  uint32_t burst;
+  lifx_scheduler_stats_t stats;
+  lifx_metrics_shard_t *metrics; /* optional, counts drops and coalescing */
+} lifx_scheduler_t;
+
+/**
+ * @brief Allocate a scheduler.
+ *
+ * @param scheduler
+ * @param max_devices maximum amount of distinct targets
+ * @param rate frames per second per device
+ * @param burst frames a device may receive back to back
+ */
+int lifx_scheduler_init(lifx_scheduler_t *scheduler, size_t max_devices,
+                        uint32_t rate, uint32_t burst);
+
+/**
+ * @brief Free the memory held by a scheduler.
+ *
+ * @param scheduler
+ */
+void lifx_scheduler_free(lifx_scheduler_t *scheduler);
+
+/**
+ * @brief Queue a frame for its target.
+ *
+ * Returns 1 when the frame replaced a queued one, 0 when it was queued and -1
+ * when the device queue or the device table is full.
+ *
+ * @param scheduler
+ * @param frame
+ * @param addr destination
+ * @param now milliseconds
+ */
+int lifx_scheduler_submit(lifx_scheduler_t *scheduler,
+                          const lifx_frame_t *frame,
+                          const struct sockaddr_in *addr, uint64_t now);
+
+/**
+ * @brief Queue a SetColor for a target, see lifx_scheduler_submit.
+ *
+ * The frame asks for an acknowledgement.
+ */
+int lifx_scheduler_set_color(lifx_scheduler_t *scheduler,
+                             const uint8_t target[8],
+                             const struct sockaddr_in *addr,
+                             const lifx_set_color_payload_t *payload,
+                             uint64_t now);
+
+/**
+ * @brief Queue a SetPower for a target, see lifx_scheduler_submit.
+ *
+ * The frame asks for an acknowledgement.
+ */
+int lifx_scheduler_set_power(lifx_scheduler_t *scheduler,
+                             const uint8_t target[8],
+                             const struct sockaddr_in *addr,
+                             const lifx_set_power_payload_t *payload,
+                             uint64_t now);
+
+/**
+ * @brief Release every frame whose device has a token.
+ *
+ * Returns the amount of frames emitted.
+ *
+ * @param scheduler
+ * @param now milliseconds
+ * @param emit
+ * @param ctx passed to emit
+ */
+int lifx_scheduler_run(lifx_scheduler_t *scheduler, uint64_t now,
+                       lifx_scheduler_emit emit, void *ctx);
+
+/**
+ * @brief Milliseconds until the next frame can be released or -1 when
+ * nothing is queued.
+ *
+ * @param scheduler
+ * @param now milliseconds
+ */
+int64_t lifx_scheduler_next(const lifx_scheduler_t *scheduler, uint64_t now);
+
+/**
+ * @brief An emit function sending through a lifx_client_t given as ctx.
+ */
+int lifx_scheduler_emit_client(void *ctx, const lifx_frame_t *frame,
+                               const struct sockaddr_in *addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCHEDULER_H */
@@ -0,0 +1,205 @@
+#ifndef SHM_H
+#define SHM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+#include "registry.h"
+
+#define LIFX_SHM_MAGIC "LIFXSHM1"
+#define LIFX_SHM_PATH_DEFAULT "/dev/shm/lifxd"
+/* Appended to the segment path to name the doorbell FIFO */
+#define LIFX_SHM_BELL_SUFFIX ".bell"
+/* Bytes between fields written by different processes */
+#define LIFX_SHM_PAD 64
+
+typedef struct {
+  uint64_t turn; /* position the cell is next written or read at */
+  lifx_frame_t frame;
+} lifx_shm_cell_t;
+
+/*
+ * Start of a shared segment, offsets count from here. The sizes let a
+ * client refuse a segment laid out by a different build.
+ */
+typedef struct {
+  char magic[8];
+  uint32_t header_size;    /* sizeof(lifx_shm_header_t) */
+  uint32_t cell_size;      /* sizeof(lifx_shm_cell_t) */
+  uint32_t device_size;    /* sizeof(lifx_device_t) */
+  uint32_t cells;          /* command cells, a power of 2 */
+  uint32_t max_devices;
+  int32_t pid;             /* daemon owning the segment */
+  uint64_t cells_offset;
+  uint64_t devices_offset;
+  uint64_t size;           /* bytes in the segment */
+  uint8_t pad0[LIFX_SHM_PAD];
+  uint64_t head;           /* next position clients claim */
+  uint64_t full;           /* submits that found the ring full */
+  uint8_t pad1[LIFX_SHM_PAD];
+  uint64_t tail;           /* next position the daemon reads */
+  uint32_t waiting;        /* daemon is about to sleep */
+  uint64_t unknown;        /* commands for targets the daemon does not know */
+  uint8_t pad2[LIFX_SHM_PAD];
+  uint32_t version;        /* odd while the devices are written */
+  uint32_t count;          /* devices published */
+} lifx_shm_header_t;
+
+/*
+ * A segment shared by a controller daemon and the processes on its host,
+ * so they all go through one socket, one registry and one rate limit.
+ *
+ * Clients submit frames through a ring of cells using the protocol of
+ * lifx_queue_t, a compare and swap on head claims a cell and moving its
+ * turn publishes it, so submitting is a copy into shared memory. A client
+ * dying between the two stalls the ring behind its cell.
+ *
+ * The daemon sleeps on a FIFO next to the segment, which clients only write
+ * to after it announced it is about to sleep. It publishes its registry into
+ * the segment under a sequence lock, clients copy it out and retry when it
+ * changed while they read.
+ */
+typedef struct {
+  lifx_shm_header_t *header;
+  lifx_shm_cell_t *cells;  /* header->cells cells */
+  lifx_device_t *devices;  /* header->max_devices devices */
+  size_t size;             /* bytes mapped */
+  int bell;                /* doorbell FIFO */
+  char *path;              /* segment path, set in the daemon only */
+} lifx_shm_t;
+
+/**
+ * @brief Create a segment, daemon only.
+ *
+ * Fails with EEXIST while another daemon owns path, a segment left behind by
+ * a daemon that is gone is replaced.
+ *
+ * @param shm
+ * @param path segment file, on a tmpfs such as /dev/shm
+ * @param cells minimum amount of frames queued at once, rounded up to a
+ * power of 2
+ * @param max_devices devices published at most
+ */
+int lifx_shm_create(lifx_shm_t *shm, const char *path, size_t cells,
+                    size_t max_devices);
+
+/**
+ * @brief Remove a segment created by lifx_shm_create.
+ *
+ * Clients still attached keep their mapping but can no longer wake the
+ * daemon.
+ *
+ * @param shm
+ */
+void lifx_shm_destroy(lifx_shm_t *shm);
+
+/**
+ * @brief Attach to the segment of a running daemon.
+ *
+ * Fails with ENXIO when the daemon that created the segment is gone and with
+ * EPROTO when the segment was laid out by a different build or is not
+ * ready yet.
+ *
+ * @param shm
+ * @param path
+ */
+int lifx_shm_open(lifx_shm_t *shm, const char *path);
+
+/**
+ * @brief Detach from a segment.
+ *
+ * @param shm
+ */
+void lifx_shm_close(lifx_shm_t *shm);
+
+/**
+ * @brief Hand a frame to the daemon, from any thread of any client.
+ *
+ * The daemon sends it to the device of its target once the rate limit of
+ * the device allows, a SetColor or SetPower replacing one still queued
+ * there, whichever process sent it. The source is replaced by the one of
+ * the daemon. Returns -1 with errno set to EAGAIN when the ring is full, or
+ * to EINVAL when the target is 0.
+ *
+ * @param shm
+ * @param frame
+ */
+int lifx_shm_submit(lifx_shm_t *shm, const lifx_frame_t *frame);
+
+/**
+ * @brief Submit a SetColor for a target, see lifx_shm_submit.
+ */
+int lifx_shm_set_color(lifx_shm_t *shm, const uint8_t target[8],
+                       const lifx_set_color_payload_t *payload);
+
+/**
+ * @brief Submit a SetPower for a target, see lifx_shm_submit.
+ */
+int lifx_shm_set_power(lifx_shm_t *shm, const uint8_t target[8],
+                       const lifx_set_power_payload_t *payload);
+
+/**
+ * @brief Copy the devices the daemon knows.
+ *
+ * Returns the amount of devices copied, at most n, or -1 with errno set to
+ * ENXIO when the daemon died while publishing them.
+ *
+ * @param shm
+ * @param devices
+ * @param n maximum amount of devices
+ */
+int lifx_shm_devices(const lifx_shm_t *shm, lifx_device_t *devices,
+                     size_t n);
+
+/**
+ * @brief Take the oldest submitted frame, daemon only.
+ *
+ * Returns 1 when a frame was taken and 0 when the ring is empty.
+ *
+ * @param shm
+ * @param frame
+ */
+int lifx_shm_take(lifx_shm_t *shm, lifx_frame_t *frame);
+
+/**
+ * @brief Publish the devices of a registry, daemon only.
+ *
+ * @param shm
+ * @param registry
+ */
+void lifx_shm_publish(lifx_shm_t *shm, const lifx_registry_t *registry);
+
+/**
+ * @brief Announce the daemon is about to sleep on lifx_shm_fd.
+ *
+ * Returns 1 when frames are already submitted and the daemon should take
+ * them instead of sleeping, 0 otherwise. Once it woke up call lifx_shm_wake.
+ *
+ * @param shm
+ */
+int lifx_shm_arm(lifx_shm_t *shm);
+
+/**
+ * @brief Empty the doorbell after the daemon woke up.
+ *
+ * @param shm
+ */
+void lifx_shm_wake(lifx_shm_t *shm);
+
+/**
+ * @brief The doorbell of a segment, readable once a client rang it.
+ *
+ * @param shm
+ */
+int lifx_shm_fd(const lifx_shm_t *shm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHM_H */
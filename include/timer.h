@@ -0,0 +1,95 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LIFX_WHEEL_LEVELS 4
+#define LIFX_WHEEL_BITS 6
+#define LIFX_WHEEL_SLOTS (1 << LIFX_WHEEL_BITS)
+
+typedef struct lifx_timer lifx_timer_t;
+
+typedef void (*lifx_timer_callback)(lifx_timer_t *timer, void *ctx);
+
+/* A timer, embedded in whatever it times. Zeroed means not scheduled. */
+struct lifx_timer {
+  lifx_timer_t *next;
+  lifx_timer_t *prev;
+  uint64_t expires; /* tick the timer fires at */
+  lifx_timer_callback callback;
+  void *ctx;
+};
+
+/*
+ * Hierarchical timer wheel. Level 0 has one slot per tick, every level above
+ * covers LIFX_WHEEL_SLOTS times the span of the one below and is cascaded
+ * down as time reaches it. Adding, cancelling and expiring a timer are all
+ * O(1) regardless of how many timers are scheduled.
+ */
+typedef struct {
+  lifx_timer_t slots[LIFX_WHEEL_LEVELS][LIFX_WHEEL_SLOTS]; /* list heads */
+  uint64_t now;                                            /* current tick */
+  size_t count;                                            /* timers */
+} lifx_wheel_t;
+
+/**
+ * @brief Initialise an empty wheel.
+ *
+ * @param wheel
+ * @param now current tick
+ */
+void lifx_wheel_init(lifx_wheel_t *wheel, uint64_t now);
+
+/**
+ * @brief Schedule a timer.
+ *
+ * A timer that is already scheduled is moved. Timers expiring at or before the
+ * current tick fire on the next one.
+ *
+ * @param wheel
+ * @param timer
+ * @param expires tick to fire at
+ * @param callback
+ * @param ctx passed to callback
+ */
+void lifx_wheel_add(lifx_wheel_t *wheel, lifx_timer_t *timer,
+                    uint64_t expires, lifx_timer_callback callback,
+                    void *ctx);
+
+/**
+ * @brief Cancel a timer, doing nothing if it is not scheduled.
+ *
+ * @param wheel
+ * @param timer
+ */
+void lifx_wheel_cancel(lifx_wheel_t *wheel, lifx_timer_t *timer);
+
+/**
+ * @brief Advance the wheel, firing every timer that expires up to now.
+ *
+ * Callbacks may add and cancel timers. Returns the amount of timers fired.
+ *
+ * @param wheel
+ * @param now current tick
+ */
+size_t lifx_wheel_advance(lifx_wheel_t *wheel, uint64_t now);
+
+/**
+ * @brief Ticks until the wheel next needs advancing or -1 when it is empty.
+ *
+ * May be earlier than the next expiry, never later.
+ *
+ * @param wheel
+ */
+int64_t lifx_wheel_next(const lifx_wheel_t *wheel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMER_H */
@@ -0,0 +1,121 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+#include "wire.h"
+
+/*
+ * Read-only view of an encoded frame. Nothing is copied, every accessor
+ * decodes just the field it is asked for straight from the buffer, so routing
+ * a reply only touches the few bytes it needs. The buffer must outlive the
+ * view.
+ */
+typedef struct {
+  const uint8_t *buf;
+  size_t n;
+} lifx_frame_view_t;
+
+/**
+ * @brief Point a view at an encoded frame.
+ *
+ * Only checks that buf holds a full header and that the size field does not
+ * claim more bytes than n.
+ *
+ * @param view
+ * @param buf
+ * @param n amount of bytes in buf
+ */
+static inline int lifx_view_init(lifx_frame_view_t *view, const uint8_t *buf,
+                                 size_t n) {
+  if (view == NULL || buf == NULL || n < FRAME_HEADER_SIZE) {
+    return -1;
+  }
+
+  uint16_t size = lifx_load_le16(buf + LIFX_OFFSET_SIZE);
+  if (size < FRAME_HEADER_SIZE || size > n) {
+    return -1;
+  }
+
+  view->buf = buf;
+  view->n = size;
+  return 0;
+}
+
+static inline uint16_t lifx_view_size(const lifx_frame_view_t *view) {
+  return lifx_load_le16(view->buf + LIFX_OFFSET_SIZE);
+}
+
+static inline uint8_t lifx_view_tagged(const lifx_frame_view_t *view) {
+  return (lifx_load_le16(view->buf + LIFX_OFFSET_PROTOCOL) & (1 << 13)) != 0;
+}
+
+static inline uint32_t lifx_view_source(const lifx_frame_view_t *view) {
+  return lifx_load_le32(view->buf + LIFX_OFFSET_SOURCE);
+}
+
+/* Pointer to the 8 target bytes inside the buffer */
+static inline const uint8_t *lifx_view_target(const lifx_frame_view_t *view) {
+  return view->buf + LIFX_OFFSET_TARGET;
+}
+
+/* The 8 target bytes as one little endian integer, handy as a lookup key */
+static inline uint64_t lifx_view_target_id(const lifx_frame_view_t *view) {
+  return lifx_load_le64(view->buf + LIFX_OFFSET_TARGET);
+}
+
+static inline uint8_t lifx_view_response(const lifx_frame_view_t *view) {
+  return (view->buf[LIFX_OFFSET_FLAGS] & 1) != 0;
+}
+
+static inline uint8_t lifx_view_acknowledgement(const lifx_frame_view_t *view) {
+  return (view->buf[LIFX_OFFSET_FLAGS] & (1 << 1)) != 0;
+}
+
+static inline uint8_t lifx_view_sequence(const lifx_frame_view_t *view) {
+  return view->buf[LIFX_OFFSET_SEQUENCE];
+}
+
+static inline lifx_message_type lifx_view_type(const lifx_frame_view_t *view) {
+  return (lifx_message_type)lifx_load_le16(view->buf + LIFX_OFFSET_TYPE);
+}
+
+/**
+ * @brief Pointer to the payload bytes inside the buffer.
+ *
+ * @param view
+ * @param n set to the amount of payload bytes
+ */
+static inline const uint8_t *lifx_view_payload(const lifx_frame_view_t *view,
+                                               size_t *n) {
+  if (n != NULL) {
+    *n = view->n - FRAME_HEADER_SIZE;
+  }
+  return view->buf + FRAME_HEADER_SIZE;
+}
+
+/**
+ * @brief Fully decode the frame a view points at.
+ *
+ * For when the cheap accessors are not enough, see lifx_decode_frame.
+ *
+ * @param view
+ * @param frame
+ */
+static inline int lifx_view_decode(const lifx_frame_view_t *view,
+                                   lifx_frame_t *frame) {
+  uint8_t *buf = (uint8_t *)view->buf;
+  return lifx_decode_frame(frame, &buf, view->n);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VIEW_H */
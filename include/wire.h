@@ -0,0 +1,112 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+/* Fixed byte offsets of the fields in the 36 byte frame header */
+#define LIFX_OFFSET_SIZE 0
+#define LIFX_OFFSET_PROTOCOL 2
+#define LIFX_OFFSET_SOURCE 4
+#define LIFX_OFFSET_TARGET 8
+#define LIFX_OFFSET_ADDRESS_RESERVED 16
+#define LIFX_OFFSET_FLAGS 22
+#define LIFX_OFFSET_SEQUENCE 23
+#define LIFX_OFFSET_PROTOCOL_RESERVED 24
+#define LIFX_OFFSET_TYPE 32
+#define LIFX_OFFSET_TYPE_RESERVED 34
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LIFX_NATIVE_LE 1
+#else
+#define LIFX_NATIVE_LE 0
+#endif
+
+/*
+ * Little endian loads and stores at a fixed offset. On little endian hosts
+ * these are plain (unaligned) memcpy moves which compile to a single
+ * instruction, otherwise the bytes are assembled by hand.
+ */
+
+static inline void lifx_store_le16(uint8_t *p, uint16_t v) {
+#if LIFX_NATIVE_LE
+  memcpy(p, &v, sizeof(v));
+#else
+  p[0] = v;
+  p[1] = v >> 8;
+#endif
+}
+
+static inline void lifx_store_le32(uint8_t *p, uint32_t v) {
+#if LIFX_NATIVE_LE
+  memcpy(p, &v, sizeof(v));
+#else
+  for (int i = 0; i < 4; ++i) {
+    p[i] = v >> (8 * i);
+  }
+#endif
+}
+
+static inline void lifx_store_le64(uint8_t *p, uint64_t v) {
+#if LIFX_NATIVE_LE
+  memcpy(p, &v, sizeof(v));
+#else
+  for (int i = 0; i < 8; ++i) {
+    p[i] = v >> (8 * i);
+  }
+#endif
+}
+
+static inline uint16_t lifx_load_le16(const uint8_t *p) {
+#if LIFX_NATIVE_LE
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+#else
+  return (uint16_t)p[0] | (uint16_t)p[1] << 8;
+#endif
+}
+
+static inline uint32_t lifx_load_le32(const uint8_t *p) {
+#if LIFX_NATIVE_LE
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+#else
+  uint32_t v = 0;
+  for (int i = 0; i < 4; ++i) {
+    v |= (uint32_t)p[i] << (8 * i);
+  }
+  return v;
+#endif
+}
+
+static inline uint64_t lifx_load_le64(const uint8_t *p) {
+#if LIFX_NATIVE_LE
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+#else
+  uint64_t v = 0;
+  for (int i = 0; i < 8; ++i) {
+    v |= (uint64_t)p[i] << (8 * i);
+  }
+  return v;
+#endif
+}
+
+/* Hash of a target (or any key) read with lifx_load_le64 */
+static inline uint64_t lifx_hash64(uint64_t v) {
+  v *= 0x9E3779B97F4A7C15ull;
+  return v ^ (v >> 29);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIRE_H */
@@ -0,0 +1,175 @@
+#include "batch.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+int lifx_batch_init(lifx_batch_t *batch, size_t capacity) {
+  if (batch == NULL || capacity == 0) {
+    return -1;
+  }
+
+  memset(batch, 0, sizeof(*batch));
+  batch->arena_size = capacity * FRAME_SIZE_MAX;
+  batch->arena = malloc(batch->arena_size);
+  batch->iov = calloc(capacity, sizeof(*batch->iov));
+  batch->msgs = calloc(capacity, sizeof(*batch->msgs));
+  batch->addrs = calloc(capacity, sizeof(*batch->addrs));
+  if (batch->arena == NULL || batch->iov == NULL || batch->msgs == NULL ||
+      batch->addrs == NULL) {
+    lifx_batch_free(batch);
+    return -1;
+  }
+  batch->capacity = capacity;
+
+  return 0;
+}
+
+void lifx_batch_free(lifx_batch_t *batch) {
+  if (batch == NULL) {
+    return;
+  }
+
+  free(batch->arena);
+  free(batch->iov);
+  free(batch->msgs);
+  free(batch->addrs);
+  memset(batch, 0, sizeof(*batch));
+}
+
+void lifx_batch_reset(lifx_batch_t *batch) {
+  batch->arena_used = 0;
+  batch->count = 0;
+  batch->sent = 0;
+}
+
+/* Fill in the iovec and mmsghdr of a frame just encoded at arena_used */
+static int batch_commit(lifx_batch_t *batch, int size,
+                        const struct sockaddr_in *addr) {
+  if (size == -1) {
+    return -1;
+  }
+
+  size_t i = batch->count;
+  batch->iov[i].iov_base = batch->arena + batch->arena_used;
+  batch->iov[i].iov_len = size;
+
+  struct msghdr *hdr = &batch->msgs[i].msg_hdr;
+  memset(hdr, 0, sizeof(*hdr));
+  hdr->msg_iov = &batch->iov[i];
+  hdr->msg_iovlen = 1;
+  if (addr != NULL) {
+    batch->addrs[i] = *addr;
+    hdr->msg_name = &batch->addrs[i];
+    hdr->msg_namelen = sizeof(batch->addrs[i]);
+  }
+  batch->msgs[i].msg_len = 0;
+
+  batch->arena_used += size;
+  batch->count++;
+
+  return i;
+}
+
+int lifx_batch_add(lifx_batch_t *batch, const lifx_frame_t *frame,
+                   const struct sockaddr_in *addr) {
+  if (batch == NULL || frame == NULL || batch->count == batch->capacity) {
+    return -1;
+  }
+
+  uint8_t *p = batch->arena + batch->arena_used;
+  int size =
+      lifx_encode_frame(frame, &p, batch->arena_size - batch->arena_used);
+  return batch_commit(batch, size, addr);
+}
+
+int lifx_batch_add_templated(lifx_batch_t *batch,
+                             const lifx_header_template_t *tmpl,
+                             uint8_t sequence, lifx_message_type type,
+                             const lifx_payload_t *payload,
+                             const struct sockaddr_in *addr) {
+  if (batch == NULL || batch->count == batch->capacity) {
+    return -1;
+  }
+
+  uint8_t *p = batch->arena + batch->arena_used;
+  int encoded =
+      lifx_encode_templated_frame(tmpl, sequence, type, payload, &p,
+                                  batch->arena_size - batch->arena_used);
+  return batch_commit(batch, encoded, addr);
+}
+
+int lifx_batch_add_packet(lifx_batch_t *batch, const uint8_t *packet,
+                          size_t size, const struct sockaddr_in *addr) {
+  if (batch == NULL || packet == NULL || size == 0 ||
+      size > FRAME_SIZE_MAX || batch->count == batch->capacity) {
+    return -1;
+  }
+
+  memcpy(batch->arena + batch->arena_used, packet, size);
+  return batch_commit(batch, size, addr);
+}
+
+int lifx_batch_encode(lifx_batch_t *batch, const lifx_frame_t *frames,
+                      const struct sockaddr_in *addrs, size_t n) {
+  if (batch == NULL || frames == NULL) {
+    return -1;
+  }
+
+  size_t i;
+  for (i = 0; i < n; ++i) {
+    if (lifx_batch_add(batch, &frames[i], addrs == NULL ? NULL : &addrs[i]) ==
+        -1) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+int lifx_batch_add_colors(lifx_batch_t *batch,
+                          const lifx_header_template_t *tmpls,
+                          uint8_t sequence,
+                          const lifx_set_color_payload_t *colors,
+                          const struct sockaddr_in *addrs, size_t n) {
+  if (batch == NULL || tmpls == NULL || colors == NULL) {
+    return -1;
+  }
+
+  size_t i;
+  lifx_payload_t payload;
+  for (i = 0; i < n; ++i) {
+    payload.set_color_payload = colors[i];
+    if (lifx_batch_add_templated(batch, &tmpls[i], sequence + i, SetColor,
+                                 &payload,
+                                 addrs == NULL ? NULL : &addrs[i]) == -1) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+int lifx_batch_send(int sfd, lifx_batch_t *batch) {
+  if (batch == NULL) {
+    return -1;
+  }
+
+  size_t start = batch->sent;
+  while (batch->sent < batch->count) {
+    batch->syscalls++;
+    int res = sendmmsg(sfd, batch->msgs + batch->sent,
+                       batch->count - batch->sent, 0);
+    if (res == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return -1;
+    }
+    batch->sent += res;
+  }
+
+  return batch->sent - start;
+}
@@ -0,0 +1,158 @@
+#include "cache.h"
+#include "wire.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void encode_record(uint8_t *b, const lifx_device_t *device) {
+  memset(b, 0, LIFX_CACHE_RECORD_SIZE);
+  memcpy(b, device->target, 8);
+  memcpy(b + 8, &device->addr.sin_addr.s_addr, 4);
+  lifx_store_le16(b + 12, ntohs(device->addr.sin_port));
+  b[14] = device->flags & ~LIFX_DEVICE_CACHED;
+  lifx_store_le64(b + 16, device->last_seen);
+  memcpy(b + 24, device->label, 32);
+}
+
+static void decode_record(const uint8_t *b, lifx_device_t *device) {
+  memcpy(&device->addr.sin_addr.s_addr, b + 8, 4);
+  device->addr.sin_family = AF_INET;
+  device->addr.sin_port = htons(lifx_load_le16(b + 12));
+  device->flags = b[14] | LIFX_DEVICE_CACHED;
+  device->last_seen = lifx_load_le64(b + 16);
+  memcpy(device->label, b + 24, 32);
+  device->label[32] = '\0';
+}
+
+int lifx_cache_save(const lifx_registry_t *registry, const char *path) {
+  if (registry == NULL || path == NULL) {
+    return -1;
+  }
+
+  size_t size = LIFX_CACHE_HEADER_SIZE +
+                registry->count * LIFX_CACHE_RECORD_SIZE;
+  uint8_t *buf = malloc(size);
+  if (buf == NULL) {
+    return -1;
+  }
+
+  memcpy(buf, LIFX_CACHE_MAGIC, 8);
+  lifx_store_le32(buf + 8, registry->count);
+  lifx_store_le32(buf + 12, LIFX_CACHE_RECORD_SIZE);
+
+  uint8_t *record = buf + LIFX_CACHE_HEADER_SIZE;
+  size_t cursor = 0;
+  lifx_device_t *device;
+  while ((device = lifx_registry_next(registry, &cursor)) != NULL) {
+    encode_record(record, device);
+    record += LIFX_CACHE_RECORD_SIZE;
+  }
+
+  /* Write next to the cache and rename over it */
+  size_t len = strlen(path);
+  char *tmp = malloc(len + 5);
+  if (tmp == NULL) {
+    free(buf);
+    return -1;
+  }
+  memcpy(tmp, path, len);
+  memcpy(tmp + len, ".tmp", 5);
+
+  int res = -1;
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd != -1) {
+    size_t written = 0;
+    while (written < size) {
+      ssize_t n = write(fd, buf + written, size - written);
+      if (n == -1) {
+        break;
+      }
+      written += n;
+    }
+    if (close(fd) == 0 && written == size && rename(tmp, path) == 0) {
+      res = 0;
+    } else {
+      unlink(tmp);
+    }
+  }
+
+  free(tmp);
+  free(buf);
+  return res;
+}
+
+int lifx_cache_load(lifx_registry_t *registry, const char *path) {
+  if (registry == NULL || path == NULL) {
+    return -1;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < LIFX_CACHE_HEADER_SIZE) {
+    close(fd);
+    return -1;
+  }
+
+  const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+
+  int loaded = -1;
+  uint32_t count = lifx_load_le32(map + 8);
+  uint32_t record_size = lifx_load_le32(map + 12);
+  if (memcmp(map, LIFX_CACHE_MAGIC, 8) != 0 ||
+      record_size < LIFX_CACHE_RECORD_SIZE ||
+      (size_t)st.st_size <
+          LIFX_CACHE_HEADER_SIZE + (uint64_t)count * record_size) {
+    goto out;
+  }
+
+  loaded = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    const uint8_t *record = map + LIFX_CACHE_HEADER_SIZE + i * record_size;
+    if (lifx_registry_find(registry, record) != NULL) {
+      continue;
+    }
+    lifx_device_t *device = lifx_registry_insert(registry, record);
+    if (device == NULL) {
+      continue;
+    }
+    decode_record(record, device);
+    loaded++;
+  }
+
+out:
+  munmap((void *)map, st.st_size);
+  return loaded;
+}
+
+size_t lifx_cache_expire(lifx_registry_t *registry, uint64_t before) {
+  size_t removed = 0;
+
+  /* Removal shifts later entries back into i, so look at i again */
+  size_t i = 0;
+  while (i < registry->capacity) {
+    const lifx_device_t *device = &registry->devices[i];
+    if (registry->keys[i] != 0 && (device->flags & LIFX_DEVICE_CACHED) &&
+        device->last_seen < before) {
+      uint8_t target[8];
+      memcpy(target, device->target, 8);
+      lifx_registry_remove(registry, target);
+      removed++;
+      continue;
+    }
+    ++i;
+  }
+
+  return removed;
+}
@@ -0,0 +1,591 @@
+#include "client.h"
+#include "view.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RECV_DEPTH 64
+#define NIL UINT32_MAX
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t target_id(const uint8_t *target) {
+  return lifx_load_le64(target);
+}
+
+static size_t request_hash(uint64_t target, uint8_t sequence) {
+  return lifx_hash64(target ^ sequence);
+}
+
+/* Position of (target, sequence) in the index or -1 */
+static long index_find(const lifx_client_t *client, uint64_t target,
+                       uint8_t sequence) {
+  size_t i = request_hash(target, sequence) & client->index_mask;
+  while (client->index[i] != 0) {
+    const lifx_request_t *request = &client->requests[client->index[i] - 1];
+    if (request->target == target && request->sequence == sequence) {
+      return i;
+    }
+    i = (i + 1) & client->index_mask;
+  }
+  return -1;
+}
+
+static void index_insert(lifx_client_t *client, uint32_t slot) {
+  const lifx_request_t *request = &client->requests[slot];
+  size_t i = request_hash(request->target, request->sequence) &
+             client->index_mask;
+  while (client->index[i] != 0) {
+    i = (i + 1) & client->index_mask;
+  }
+  client->index[i] = slot + 1;
+}
+
+/* Linear probing removal, shifting back entries that probed past i */
+static void index_remove(lifx_client_t *client, size_t i) {
+  size_t j = i;
+  client->index[i] = 0;
+  while (1) {
+    j = (j + 1) & client->index_mask;
+    if (client->index[j] == 0) {
+      return;
+    }
+    const lifx_request_t *request = &client->requests[client->index[j] - 1];
+    size_t home = request_hash(request->target, request->sequence) &
+                  client->index_mask;
+    /* Move j back into the hole unless its home lies cyclically in (i, j] */
+    if ((j > i && (home <= i || home > j)) ||
+        (j < i && (home <= i && home > j))) {
+      client->index[i] = client->index[j];
+      client->index[j] = 0;
+      i = j;
+    }
+  }
+}
+
+static void request_release(lifx_client_t *client, uint32_t slot) {
+  client->requests[slot].state = LIFX_REQUEST_FREE;
+  client->requests[slot].next = client->free_head;
+  client->free_head = slot;
+  client->inflight--;
+}
+
+/* Unlink a request from the unsent queue, which is short unless the socket
+ * stays full */
+static void unsent_remove(lifx_client_t *client, uint32_t slot) {
+  uint32_t prev = NIL;
+  uint32_t i = client->unsent_head;
+  while (i != NIL && i != slot) {
+    prev = i;
+    i = client->requests[i].next;
+  }
+  if (i == NIL) {
+    return;
+  }
+
+  uint32_t next = client->requests[slot].next;
+  if (prev == NIL) {
+    client->unsent_head = next;
+  } else {
+    client->requests[prev].next = next;
+  }
+  if (client->unsent_tail == slot) {
+    client->unsent_tail = prev;
+  }
+}
+
+/* Drop a request from the client and run its callback */
+static void request_complete(lifx_client_t *client, uint32_t slot, int status,
+                             const lifx_frame_t *reply) {
+  lifx_request_t *request = &client->requests[slot];
+  lifx_client_callback callback = request->callback;
+  void *ctx = request->ctx;
+
+  /* A retransmission still queued can be answered by an earlier attempt */
+  if (request->state == LIFX_REQUEST_UNSENT) {
+    unsent_remove(client, slot);
+  }
+
+  if (request->response || request->acknowledgement) {
+    long i = index_find(client, request->target, request->sequence);
+    if (i != -1) {
+      index_remove(client, i);
+    }
+    lifx_wheel_cancel(&client->wheel, &request->timer);
+  }
+  request_release(client, slot);
+  client->stats.completed++;
+
+  if (callback != NULL) {
+    callback(client, status, reply, ctx);
+  }
+}
+
+/*
+ * Returns 1 when the datagram was sent, 2 when it was lost, 0 when the socket
+ * would block and -1 on error. ENOBUFS leaves the socket writable, waiting
+ * for EPOLLOUT would spin, so the datagram counts as lost on the way and the
+ * retry timer takes over.
+ */
+static int request_transmit(lifx_client_t *client, lifx_request_t *request) {
+  ssize_t res = sendto(client->sfd, request->packet, request->size, 0,
+                       (struct sockaddr *)&request->addr,
+                       sizeof(request->addr));
+  if (res == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    }
+    if (errno == ENOBUFS) {
+      client->stats.dropped++;
+      return 2;
+    }
+    return -1;
+  }
+  client->stats.sent++;
+  if (client->metrics != NULL) {
+    if (request->attempts == 0) {
+      request->sent_at = now_us();
+    }
+    lifx_metrics_sent(client->metrics, request->target,
+                      lifx_load_le16(request->packet + LIFX_OFFSET_TYPE));
+  }
+
+  return 1;
+}
+
+static void request_expired(lifx_timer_t *timer, void *ctx);
+
+/* Called once an attempt is over, res being what request_transmit returned
+ * for it. A request waiting for a reply leaves a lost attempt to its timer,
+ * one that is not has nothing to retry and times out right away. */
+static void request_sent(lifx_client_t *client, uint32_t slot, int res) {
+  lifx_request_t *request = &client->requests[slot];
+  if (request->response || request->acknowledgement) {
+    request->state = LIFX_REQUEST_INFLIGHT;
+    lifx_wheel_add(&client->wheel, &request->timer,
+                   client->wheel.now + request->timeout, request_expired,
+                   client);
+    return;
+  }
+  if (res != 1) {
+    client->stats.giveups++;
+    lifx_metrics_add(client->metrics, request->target, LIFX_METRIC_TIMEOUTS,
+                     1);
+    request_complete(client, slot, LIFX_CLIENT_TIMEOUT, NULL);
+    return;
+  }
+  request_complete(client, slot, LIFX_CLIENT_OK, NULL);
+}
+
+static int client_arm(lifx_client_t *client, int writable) {
+  struct epoll_event event = {
+      .events = EPOLLIN | (writable ? 0 : EPOLLOUT),
+      .data.fd = client->sfd,
+  };
+  if (epoll_ctl(client->epfd, EPOLL_CTL_MOD, client->sfd, &event) == -1) {
+    return -1;
+  }
+  client->writable = writable;
+  return 0;
+}
+
+static void unsent_push(lifx_client_t *client, uint32_t slot) {
+  client->requests[slot].state = LIFX_REQUEST_UNSENT;
+  client->requests[slot].next = NIL;
+  if (client->unsent_head == NIL) {
+    client->unsent_head = slot;
+  } else {
+    client->requests[client->unsent_tail].next = slot;
+  }
+  client->unsent_tail = slot;
+
+  if (client->writable) {
+    client_arm(client, 0);
+  }
+}
+
+static int client_flush(lifx_client_t *client) {
+  while (client->unsent_head != NIL) {
+    uint32_t slot = client->unsent_head;
+    int res = request_transmit(client, &client->requests[slot]);
+    if (res == -1) {
+      return -1;
+    }
+    if (res == 0) {
+      return 0;
+    }
+    client->unsent_head = client->requests[slot].next;
+    /* Off the queue, request_complete has nothing to unlink */
+    client->requests[slot].state = LIFX_REQUEST_INFLIGHT;
+    request_sent(client, slot, res);
+  }
+
+  if (!client->writable) {
+    return client_arm(client, 1);
+  }
+
+  return 0;
+}
+
+/* No reply in time: retransmit with a doubled timeout or give up */
+static void request_expired(lifx_timer_t *timer, void *ctx) {
+  lifx_client_t *client = ctx;
+  lifx_request_t *request =
+      (lifx_request_t *)((char *)timer - offsetof(lifx_request_t, timer));
+  uint32_t slot = request - client->requests;
+
+  if (request->attempts >= request->policy.retries) {
+    client->stats.giveups++;
+    lifx_metrics_add(client->metrics, request->target, LIFX_METRIC_TIMEOUTS,
+                     1);
+    request_complete(client, slot, LIFX_CLIENT_TIMEOUT, NULL);
+    return;
+  }
+
+  request->attempts++;
+  request->timeout *= 2;
+  if (request->timeout > request->policy.max_timeout) {
+    request->timeout = request->policy.max_timeout;
+  }
+  client->stats.retries++;
+  lifx_metrics_add(client->metrics, request->target, LIFX_METRIC_RETRIES, 1);
+
+  /* Retransmissions queue up behind requests already waiting, and so do
+   * ones the socket has no room for yet. They stay in the index meanwhile,
+   * a late reply to an earlier attempt still completes them. */
+  int res = client->unsent_head != NIL ? 0 : request_transmit(client, request);
+  if (res == 0) {
+    unsent_push(client, slot);
+    return;
+  }
+  /* Sent, or failed and counted as a lost attempt, either way the timer
+   * decides what happens next */
+  request_sent(client, slot, res);
+}
+
+static void client_dispatch(lifx_client_t *client,
+                            const lifx_frame_view_t *view,
+                            const struct sockaddr_storage *from) {
+  client->stats.received++;
+
+  /* Device announcements are worth keeping whoever asked for them */
+  lifx_frame_t reply;
+  int decoded = 0;
+  lifx_message_type type = lifx_view_type(view);
+  if (client->registry != NULL &&
+      (type == StateService || type == StateLabel) &&
+      lifx_view_decode(view, &reply) != -1) {
+    decoded = 1;
+    lifx_registry_observe(client->registry, &reply,
+                          from->ss_family == AF_INET
+                              ? (const struct sockaddr_in *)from
+                              : NULL,
+                          lifx_registry_now());
+  }
+
+  if (lifx_view_source(view) != client->source) {
+    client->stats.unmatched++;
+    return;
+  }
+
+  uint8_t sequence = lifx_view_sequence(view);
+  long i = index_find(client, lifx_view_target_id(view), sequence);
+  if (i == -1) {
+    /* Replies to a tagged request come from the devices own target */
+    i = index_find(client, 0, sequence);
+    if (i == -1 || !client->requests[client->index[i] - 1].tagged) {
+      client->stats.unmatched++;
+      return;
+    }
+  }
+
+  uint32_t slot = client->index[i] - 1;
+  const lifx_request_t *request = &client->requests[slot];
+  int ack = type == Acknowledgement;
+  if (request->response ? ack : !ack) {
+    /* The acknowledgement of a request waiting for its response, or the
+     * other way around */
+    return;
+  }
+
+  if (!decoded && lifx_view_decode(view, &reply) == -1) {
+    client->stats.unmatched++;
+    return;
+  }
+  /* An acknowledgement after a retransmission could answer any attempt, so
+   * only the first one is timed */
+  if (ack && client->metrics != NULL && request->attempts == 0) {
+    lifx_metrics_ack(client->metrics, request->target,
+                     now_us() - request->sent_at);
+  }
+  request_complete(client, slot, LIFX_CLIENT_OK, &reply);
+}
+
+int lifx_client_init(lifx_client_t *client, uint32_t source, size_t capacity) {
+  if (client == NULL || source == 0 || capacity == 0 || capacity >= NIL) {
+    return -1;
+  }
+
+  memset(client, 0, sizeof(*client));
+  client->sfd = -1;
+  client->epfd = -1;
+  client->source = source;
+  client->capacity = capacity;
+  client->free_head = NIL;
+  client->unsent_head = NIL;
+  client->unsent_tail = NIL;
+  client->writable = 1;
+  client->policy.timeout = LIFX_CLIENT_TIMEOUT_DEFAULT;
+  client->policy.max_timeout = LIFX_CLIENT_MAX_TIMEOUT_DEFAULT;
+  client->policy.retries = LIFX_CLIENT_RETRIES_DEFAULT;
+  lifx_wheel_init(&client->wheel, now_ms());
+
+  size_t index_size = 1;
+  while (index_size < capacity * 2) {
+    index_size <<= 1;
+  }
+  client->index_mask = index_size - 1;
+
+  client->requests = calloc(capacity, sizeof(*client->requests));
+  client->index = calloc(index_size, sizeof(*client->index));
+  if (client->requests == NULL || client->index == NULL ||
+      lifx_receiver_init(&client->receiver, RECV_DEPTH) == -1) {
+    goto fail;
+  }
+
+  for (size_t i = capacity; i > 0; --i) {
+    client->requests[i - 1].next = client->free_head;
+    client->free_head = i - 1;
+  }
+
+  client->sfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (client->sfd == -1) {
+    goto fail;
+  }
+
+  int yes = 1;
+  if (setsockopt(client->sfd, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes)) ==
+      -1) {
+    goto fail;
+  }
+
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(client->sfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    goto fail;
+  }
+
+  client->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (client->epfd == -1) {
+    goto fail;
+  }
+
+  struct epoll_event event = {
+      .events = EPOLLIN,
+      .data.fd = client->sfd,
+  };
+  if (epoll_ctl(client->epfd, EPOLL_CTL_ADD, client->sfd, &event) == -1) {
+    goto fail;
+  }
+
+  return 0;
+
+fail:
+  lifx_client_close(client);
+  return -1;
+}
+
+void lifx_client_close(lifx_client_t *client) {
+  if (client == NULL) {
+    return;
+  }
+
+  /* Nothing is sent any more, empty the queue instead of unlinking every
+   * request on it */
+  client->unsent_head = NIL;
+  client->unsent_tail = NIL;
+  for (size_t i = 0; client->requests != NULL && i < client->capacity; ++i) {
+    if (client->requests[i].state == LIFX_REQUEST_UNSENT) {
+      client->requests[i].state = LIFX_REQUEST_INFLIGHT;
+    }
+    if (client->requests[i].state != LIFX_REQUEST_FREE) {
+      request_complete(client, i, LIFX_CLIENT_CANCELLED, NULL);
+    }
+  }
+
+  if (client->epfd != -1) {
+    close(client->epfd);
+  }
+  if (client->sfd != -1) {
+    close(client->sfd);
+  }
+  free(client->requests);
+  free(client->index);
+  lifx_receiver_free(&client->receiver);
+  memset(client, 0, sizeof(*client));
+  client->sfd = -1;
+  client->epfd = -1;
+}
+
+int lifx_client_send(lifx_client_t *client, const lifx_frame_t *frame,
+                     const struct sockaddr_in *addr,
+                     lifx_client_callback callback, void *ctx) {
+  if (client == NULL) {
+    return -1;
+  }
+
+  return lifx_client_send_policy(client, frame, addr, &client->policy,
+                                 callback, ctx);
+}
+
+int lifx_client_send_policy(lifx_client_t *client, const lifx_frame_t *frame,
+                            const struct sockaddr_in *addr,
+                            const lifx_retry_policy_t *policy,
+                            lifx_client_callback callback, void *ctx) {
+  if (client == NULL || frame == NULL || addr == NULL || policy == NULL) {
+    return -1;
+  }
+
+  if (client->free_head == NIL) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  uint64_t target = target_id(frame->header.target);
+  int correlated = frame->header.response || frame->header.acknowledgement;
+
+  /* Find a sequence that is not outstanding for this target */
+  uint8_t sequence = client->sequence;
+  if (correlated) {
+    int tries = 0;
+    while (index_find(client, target, sequence) != -1) {
+      if (++tries > UINT8_MAX) {
+        errno = EBUSY;
+        return -1;
+      }
+      sequence++;
+    }
+  }
+  client->sequence = sequence + 1;
+
+  uint32_t slot = client->free_head;
+  lifx_request_t *request = &client->requests[slot];
+
+  lifx_frame_t outbound = *frame;
+  outbound.header.source = client->source;
+  outbound.header.sequence = sequence;
+  uint8_t *packet = request->packet;
+  int size = lifx_encode_frame(&outbound, &packet, sizeof(request->packet));
+  if (size == -1) {
+    lifx_metrics_add(client->metrics, target, LIFX_METRIC_ENCODE_ERRORS, 1);
+    return -1;
+  }
+
+  client->free_head = request->next;
+  client->inflight++;
+  request->target = target;
+  request->sequence = sequence;
+  request->tagged = frame->header.tagged;
+  request->response = frame->header.response;
+  request->acknowledgement = frame->header.acknowledgement;
+  request->attempts = 0;
+  request->policy = *policy;
+  request->timeout = policy->timeout;
+  request->size = size;
+  request->addr = *addr;
+  request->callback = callback;
+  request->ctx = ctx;
+  request->next = NIL;
+  if (correlated) {
+    index_insert(client, slot);
+  }
+
+  /* Keep requests in order behind any that are already waiting */
+  if (client->unsent_head != NIL) {
+    unsent_push(client, slot);
+    return sequence;
+  }
+
+  int res = request_transmit(client, request);
+  if (res == -1) {
+    if (correlated) {
+      index_remove(client, index_find(client, target, sequence));
+    }
+    request_release(client, slot);
+    return -1;
+  }
+  if (res == 0) {
+    unsent_push(client, slot);
+    return sequence;
+  }
+
+  request_sent(client, slot, res);
+  return sequence;
+}
+
+int lifx_client_poll(lifx_client_t *client, int timeout) {
+  if (client == NULL) {
+    return -1;
+  }
+
+  /* Wake up in time for the next retransmission */
+  lifx_wheel_advance(&client->wheel, now_ms());
+  int64_t next = lifx_wheel_next(&client->wheel);
+  if (next != -1 && (timeout < 0 || next < timeout)) {
+    timeout = next;
+  }
+
+  uint64_t completed = client->stats.completed;
+  client->receiver.metrics = client->metrics;
+  struct epoll_event events[4];
+  int ready = epoll_wait(client->epfd, events, 4, timeout);
+  if (ready == -1) {
+    if (errno != EINTR) {
+      return -1;
+    }
+    ready = 0;
+  }
+
+  for (int e = 0; e < ready; ++e) {
+    if (events[e].events & EPOLLOUT) {
+      if (client_flush(client) == -1) {
+        return -1;
+      }
+    }
+
+    if (events[e].events & (EPOLLIN | EPOLLERR)) {
+      int count;
+      do {
+        count = lifx_receiver_recv_views(&client->receiver, client->sfd, 0);
+        if (count == -1) {
+          return -1;
+        }
+        for (int i = 0; i < count; ++i) {
+          client_dispatch(client, &client->receiver.views[i],
+                          &client->receiver.addrs[i]);
+        }
+      } while ((size_t)count == client->receiver.depth);
+    }
+  }
+
+  lifx_wheel_advance(&client->wheel, now_ms());
+
+  return client->stats.completed - completed;
+}
+
+int lifx_client_fd(const lifx_client_t *client) { return client->epfd; }
@@ -0,0 +1,436 @@
+#include "color.h"
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLOR_X86 1
+#endif
+
+/*
+ * RGB to HSV the way every kernel computes it, step by step in single
+ * precision with no operation fused or reordered, so the vector kernels give
+ * the scalar results bit for bit. The comparisons are written as max and min
+ * select them: NaN compares false and ends up as 0.
+ *
+ *   max = max(r, g, b)      d = max - min(r, g, b)
+ *   brightness = max * alpha
+ *   saturation = d / max
+ *   hue = (g - b) / d, (b - r) / d + 2 or (r - g) / d + 4 by which channel
+ *         is the max, plus 6 when negative, in sixths of the circle
+ *
+ * The numerator and offset of hue are selected first so a pixel takes two
+ * divisions, not four.
+ *
+ * Dividing by at least COLOR_TINY keeps black and grey at hue and saturation
+ * 0 without a branch. lib/color.c is built with -ffp-contract=off to keep the
+ * compiler from fusing multiplies and adds in one kernel but not another.
+ */
+#define COLOR_TINY 1e-20f
+#define COLOR_SCALE 65535.0f
+#define COLOR_HUE_SCALE (65536.0f / 6.0f)
+/* 8 bit channels are scaled to 0 to 1 by a multiply in every kernel */
+#define COLOR_BYTE_SCALE (1.0f / 255.0f)
+
+#define COLOR_MAX(a, b) ((a) > (b) ? (a) : (b))
+#define COLOR_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* What the pixels handed to a kernel are made of */
+typedef enum {
+  PIXELS_FLOAT,
+  PIXELS_BYTE,
+} pixels_format;
+
+static float clamp(float x) {
+  x = COLOR_MAX(x, 0.0f);
+  return COLOR_MIN(x, 1.0f);
+}
+
+/* Round a non negative value to the nearest integer, halves up */
+static uint32_t quantize(float x) { return (uint32_t)(int32_t)(x + 0.5f); }
+
+static void hsbk_scalar(float r, float g, float b, float a, uint16_t kelvin,
+                        uint32_t duration, lifx_set_color_payload_t *out) {
+  r = clamp(r);
+  g = clamp(g);
+  b = clamp(b);
+  a = clamp(a);
+
+  float max = COLOR_MAX(COLOR_MAX(r, g), b);
+  float min = COLOR_MIN(COLOR_MIN(r, g), b);
+  float d = max - min;
+  float bri = max * a;
+  float sat = d / COLOR_MAX(max, COLOR_TINY);
+  float safe = COLOR_MAX(d, COLOR_TINY);
+  float num = max == r ? g - b : max == g ? b - r : r - g;
+  float offset = max == r ? 0.0f : max == g ? 2.0f : 4.0f;
+  float h = num / safe + offset;
+  h = h < 0.0f ? h + 6.0f : h;
+
+  out->hue = quantize(h * COLOR_HUE_SCALE) & 0xffff;
+  out->saturation = quantize(sat * COLOR_SCALE);
+  out->brightness = quantize(bri * COLOR_SCALE);
+  out->kelvin = kelvin;
+  out->duration = duration;
+}
+
+static void convert_scalar(const void *pixels, pixels_format format,
+                           size_t channels, size_t n, uint16_t kelvin,
+                           uint32_t duration, lifx_set_color_payload_t *out) {
+  if (format == PIXELS_FLOAT) {
+    const float *p = pixels;
+    for (size_t i = 0; i < n; ++i, p += channels) {
+      hsbk_scalar(p[0], p[1], p[2], channels == 4 ? p[3] : 1.0f, kelvin,
+                  duration, &out[i]);
+    }
+    return;
+  }
+  const uint8_t *p = pixels;
+  for (size_t i = 0; i < n; ++i, p += channels) {
+    hsbk_scalar(p[0] * COLOR_BYTE_SCALE, p[1] * COLOR_BYTE_SCALE,
+                p[2] * COLOR_BYTE_SCALE,
+                channels == 4 ? p[3] * COLOR_BYTE_SCALE : 1.0f, kelvin,
+                duration, &out[i]);
+  }
+}
+
+#ifdef COLOR_X86
+_Static_assert(offsetof(lifx_set_color_payload_t, kelvin) == 6 &&
+                   offsetof(lifx_set_color_payload_t, duration) == 8,
+               "payload layout the kernels store into");
+
+/* Pixel i of pixels */
+static const void *pixels_at(const void *pixels, pixels_format format,
+                             size_t channels, size_t i) {
+  size_t size = format == PIXELS_FLOAT ? sizeof(float) : sizeof(uint8_t);
+  return (const uint8_t *)pixels + i * channels * size;
+}
+
+/* The 4 bytes of an 8 bit pixel, the first byte of the next one after an RGB
+ * pixel */
+static uint32_t pixel_word(const void *pixels, size_t channels, size_t i) {
+  uint32_t word;
+  memcpy(&word, pixels_at(pixels, PIXELS_BYTE, channels, i), sizeof(word));
+  return word;
+}
+
+/*
+ * Store 4 payloads. hs holds hue and saturation and bk brightness and kelvin
+ * of a pixel per lane, interleaving them gives the first 8 bytes of each
+ * payload, so a payload takes two stores instead of five.
+ */
+__attribute__((target("sse2"))) static void
+payloads_store(__m128i hs, __m128i bk, uint32_t duration,
+               lifx_set_color_payload_t *out) {
+  __m128i lo = _mm_unpacklo_epi32(hs, bk);
+  __m128i hi = _mm_unpackhi_epi32(hs, bk);
+  _mm_storel_epi64((__m128i *)&out[0], lo);
+  _mm_storel_epi64((__m128i *)&out[1], _mm_unpackhi_epi64(lo, lo));
+  _mm_storel_epi64((__m128i *)&out[2], hi);
+  _mm_storel_epi64((__m128i *)&out[3], _mm_unpackhi_epi64(hi, hi));
+  out[0].duration = duration;
+  out[1].duration = duration;
+  out[2].duration = duration;
+  out[3].duration = duration;
+}
+
+/* mask ? a : b per lane, SSE2 has no blend */
+#define SSE_SELECT(mask, a, b)                                                 \
+  _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b))
+
+/* Pixel i as r, g, b and alpha or whatever follows an RGB pixel */
+__attribute__((target("sse2"))) static inline __m128
+pixel_sse2(const void *pixels, pixels_format format, size_t channels,
+           size_t i) {
+  if (format == PIXELS_FLOAT) {
+    return _mm_loadu_ps(pixels_at(pixels, format, channels, i));
+  }
+  const __m128i zero = _mm_setzero_si128();
+  __m128i v = _mm_cvtsi32_si128(pixel_word(pixels, channels, i));
+  v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero);
+  return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(COLOR_BYTE_SCALE));
+}
+
+/* hsbk_scalar on 4 pixels */
+__attribute__((target("sse2"))) static inline void
+hsbk_sse2(__m128 r, __m128 g, __m128 b, __m128 a, uint16_t kelvin,
+          uint32_t duration, lifx_set_color_payload_t *out) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 four = _mm_set1_ps(4.0f);
+  const __m128 six = _mm_set1_ps(6.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 tiny = _mm_set1_ps(COLOR_TINY);
+  const __m128 scale = _mm_set1_ps(COLOR_SCALE);
+  const __m128 hue_scale = _mm_set1_ps(COLOR_HUE_SCALE);
+  const __m128i low = _mm_set1_epi32(0xffff);
+  const __m128i kelvins = _mm_set1_epi32((uint32_t)kelvin << 16);
+
+  r = _mm_min_ps(_mm_max_ps(r, zero), one);
+  g = _mm_min_ps(_mm_max_ps(g, zero), one);
+  b = _mm_min_ps(_mm_max_ps(b, zero), one);
+  a = _mm_min_ps(_mm_max_ps(a, zero), one);
+
+  __m128 max = _mm_max_ps(_mm_max_ps(r, g), b);
+  __m128 min = _mm_min_ps(_mm_min_ps(r, g), b);
+  __m128 d = _mm_sub_ps(max, min);
+  __m128 bri = _mm_mul_ps(max, a);
+  __m128 sat = _mm_div_ps(d, _mm_max_ps(max, tiny));
+  __m128 safe = _mm_max_ps(d, tiny);
+  __m128 is_r = _mm_cmpeq_ps(max, r);
+  __m128 is_g = _mm_cmpeq_ps(max, g);
+  __m128 num = SSE_SELECT(is_r, _mm_sub_ps(g, b),
+                          SSE_SELECT(is_g, _mm_sub_ps(b, r),
+                                     _mm_sub_ps(r, g)));
+  __m128 offset = SSE_SELECT(is_r, zero, SSE_SELECT(is_g, two, four));
+  __m128 h = _mm_add_ps(_mm_div_ps(num, safe), offset);
+  h = SSE_SELECT(_mm_cmplt_ps(h, zero), _mm_add_ps(h, six), h);
+
+  __m128i hue = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(h, hue_scale), half));
+  __m128i saturation =
+      _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(sat, scale), half));
+  __m128i brightness =
+      _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(bri, scale), half));
+  __m128i hs =
+      _mm_or_si128(_mm_and_si128(hue, low), _mm_slli_epi32(saturation, 16));
+  payloads_store(hs, _mm_or_si128(brightness, kelvins), duration, out);
+}
+
+__attribute__((target("sse2"))) static void
+convert_sse2(const void *pixels, pixels_format format, size_t channels,
+             size_t n, uint16_t kelvin, uint32_t duration,
+             lifx_set_color_payload_t *out) {
+  /* Every pixel is read as 4 channels, an RGB pixel with the red of the
+   * next one, so the last RGB pixel is left to the scalar tail */
+  size_t i = 0;
+  for (; i + 4 + (channels == 3) <= n; i += 4) {
+    __m128 r = pixel_sse2(pixels, format, channels, i);
+    __m128 g = pixel_sse2(pixels, format, channels, i + 1);
+    __m128 b = pixel_sse2(pixels, format, channels, i + 2);
+    __m128 a = pixel_sse2(pixels, format, channels, i + 3);
+    _MM_TRANSPOSE4_PS(r, g, b, a);
+    if (channels == 3) {
+      a = _mm_set1_ps(1.0f);
+    }
+    hsbk_sse2(r, g, b, a, kelvin, duration, out + i);
+  }
+  convert_scalar(pixels_at(pixels, format, channels, i), format, channels,
+                 n - i, kelvin, duration, out + i);
+}
+
+/* Pixels i and j as r, g, b and alpha, i in the low 128 bits */
+__attribute__((target("avx2"))) static inline __m256
+pixels_avx2(const void *pixels, pixels_format format, size_t channels,
+            size_t i, size_t j) {
+  if (format == PIXELS_FLOAT) {
+    return _mm256_loadu2_m128(pixels_at(pixels, format, channels, j),
+                              pixels_at(pixels, format, channels, i));
+  }
+  __m128i words = _mm_set_epi32(0, 0, pixel_word(pixels, channels, j),
+                                pixel_word(pixels, channels, i));
+  return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(words)),
+                       _mm256_set1_ps(COLOR_BYTE_SCALE));
+}
+
+/* hsbk_scalar on 8 pixels */
+__attribute__((target("avx2"))) static inline void
+hsbk_avx2(__m256 r, __m256 g, __m256 b, __m256 a, uint16_t kelvin,
+          uint32_t duration, lifx_set_color_payload_t *out) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 four = _mm256_set1_ps(4.0f);
+  const __m256 six = _mm256_set1_ps(6.0f);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 tiny = _mm256_set1_ps(COLOR_TINY);
+  const __m256 scale = _mm256_set1_ps(COLOR_SCALE);
+  const __m256 hue_scale = _mm256_set1_ps(COLOR_HUE_SCALE);
+  const __m256i low = _mm256_set1_epi32(0xffff);
+  const __m256i kelvins = _mm256_set1_epi32((uint32_t)kelvin << 16);
+
+  r = _mm256_min_ps(_mm256_max_ps(r, zero), one);
+  g = _mm256_min_ps(_mm256_max_ps(g, zero), one);
+  b = _mm256_min_ps(_mm256_max_ps(b, zero), one);
+  a = _mm256_min_ps(_mm256_max_ps(a, zero), one);
+
+  __m256 max = _mm256_max_ps(_mm256_max_ps(r, g), b);
+  __m256 min = _mm256_min_ps(_mm256_min_ps(r, g), b);
+  __m256 d = _mm256_sub_ps(max, min);
+  __m256 bri = _mm256_mul_ps(max, a);
+  __m256 sat = _mm256_div_ps(d, _mm256_max_ps(max, tiny));
+  __m256 safe = _mm256_max_ps(d, tiny);
+  /* blendv takes its second operand where the mask is set */
+  __m256 is_r = _mm256_cmp_ps(max, r, _CMP_EQ_OQ);
+  __m256 is_g = _mm256_cmp_ps(max, g, _CMP_EQ_OQ);
+  __m256 num = _mm256_blendv_ps(
+      _mm256_blendv_ps(_mm256_sub_ps(r, g), _mm256_sub_ps(b, r), is_g),
+      _mm256_sub_ps(g, b), is_r);
+  __m256 offset =
+      _mm256_blendv_ps(_mm256_blendv_ps(four, two, is_g), zero, is_r);
+  __m256 h = _mm256_add_ps(_mm256_div_ps(num, safe), offset);
+  h = _mm256_blendv_ps(h, _mm256_add_ps(h, six),
+                       _mm256_cmp_ps(h, zero, _CMP_LT_OQ));
+
+  __m256i hue =
+      _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(h, hue_scale), half));
+  __m256i saturation =
+      _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(sat, scale), half));
+  __m256i brightness =
+      _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(bri, scale), half));
+  __m256i hs = _mm256_or_si256(_mm256_and_si256(hue, low),
+                               _mm256_slli_epi32(saturation, 16));
+  __m256i bk = _mm256_or_si256(brightness, kelvins);
+  payloads_store(_mm256_castsi256_si128(hs), _mm256_castsi256_si128(bk),
+                 duration, out);
+  payloads_store(_mm256_extracti128_si256(hs, 1),
+                 _mm256_extracti128_si256(bk, 1), duration, out + 4);
+}
+
+__attribute__((target("avx2"))) static void
+convert_avx2(const void *pixels, pixels_format format, size_t channels,
+             size_t n, uint16_t kelvin, uint32_t duration,
+             lifx_set_color_payload_t *out) {
+  /* Pixels i and i + 4 share a register, transposed like in convert_sse2
+   * within each 128 bit lane */
+  size_t i = 0;
+  for (; i + 8 + (channels == 3) <= n; i += 8) {
+    __m256 t0 = pixels_avx2(pixels, format, channels, i, i + 4);
+    __m256 t1 = pixels_avx2(pixels, format, channels, i + 1, i + 5);
+    __m256 t2 = pixels_avx2(pixels, format, channels, i + 2, i + 6);
+    __m256 t3 = pixels_avx2(pixels, format, channels, i + 3, i + 7);
+    __m256 rg01 = _mm256_unpacklo_ps(t0, t1);
+    __m256 rg23 = _mm256_unpacklo_ps(t2, t3);
+    __m256 ba01 = _mm256_unpackhi_ps(t0, t1);
+    __m256 ba23 = _mm256_unpackhi_ps(t2, t3);
+    __m256 r = _mm256_shuffle_ps(rg01, rg23, 0x44);
+    __m256 g = _mm256_shuffle_ps(rg01, rg23, 0xee);
+    __m256 b = _mm256_shuffle_ps(ba01, ba23, 0x44);
+    __m256 a = channels == 4 ? _mm256_shuffle_ps(ba01, ba23, 0xee)
+                             : _mm256_set1_ps(1.0f);
+    hsbk_avx2(r, g, b, a, kelvin, duration, out + i);
+  }
+  convert_scalar(pixels_at(pixels, format, channels, i), format, channels,
+                 n - i, kelvin, duration, out + i);
+}
+#endif
+
+int lifx_color_kernel_supported(lifx_color_kernel kernel) {
+  switch (kernel) {
+  case LIFX_COLOR_AUTO:
+  case LIFX_COLOR_SCALAR:
+    return 1;
+#ifdef COLOR_X86
+  case LIFX_COLOR_SSE2:
+    return __builtin_cpu_supports("sse2");
+  case LIFX_COLOR_AVX2:
+    return __builtin_cpu_supports("avx2");
+#else
+  case LIFX_COLOR_SSE2:
+  case LIFX_COLOR_AVX2:
+    return 0;
+#endif
+  }
+  return 0;
+}
+
+lifx_color_kernel lifx_color_kernel_best(void) {
+  if (lifx_color_kernel_supported(LIFX_COLOR_AVX2)) {
+    return LIFX_COLOR_AVX2;
+  }
+  if (lifx_color_kernel_supported(LIFX_COLOR_SSE2)) {
+    return LIFX_COLOR_SSE2;
+  }
+  return LIFX_COLOR_SCALAR;
+}
+
+static int color_convert(lifx_color_kernel kernel, const void *pixels,
+                         pixels_format format, size_t channels, size_t n,
+                         uint16_t kelvin, uint32_t duration,
+                         lifx_set_color_payload_t *out) {
+  if ((pixels == NULL || out == NULL) && n > 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (channels != 3 && channels != 4) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (kernel == LIFX_COLOR_AUTO) {
+    kernel = lifx_color_kernel_best();
+  }
+  if (!lifx_color_kernel_supported(kernel)) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  switch (kernel) {
+#ifdef COLOR_X86
+  case LIFX_COLOR_SSE2:
+    convert_sse2(pixels, format, channels, n, kelvin, duration, out);
+    break;
+  case LIFX_COLOR_AVX2:
+    convert_avx2(pixels, format, channels, n, kelvin, duration, out);
+    break;
+#endif
+  default:
+    convert_scalar(pixels, format, channels, n, kelvin, duration, out);
+    break;
+  }
+  return 0;
+}
+
+int lifx_color_from_rgb_kernel(lifx_color_kernel kernel, const float *rgb,
+                               size_t channels, size_t n, uint16_t kelvin,
+                               uint32_t duration,
+                               lifx_set_color_payload_t *out) {
+  return color_convert(kernel, rgb, PIXELS_FLOAT, channels, n, kelvin,
+                       duration, out);
+}
+
+int lifx_color_from_rgb(const float *rgb, size_t channels, size_t n,
+                        uint16_t kelvin, uint32_t duration,
+                        lifx_set_color_payload_t *out) {
+  return lifx_color_from_rgb_kernel(LIFX_COLOR_AUTO, rgb, channels, n, kelvin,
+                                    duration, out);
+}
+
+int lifx_color_from_rgb8_kernel(lifx_color_kernel kernel, const uint8_t *rgb,
+                                size_t channels, size_t n, uint16_t kelvin,
+                                uint32_t duration,
+                                lifx_set_color_payload_t *out) {
+  return color_convert(kernel, rgb, PIXELS_BYTE, channels, n, kelvin,
+                       duration, out);
+}
+
+int lifx_color_from_rgb8(const uint8_t *rgb, size_t channels, size_t n,
+                         uint16_t kelvin, uint32_t duration,
+                         lifx_set_color_payload_t *out) {
+  return lifx_color_from_rgb8_kernel(LIFX_COLOR_AUTO, rgb, channels, n,
+                                     kelvin, duration, out);
+}
+
+const char *lifx_color_kernel_name(lifx_color_kernel kernel) {
+  switch (kernel) {
+  case LIFX_COLOR_AUTO:
+    return "auto";
+  case LIFX_COLOR_SCALAR:
+    return "scalar";
+  case LIFX_COLOR_SSE2:
+    return "sse2";
+  case LIFX_COLOR_AVX2:
+    return "avx2";
+  }
+  return "unknown";
+}
+
+int lifx_color_kernel_parse(const char *name, lifx_color_kernel *kernel) {
+  for (int i = LIFX_COLOR_AUTO; i <= LIFX_COLOR_AVX2; ++i) {
+    if (strcmp(name, lifx_color_kernel_name(i)) == 0) {
+      *kernel = i;
+      return 0;
+    }
+  }
+  return -1;
+}
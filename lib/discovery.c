@@ -0,0 +1,346 @@
+#include "discovery.h"
+#include "batch.h"
+#include "io.h"
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RECV_DEPTH 64
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* xorshift64, good enough to spread probes */
+static uint64_t next_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+/* interval scaled by a random factor in [0.75, 1.25] */
+static uint64_t jitter(uint64_t interval, uint64_t *state) {
+  return interval * 3 / 4 + next_random(state) % (interval / 2 + 1);
+}
+
+void lifx_discovery_config_init(lifx_discovery_config_t *config) {
+  memset(config, 0, sizeof(*config));
+  config->source = getpid() | 1;
+  config->port = 56700;
+  config->timeout = 2000;
+  config->interval = 50;
+  config->max_interval = 400;
+  config->quiet = 100;
+  config->min_probes = 2;
+  config->refresh = 60000;
+  config->stale = 60000;
+  config->dead = 180000;
+}
+
+int lifx_discovery_interfaces(struct sockaddr_in *addrs, size_t n,
+                              uint16_t port) {
+  if (addrs == NULL || n == 0) {
+    return -1;
+  }
+
+  size_t count = 0;
+  struct ifaddrs *ifaddr;
+  if (getifaddrs(&ifaddr) == 0) {
+    for (struct ifaddrs *ifa = ifaddr; ifa != NULL && count < n;
+         ifa = ifa->ifa_next) {
+      if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_INET ||
+          !(ifa->ifa_flags & IFF_UP) || !(ifa->ifa_flags & IFF_BROADCAST) ||
+          (ifa->ifa_flags & IFF_LOOPBACK) || ifa->ifa_broadaddr == NULL) {
+        continue;
+      }
+
+      struct in_addr broadcast =
+          ((struct sockaddr_in *)ifa->ifa_broadaddr)->sin_addr;
+      size_t i;
+      for (i = 0; i < count; ++i) {
+        if (addrs[i].sin_addr.s_addr == broadcast.s_addr) {
+          break;
+        }
+      }
+      if (i < count) {
+        continue;
+      }
+
+      memset(&addrs[count], 0, sizeof(addrs[count]));
+      addrs[count].sin_family = AF_INET;
+      addrs[count].sin_addr = broadcast;
+      addrs[count].sin_port = htons(port);
+      count++;
+    }
+    freeifaddrs(ifaddr);
+  }
+
+  if (count == 0) {
+    memset(&addrs[0], 0, sizeof(addrs[0]));
+    addrs[0].sin_family = AF_INET;
+    addrs[0].sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    addrs[0].sin_port = htons(port);
+    count = 1;
+  }
+
+  return count;
+}
+
+int lifx_discover(lifx_registry_t *registry,
+                  const lifx_discovery_config_t *config) {
+  if (registry == NULL || config == NULL || config->interval == 0) {
+    return -1;
+  }
+
+  struct sockaddr_in addrs[LIFX_DISCOVERY_INTERFACES_MAX];
+  int interfaces =
+      lifx_discovery_interfaces(addrs, LIFX_DISCOVERY_INTERFACES_MAX,
+                                config->port);
+
+  int sfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (sfd == -1) {
+    return -1;
+  }
+
+  int yes = 1;
+  struct sockaddr_in local = {0};
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (setsockopt(sfd, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes)) == -1 ||
+      bind(sfd, (struct sockaddr *)&local, sizeof(local)) == -1) {
+    close(sfd);
+    return -1;
+  }
+
+  lifx_batch_t batch;
+  lifx_io_t io;
+  if (lifx_batch_init(&batch, interfaces) == -1) {
+    close(sfd);
+    return -1;
+  }
+  if (lifx_io_init(&io, sfd, RECV_DEPTH, config->backend) == -1) {
+    lifx_batch_free(&batch);
+    close(sfd);
+    return -1;
+  }
+
+  /* The same GetService goes to every interface, encode it once */
+  lifx_frame_t probe = {
+      .header =
+          {
+              .tagged = 1,
+              .source = config->source,
+              .type = GetService,
+          },
+  };
+  for (int i = 0; i < interfaces; ++i) {
+    lifx_batch_add(&batch, &probe, &addrs[i]);
+  }
+
+  uint64_t rng = now_ms() ^ ((uint64_t)config->source << 32) ^ 1;
+  uint64_t seen = lifx_registry_now();
+  uint64_t start = now_ms();
+  uint64_t deadline = start + config->timeout;
+  uint64_t next_probe = start;
+  uint64_t interval = config->interval;
+  uint64_t last_change = start;
+  uint32_t probes = 0;
+  int responders = 0;
+  int res = 0;
+
+  while (1) {
+    uint64_t now = now_ms();
+
+    if (now >= next_probe) {
+      batch.sent = 0;
+      if (lifx_io_send(&io, &batch) == -1) {
+        res = -1;
+        break;
+      }
+      probes++;
+      next_probe = now + jitter(interval, &rng);
+      interval *= 2;
+      if (interval > config->max_interval) {
+        interval = config->max_interval;
+      }
+    }
+
+    /* Done once nothing new turned up for a while */
+    uint64_t stop = last_change + config->quiet;
+    if (config->expected != 0 && (uint32_t)responders >= config->expected) {
+      break;
+    }
+    if (now >= deadline || (probes >= config->min_probes && now >= stop)) {
+      break;
+    }
+
+    uint64_t wake = deadline;
+    if (next_probe < wake) {
+      wake = next_probe;
+    }
+    if (probes >= config->min_probes && stop < wake) {
+      wake = stop;
+    }
+
+    int count = lifx_io_recv(&io, wake - now);
+    if (count == -1) {
+      res = -1;
+      break;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      const lifx_frame_view_t *view = &io.views[i];
+      if (lifx_view_type(view) != StateService ||
+          lifx_view_source(view) != config->source ||
+          io.addrs[i].ss_family != AF_INET) {
+        continue;
+      }
+      lifx_frame_t reply;
+      if (lifx_view_decode(view, &reply) == -1) {
+        continue;
+      }
+      const lifx_frame_t *frame = &reply;
+
+      /* A device counts once per run, however many probes it answers */
+      const uint8_t *target = frame->header.target;
+      lifx_device_t *device = lifx_registry_find(registry, target);
+      int fresh = device == NULL || device->last_seen < seen;
+      if (lifx_registry_observe(registry, frame,
+                                (struct sockaddr_in *)&io.addrs[i],
+                                lifx_registry_now()) == -1) {
+        continue;
+      }
+      device = lifx_registry_find(registry, target);
+      if (fresh && device != NULL) {
+        responders++;
+        last_change = now_ms();
+        if (config->callback != NULL) {
+          config->callback(device, config->ctx);
+        }
+      }
+    }
+  }
+
+  lifx_io_free(&io);
+  lifx_batch_free(&batch);
+  close(sfd);
+
+  return res == -1 ? -1 : responders;
+}
+
+int lifx_discovery_init(lifx_discovery_t *discovery,
+                        const lifx_discovery_config_t *config, uint64_t now) {
+  if (discovery == NULL || config == NULL || config->refresh == 0) {
+    return -1;
+  }
+
+  memset(discovery, 0, sizeof(*discovery));
+  discovery->source = config->source;
+  discovery->refresh = config->refresh;
+  discovery->stale = config->stale;
+  discovery->dead = config->dead;
+  discovery->started = lifx_registry_now();
+  discovery->next = now + config->refresh;
+  discovery->interfaces = lifx_discovery_interfaces(
+      discovery->broadcasts, LIFX_DISCOVERY_INTERFACES_MAX, config->port);
+  return 0;
+}
+
+/* Remove every device last seen before a time, see lifx_cache_expire */
+static size_t discovery_expire(lifx_registry_t *registry, uint64_t before) {
+  size_t removed = 0;
+
+  /* Removal shifts later entries back into i, so look at i again */
+  size_t i = 0;
+  while (i < registry->capacity) {
+    const lifx_device_t *device = &registry->devices[i];
+    if (registry->keys[i] != 0 && device->last_seen < before) {
+      uint8_t target[8];
+      memcpy(target, device->target, 8);
+      lifx_registry_remove(registry, target);
+      removed++;
+      continue;
+    }
+    ++i;
+  }
+
+  return removed;
+}
+
+int lifx_discovery_step(lifx_discovery_t *discovery,
+                        lifx_registry_t *registry, uint64_t now,
+                        lifx_scheduler_emit emit, void *ctx) {
+  if (discovery == NULL || registry == NULL || emit == NULL) {
+    return -1;
+  }
+  if (!discovery->probing && now < discovery->next) {
+    return 0;
+  }
+
+  uint64_t seen = lifx_registry_now();
+  size_t removed = 0;
+  if (!discovery->probing) {
+    /* Devices known before init had no chance to answer until now */
+    if (seen >= discovery->dead &&
+        discovery->started <= seen - discovery->dead) {
+      removed = discovery_expire(registry, seen - discovery->dead);
+      discovery->removed += removed;
+    }
+    discovery->probing = 1;
+    discovery->broadcasts_sent = 0;
+    discovery->cursor = 0;
+    discovery->next = now + discovery->refresh;
+  }
+
+  lifx_frame_t probe = {
+      .header =
+          {
+              .tagged = 1,
+              .source = discovery->source,
+              .type = GetService,
+          },
+  };
+  while (discovery->broadcasts_sent < discovery->interfaces) {
+    if (emit(ctx, &probe,
+             &discovery->broadcasts[discovery->broadcasts_sent]) == -1) {
+      return removed;
+    }
+    discovery->broadcasts_sent++;
+    discovery->probes++;
+  }
+
+  /* Devices that stopped answering broadcasts, or only ever were cached */
+  probe.header.tagged = 0;
+  size_t cursor = discovery->cursor;
+  const lifx_device_t *device;
+  while ((device = lifx_registry_next(registry, &cursor)) != NULL) {
+    if (device->last_seen + discovery->stale > seen) {
+      discovery->cursor = cursor;
+      continue;
+    }
+    memcpy(probe.header.target, device->target, sizeof(device->target));
+    if (emit(ctx, &probe, &device->addr) == -1) {
+      return removed;
+    }
+    discovery->cursor = cursor;
+    discovery->probes++;
+  }
+  discovery->probing = 0;
+
+  return removed;
+}
+
+int64_t lifx_discovery_next(const lifx_discovery_t *discovery, uint64_t now) {
+  if (discovery->probing || now >= discovery->next) {
+    return 0;
+  }
+  return discovery->next - now;
+}
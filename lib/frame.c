@@ -1,126 +1,113 @@
 #include "frame.h"
+#include "wire.h"
 #include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-
-/* TODO: Remove all failure points, as they should be handled by the user.
- * Instead find a way to signify an error */
+#include <string.h>
+
+/*
+ * Every encoder and decoder works on fixed offsets from the start of its part
+ * of the frame. Bounds are checked once per frame so the individual field
+ * stores and loads need no checks of their own.
+ *
+ * The payload codec is generated from LIFX_MESSAGES and the LIFX_FIELDS_
+ * lists, a straight line encoder and decoder per type found through a table
+ * indexed by type id.
+ */
+
+#define ENCODE_U8(b, value, length) (b)[0] = (value)
+#define ENCODE_U16(b, value, length) lifx_store_le16(b, value)
+#define ENCODE_U32(b, value, length) lifx_store_le32(b, value)
+#define ENCODE_BYTES(b, value, length) memcpy(b, value, length)
+#define ENCODE_RESERVED(b, value, length) memset(b, FRAME_RESERVED, length)
+
+#define DECODE_U8(b, value, length) (value) = (b)[0]
+#define DECODE_U16(b, value, length) (value) = lifx_load_le16(b)
+#define DECODE_U32(b, value, length) (value) = lifx_load_le32(b)
+#define DECODE_BYTES(b, value, length)                                         \
+  do {                                                                         \
+    memcpy(value, b, length);                                                  \
+    (value)[length] = '\0';                                                    \
+  } while (0)
+#define DECODE_RESERVED(b, value, length)
+
+#define ENCODE_FIELD(m, kind, field, offset, length)                           \
+  ENCODE_##kind(b + (offset), payload->m.field, length);
+#define DECODE_FIELD(m, kind, field, offset, length)                           \
+  DECODE_##kind(b + (offset), payload->m.field, length);
+#define FIELD_LENGTH(m, kind, field, offset, length) +(length)
+
+#define DEFINE_CODEC(name, id, size, member)                                   \
+  _Static_assert(0 LIFX_FIELDS_##name(FIELD_LENGTH, member) == (size),         \
+                 "fields of " #name " do not cover its payload");             \
+  static void encode_##name(uint8_t *b, const lifx_payload_t *payload) {       \
+    (void)b;                                                                   \
+    (void)payload;                                                             \
+    LIFX_FIELDS_##name(ENCODE_FIELD, member)                                   \
+  }                                                                            \
+  static void decode_##name(const uint8_t *b, lifx_payload_t *payload) {       \
+    (void)b;                                                                   \
+    (void)payload;                                                             \
+    LIFX_FIELDS_##name(DECODE_FIELD, member)                                   \
+  }
+LIFX_MESSAGES(DEFINE_CODEC)
+
+/* As large as the largest type id, like union lifx_payload_space */
+#define MESSAGE_ID_SPACE(name, id, size, member) uint8_t name[(id) + 1];
+union message_id_space {
+  LIFX_MESSAGES(MESSAGE_ID_SPACE)
+};
+#define MESSAGE_ID_MAX (sizeof(union message_id_space) - 1)
 
 typedef struct {
-  uint8_t *const *buf;
-  const int capacity;
-  int cursor;
-} lifx_packet_t;
-
-int write_packet(lifx_packet_t *packet, uint64_t v, int n) {
-  if ((packet->cursor + n) > packet->capacity) {
-    fprintf(stderr, "[WARN] overwrite packet\n");
-    exit(EXIT_FAILURE);
-  }
+  void (*encode)(uint8_t *b, const lifx_payload_t *payload);
+  void (*decode)(const uint8_t *b, lifx_payload_t *payload);
+  uint16_t size; /* payload bytes on the wire */
+} message_t;
 
-  uint8_t write = 0;
+/* Indexed by type id, encode is NULL for ids that are not a known type */
+#define MESSAGE_ENTRY(name, id, size, member)                                  \
+  [id] = {encode_##name, decode_##name, size},
+static const message_t messages[MESSAGE_ID_MAX + 1] = {
+    LIFX_MESSAGES(MESSAGE_ENTRY)};
 
-  for (int i = 0; i < n; ++i) {
-    write = v >> (8 * i);
-    (*packet->buf)[packet->cursor + i] = write;
+static const message_t *message_find(lifx_message_type type) {
+  if ((unsigned)type > MESSAGE_ID_MAX || messages[type].encode == NULL) {
+    return NULL;
   }
-  packet->cursor += n;
-
-  return packet->cursor;
-}
-
-int write_uint8(lifx_packet_t *packet, uint8_t v) {
-  return write_packet(packet, v, 1);
-}
-
-int write_uint16(lifx_packet_t *packet, uint16_t v) {
-  return write_packet(packet, v, 2);
-}
-
-int write_uint32(lifx_packet_t *packet, uint32_t v) {
-  return write_packet(packet, v, 4);
+  return &messages[type];
 }
 
-int write_uint64(lifx_packet_t *packet, uint64_t v) {
-  return write_packet(packet, v, 8);
-}
-
-uint64_t read_packet(lifx_packet_t *packet, int n) {
-  if ((packet->cursor + n) > packet->capacity) {
-    fprintf(stderr, "[WARN] overread packet\n");
-    exit(EXIT_FAILURE);
-  }
-
-  uint64_t output = 0;
-  uint8_t value = 0;
-  for (int i = 0; i < n; ++i) {
-    value = (*packet->buf)[packet->cursor + i];
-    output |= value << (8 * i);
+int lifx_frame_size(lifx_message_type type) {
+  const message_t *message = message_find(type);
+  if (message == NULL) {
+    return -1;
   }
-  packet->cursor += n;
-
-  return output;
+  return FRAME_HEADER_SIZE + message->size;
 }
 
-uint8_t read_uint8(lifx_packet_t *packet) { return read_packet(packet, 1); }
-
-uint16_t read_uint16(lifx_packet_t *packet) { return read_packet(packet, 2); }
-
-uint32_t read_uint32(lifx_packet_t *packet) { return read_packet(packet, 4); }
-
-uint64_t read_uint64(lifx_packet_t *packet) { return read_packet(packet, 8); }
-
-int encode_state_service_payload(lifx_packet_t *packet,
-                                 const lifx_state_service_payload_t *payload) {
-  write_uint8(packet, payload->service);
-  write_uint32(packet, payload->port);
-  return packet->cursor;
-}
-
-int encode_set_color_payload(lifx_packet_t *packet,
-                             const lifx_set_color_payload_t *payload) {
-  write_uint8(packet, FRAME_RESERVED); // Reserved
-  write_uint16(packet, payload->hue);
-  write_uint16(packet, payload->saturation);
-  write_uint16(packet, payload->brightness);
-  write_uint16(packet, payload->kelvin);
-  write_uint32(packet, payload->duration);
-  return packet->cursor;
-}
-
-int encode_set_power_payload(lifx_packet_t *packet,
-                             const lifx_set_power_payload_t *payload) {
-  write_uint16(packet, payload->level);
-  return packet->cursor;
-}
+static void encode_header(const lifx_header_t *header, uint16_t size,
+                          uint8_t *b) {
+  /* Frame Header */
+  uint16_t protocol = FRAME_PROTOCOL;
+  protocol |= FRAME_ADDRESSABLE << 12;
+  protocol |= header->tagged << 13;
+  protocol |= FRAME_ORIGIN << 14;
+  lifx_store_le16(b + LIFX_OFFSET_SIZE, size);
+  lifx_store_le16(b + LIFX_OFFSET_PROTOCOL, protocol);
+  lifx_store_le32(b + LIFX_OFFSET_SOURCE, header->source);
 
-int encode_echo_request_payload(lifx_packet_t *packet,
-                                const lifx_echo_request_payload_t *payload) {
-  for (int i = 0; i < 64; ++i) {
-    write_uint8(packet, payload->echoing[i]);
-  }
-  return packet->cursor;
-}
+  /* Frame Address */
+  memcpy(b + LIFX_OFFSET_TARGET, header->target, sizeof(header->target));
+  memset(b + LIFX_OFFSET_ADDRESS_RESERVED, FRAME_RESERVED, 6);
+  uint8_t flags = 0;
+  flags |= header->response;
+  flags |= header->acknowledgement << 1;
+  b[LIFX_OFFSET_FLAGS] = flags;
+  b[LIFX_OFFSET_SEQUENCE] = header->sequence;
 
-int encode_payload(lifx_packet_t *packet, lifx_message_type type,
-                   const lifx_payload_t *payload) {
-  switch (type) {
-  case StateService:
-    return encode_state_service_payload(packet,
-                                        &payload->state_service_payload);
-  case SetPower:
-    return encode_set_power_payload(packet, &payload->set_power_payload);
-  case SetColor:
-    return encode_set_color_payload(packet, &payload->set_color_payload);
-  case EchoRequest:
-    return encode_echo_request_payload(packet, &payload->echo_request_payload);
-  case GetService:
-  case GetLabel:
-    return packet->cursor;
-  default:
-    fprintf(stderr, "[WARN] invalid payload type '%d'\n", type);
-    exit(EXIT_FAILURE);
-  }
+  /* Protocol Header */
+  lifx_store_le64(b + LIFX_OFFSET_PROTOCOL_RESERVED, FRAME_RESERVED);
+  lifx_store_le16(b + LIFX_OFFSET_TYPE, header->type);
+  lifx_store_le16(b + LIFX_OFFSET_TYPE_RESERVED, FRAME_RESERVED);
 }
 
 int lifx_encode_frame(const lifx_frame_t *frame, uint8_t *const *buf,
@@ -129,97 +116,73 @@ int lifx_encode_frame(const lifx_frame_t *frame, uint8_t *const *buf,
     return -1;
   }
 
-  if (frame->header.size < FRAME_HEADER_SIZE) {
+  /* The whole frame is bounds checked once up front, then every field is
+   * stored at its fixed offset */
+  const message_t *message = message_find(frame->header.type);
+  if (message == NULL || n < (size_t)FRAME_HEADER_SIZE + message->size) {
     return -1;
   }
+  encode_header(&frame->header, FRAME_HEADER_SIZE + message->size, *buf);
+  message->encode(*buf + FRAME_HEADER_SIZE, &frame->payload);
 
-  lifx_packet_t packet = {
-      .buf = buf,
-      .capacity = n,
-      .cursor = 0,
-  };
-
-  /* Frame Header */
-  write_uint16(&packet, frame->header.size);
-  uint16_t protocol = FRAME_PROTOCOL;
-  protocol |= FRAME_ADDRESSABLE << 12;
-  protocol |= frame->header.tagged << 13;
-  protocol |= FRAME_ORIGIN << 14;
-  write_uint16(&packet, protocol);
-  write_uint32(&packet, frame->header.source);
+  return FRAME_HEADER_SIZE + message->size;
+}
 
-  /* Frame Address */
-  for (int i = 0; i < 8; ++i) {
-    write_uint8(&packet, frame->header.target[i]);
-  }
-  for (int i = 0; i < 6; ++i) { // Reserved Bytes
-    write_uint8(&packet, FRAME_RESERVED);
+int lifx_encode_header_template(lifx_header_template_t *tmpl,
+                                const lifx_header_t *header) {
+  if (tmpl == NULL || header == NULL) {
+    return -1;
   }
-  uint8_t flags = 0;
-  flags |= frame->header.response;
-  flags |= frame->header.acknowledgement << 1;
-  write_uint8(&packet, flags);
-  write_uint8(&packet, frame->header.sequence);
-
-  /* Protocol Header */
-  write_uint64(&packet, FRAME_RESERVED); // Reserved Bytes
-  write_uint16(&packet, frame->header.type);
-  write_uint16(&packet, FRAME_RESERVED); // Reserved Bytes
 
-  /* Payload */
-  encode_payload(&packet, frame->header.type, &(frame->payload));
+  encode_header(header, 0, tmpl->bytes);
+  tmpl->bytes[LIFX_OFFSET_SEQUENCE] = 0;
+  lifx_store_le16(tmpl->bytes + LIFX_OFFSET_TYPE, 0);
 
-  return packet.cursor;
+  return FRAME_HEADER_SIZE;
 }
 
-int decode_state_label_payload(lifx_packet_t *packet,
-                               lifx_state_label_payload_t *payload) {
-  int i;
-  for (i = 0; i < 32; ++i) {
-    payload->label[i] = read_uint8(packet);
-  }
-  payload->label[i] = '\0';
+int lifx_encode_templated_frame(const lifx_header_template_t *tmpl,
+                                uint8_t sequence, lifx_message_type type,
+                                const lifx_payload_t *payload,
+                                uint8_t *const *buf, const size_t n) {
+  static const lifx_payload_t empty;
 
-  return packet->cursor;
-}
+  if (tmpl == NULL || buf == NULL) {
+    return -1;
+  }
 
-int decode_echo_response_payload(lifx_packet_t *packet,
-                                 lifx_echo_response_payload_t *payload) {
-  int i;
-  for (i = 0; i < 64; ++i) {
-    payload->echoing[i] = read_uint8(packet);
+  const message_t *message = message_find(type);
+  if (message == NULL || n < (size_t)FRAME_HEADER_SIZE + message->size) {
+    return -1;
   }
-  payload->echoing[i] = '\0';
+  uint16_t size = FRAME_HEADER_SIZE + message->size;
+
+  uint8_t *b = *buf;
+  memcpy(b, tmpl->bytes, FRAME_HEADER_SIZE);
+  lifx_store_le16(b + LIFX_OFFSET_SIZE, size);
+  b[LIFX_OFFSET_SEQUENCE] = sequence;
+  lifx_store_le16(b + LIFX_OFFSET_TYPE, type);
+  message->encode(b + FRAME_HEADER_SIZE, payload == NULL ? &empty : payload);
 
-  return packet->cursor;
+  return size;
 }
 
-int decode_state_service_payload(lifx_packet_t *packet,
-                                 lifx_state_service_payload_t *payload) {
-  payload->service = read_uint8(packet);
-  payload->port = read_uint32(packet);
+static void decode_header(lifx_header_t *header, const uint8_t *b) {
+  /* Frame Header */
+  header->size = lifx_load_le16(b + LIFX_OFFSET_SIZE);
+  uint16_t protocol = lifx_load_le16(b + LIFX_OFFSET_PROTOCOL);
+  header->tagged = (protocol & (1 << 13)) > 0;
+  header->source = lifx_load_le32(b + LIFX_OFFSET_SOURCE);
 
-  return packet->cursor;
-}
+  /* Frame Address */
+  memcpy(header->target, b + LIFX_OFFSET_TARGET, sizeof(header->target));
+  uint8_t flags = b[LIFX_OFFSET_FLAGS];
+  header->response = (flags & 1) != 0;
+  header->acknowledgement = (flags & (1 << 1)) != 0;
+  header->sequence = b[LIFX_OFFSET_SEQUENCE];
 
-int decode_payload(lifx_packet_t *packet, lifx_message_type type,
-                   lifx_payload_t *payload) {
-  switch (type) {
-  case StateLabel:
-    return decode_state_label_payload(packet, &payload->state_label_payload);
-  case EchoResponse:
-    return decode_echo_response_payload(packet,
-                                        &payload->echo_response_payload);
-  case StateService:
-    return decode_state_service_payload(packet,
-                                        &payload->state_service_payload);
-  case GetService:
-  case Acknowledgement:
-    return packet->cursor;
-  default:
-    fprintf(stderr, "[WARN] invalid payload type '%d'\n", type);
-    exit(EXIT_FAILURE);
-  }
+  /* Protocol Header */
+  header->type = lifx_load_le16(b + LIFX_OFFSET_TYPE);
 }
 
 int lifx_decode_frame(lifx_frame_t *frame, uint8_t *const *buf, size_t n) {
@@ -231,37 +194,21 @@ int lifx_decode_frame(lifx_frame_t *frame, uint8_t *const *buf, size_t n) {
     return -1;
   }
 
-  lifx_packet_t packet = {
-      .buf = buf,
-      .capacity = n,
-      .cursor = 0,
-  };
-
-  /* Frame Header */
-  frame->header.size = read_uint16(&packet);
-  uint16_t protocol = read_uint16(&packet);
-  frame->header.tagged = (protocol & (1 << 13)) > 0;
-  frame->header.source = read_uint32(&packet);
+  if (n < FRAME_HEADER_SIZE) {
+    return -1;
+  }
+  decode_header(&frame->header, *buf);
 
-  /* Frame Address */
-  for (int i = 0; i < 8; ++i) {
-    frame->header.target[i] = read_uint8(&packet);
+  /* Types this library does not know, newer firmware has plenty, keep their
+   * header and skip their payload */
+  const message_t *message = message_find(frame->header.type);
+  if (message == NULL) {
+    return FRAME_HEADER_SIZE;
   }
-  for (int i = 0; i < 6; ++i) { // Reserved Bytes
-    read_uint8(&packet);
+  if (n < (size_t)FRAME_HEADER_SIZE + message->size) {
+    return -1;
   }
-  uint8_t flags = read_uint8(&packet);
-  frame->header.response = (flags & 1) < 0;
-  frame->header.acknowledgement = (flags & (1 << 1)) < 0;
-  frame->header.sequence = read_uint8(&packet);
-
-  /* Protocol Header */
-  read_uint64(&packet); // Reserved Bytes
-  frame->header.type = read_uint16(&packet);
-  read_uint16(&packet); // Reserved Bytes
-
-  /* Payload */
-  decode_payload(&packet, frame->header.type, &frame->payload);
+  message->decode(*buf + FRAME_HEADER_SIZE, &frame->payload);
 
-  return packet.cursor;
+  return FRAME_HEADER_SIZE + message->size;
 }
@@ -0,0 +1,92 @@
+#include "histogram.h"
+#include <string.h>
+
+#define HALF (1u << (LIFX_HISTOGRAM_BITS - 1))
+
+size_t lifx_histogram_bucket(uint64_t value) {
+  if (value >> LIFX_HISTOGRAM_MAX_BITS) {
+    return LIFX_HISTOGRAM_BUCKETS - 1;
+  }
+  if (value < 2 * HALF) {
+    return value;
+  }
+
+  /* Keep the top LIFX_HISTOGRAM_BITS bits, the shift picks the power of two */
+  int shift = 63 - __builtin_clzll(value) - (LIFX_HISTOGRAM_BITS - 1);
+  return shift * HALF + (value >> shift);
+}
+
+uint64_t lifx_histogram_bucket_value(size_t index) {
+  if (index < 2 * HALF) {
+    return index;
+  }
+
+  int shift = index / HALF - 1;
+  uint64_t sub = index - shift * HALF;
+  return ((sub + 1) << shift) - 1;
+}
+
+void lifx_histogram_init(lifx_histogram_t *histogram) {
+  memset(histogram, 0, sizeof(*histogram));
+  histogram->min = UINT64_MAX;
+}
+
+void lifx_histogram_record(lifx_histogram_t *histogram, uint64_t value) {
+  histogram->counts[lifx_histogram_bucket(value)]++;
+  histogram->count++;
+  histogram->sum += value;
+  if (value < histogram->min) {
+    histogram->min = value;
+  }
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+}
+
+void lifx_histogram_merge(lifx_histogram_t *dst, const lifx_histogram_t *src) {
+  for (size_t i = 0; i < LIFX_HISTOGRAM_BUCKETS; ++i) {
+    dst->counts[i] += src->counts[i];
+  }
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->min < dst->min) {
+    dst->min = src->min;
+  }
+  if (src->max > dst->max) {
+    dst->max = src->max;
+  }
+}
+
+uint64_t lifx_histogram_quantile(const lifx_histogram_t *histogram,
+                                 double quantile) {
+  if (histogram->count == 0) {
+    return 0;
+  }
+
+  /* Rank of the value at quantile, counting from 1 */
+  uint64_t rank = quantile * histogram->count + 0.5;
+  if (rank < 1) {
+    rank = 1;
+  }
+  if (rank > histogram->count) {
+    rank = histogram->count;
+  }
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < LIFX_HISTOGRAM_BUCKETS; ++i) {
+    seen += histogram->counts[i];
+    if (seen >= rank) {
+      uint64_t value = lifx_histogram_bucket_value(i);
+      return value > histogram->max ? histogram->max : value;
+    }
+  }
+
+  return histogram->max;
+}
+
+double lifx_histogram_mean(const lifx_histogram_t *histogram) {
+  if (histogram->count == 0) {
+    return 0;
+  }
+  return (double)histogram->sum / histogram->count;
+}
@@ -0,0 +1,191 @@
+#include "io.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#ifdef LIFX_HAVE_IO_URING
+#include "uring.h"
+#endif
+
+static int epoll_init(lifx_io_t *io) {
+  if (lifx_receiver_init(&io->receiver, io->depth) == -1) {
+    return -1;
+  }
+
+  io->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (io->epfd == -1) {
+    lifx_receiver_free(&io->receiver);
+    return -1;
+  }
+  struct epoll_event event = {
+      .events = EPOLLIN,
+      .data.fd = io->sfd,
+  };
+  if (epoll_ctl(io->epfd, EPOLL_CTL_ADD, io->sfd, &event) == -1) {
+    close(io->epfd);
+    io->epfd = -1;
+    lifx_receiver_free(&io->receiver);
+    return -1;
+  }
+
+  io->views = io->receiver.views;
+  io->addrs = io->receiver.addrs;
+  return 0;
+}
+
+static int epoll_recv(lifx_io_t *io, int timeout) {
+  io->count = 0;
+  if (timeout != 0) {
+    struct epoll_event events[2];
+    io->syscalls++;
+    int ready = epoll_wait(io->epfd, events, 2, timeout);
+    if (ready == -1) {
+      return errno == EINTR ? 0 : -1;
+    }
+    if (ready == 0 || (ready == 1 && events[0].data.fd == io->watch)) {
+      return 0;
+    }
+  }
+
+  io->syscalls++;
+  int count = lifx_receiver_recv_views(&io->receiver, io->sfd, 0);
+  if (count == -1) {
+    return -1;
+  }
+  io->count = count;
+  io->dropped = io->receiver.dropped;
+  return count;
+}
+
+static int epoll_send(lifx_io_t *io, lifx_batch_t *batch) {
+  uint64_t syscalls = batch->syscalls;
+  int sent = lifx_batch_send(io->sfd, batch);
+  io->syscalls += batch->syscalls - syscalls;
+  return sent;
+}
+
+int lifx_io_init(lifx_io_t *io, int sfd, size_t depth,
+                 lifx_io_backend backend) {
+  if (io == NULL || sfd < 0 || depth == 0 || backend < LIFX_IO_AUTO ||
+      backend > LIFX_IO_URING) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(io, 0, sizeof(*io));
+  io->sfd = sfd;
+  io->depth = depth;
+  io->epfd = -1;
+  io->watch = -1;
+
+  if (backend != LIFX_IO_EPOLL) {
+#ifdef LIFX_HAVE_IO_URING
+    if (lifx_uring_init(io) == 0) {
+      io->backend = LIFX_IO_URING;
+      return 0;
+    }
+#else
+    errno = ENOSYS;
+#endif
+    if (backend == LIFX_IO_URING) {
+      return -1;
+    }
+  }
+
+  if (epoll_init(io) == -1) {
+    return -1;
+  }
+  io->backend = LIFX_IO_EPOLL;
+  return 0;
+}
+
+void lifx_io_free(lifx_io_t *io) {
+  if (io == NULL) {
+    return;
+  }
+
+#ifdef LIFX_HAVE_IO_URING
+  if (io->backend == LIFX_IO_URING) {
+    lifx_uring_free(io);
+  }
+#endif
+  if (io->backend == LIFX_IO_EPOLL) {
+    close(io->epfd);
+    lifx_receiver_free(&io->receiver);
+  }
+  memset(io, 0, sizeof(*io));
+  io->epfd = -1;
+  io->watch = -1;
+}
+
+int lifx_io_recv(lifx_io_t *io, int timeout) {
+  if (io == NULL) {
+    return -1;
+  }
+
+#ifdef LIFX_HAVE_IO_URING
+  if (io->backend == LIFX_IO_URING) {
+    return lifx_uring_recv(io, timeout);
+  }
+#endif
+  return epoll_recv(io, timeout);
+}
+
+int lifx_io_send(lifx_io_t *io, lifx_batch_t *batch) {
+  if (io == NULL || batch == NULL) {
+    return -1;
+  }
+
+#ifdef LIFX_HAVE_IO_URING
+  if (io->backend == LIFX_IO_URING) {
+    return lifx_uring_send(io, batch);
+  }
+#endif
+  return epoll_send(io, batch);
+}
+
+int lifx_io_watch(lifx_io_t *io, int fd) {
+  if (io == NULL || fd < 0 || io->watch != -1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+#ifdef LIFX_HAVE_IO_URING
+  if (io->backend == LIFX_IO_URING) {
+    io->watch = fd;
+    return lifx_uring_watch(io);
+  }
+#endif
+  struct epoll_event event = {
+      .events = EPOLLIN,
+      .data.fd = fd,
+  };
+  if (epoll_ctl(io->epfd, EPOLL_CTL_ADD, fd, &event) == -1) {
+    return -1;
+  }
+  io->watch = fd;
+  return 0;
+}
+
+const char *lifx_io_backend_name(lifx_io_backend backend) {
+  switch (backend) {
+  case LIFX_IO_AUTO:
+    return "auto";
+  case LIFX_IO_EPOLL:
+    return "epoll";
+  case LIFX_IO_URING:
+    return "io_uring";
+  }
+  return "unknown";
+}
+
+int lifx_io_backend_parse(const char *name, lifx_io_backend *backend) {
+  for (int i = LIFX_IO_AUTO; i <= LIFX_IO_URING; ++i) {
+    if (strcmp(name, lifx_io_backend_name(i)) == 0) {
+      *backend = i;
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,296 @@
+#include "metrics.h"
+#include "wire.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Shards are written by their owner only, a relaxed load and store is enough
+ * for readers to never see a torn value */
+#define METRICS_LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define METRICS_BUMP(p, n)                                                     \
+  __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + (n),              \
+                   __ATOMIC_RELAXED)
+
+static size_t table_size(size_t max_targets) {
+  size_t size = 1;
+  while (size < max_targets * 2) {
+    size <<= 1;
+  }
+  return size;
+}
+
+/* Slot of target, or -1 when absent and the table is full */
+static long table_slot(uint64_t *keys, size_t capacity, uint64_t target,
+                       size_t *count, size_t max_targets) {
+  size_t mask = capacity - 1;
+  size_t i = lifx_hash64(target) & mask;
+  while (1) {
+    uint64_t key = __atomic_load_n(&keys[i], __ATOMIC_ACQUIRE);
+    if (key == target) {
+      return i;
+    }
+    if (key == 0) {
+      break;
+    }
+    i = (i + 1) & mask;
+  }
+
+  if (*count == max_targets) {
+    return -1;
+  }
+  (*count)++;
+  /* The counters of a new slot are zero, publish the key after them */
+  __atomic_store_n(&keys[i], target, __ATOMIC_RELEASE);
+  return i;
+}
+
+static lifx_metrics_counters_t *shard_target(lifx_metrics_shard_t *shard,
+                                             uint64_t target) {
+  if (target == 0) {
+    return NULL;
+  }
+  long i = table_slot(shard->keys, shard->capacity, target, &shard->count,
+                      shard->max_targets);
+  return i == -1 ? NULL : &shard->targets[i];
+}
+
+int lifx_metrics_init(lifx_metrics_t *metrics, size_t max_targets) {
+  if (metrics == NULL || max_targets == 0) {
+    return -1;
+  }
+
+  metrics->shards = NULL;
+  metrics->max_targets = max_targets;
+  return 0;
+}
+
+void lifx_metrics_free(lifx_metrics_t *metrics) {
+  if (metrics == NULL) {
+    return;
+  }
+
+  lifx_metrics_shard_t *shard = metrics->shards;
+  while (shard != NULL) {
+    lifx_metrics_shard_t *next = shard->next;
+    free(shard->keys);
+    free(shard->targets);
+    free(shard);
+    shard = next;
+  }
+  metrics->shards = NULL;
+}
+
+lifx_metrics_shard_t *lifx_metrics_shard(lifx_metrics_t *metrics) {
+  if (metrics == NULL) {
+    return NULL;
+  }
+
+  lifx_metrics_shard_t *shard = calloc(1, sizeof(*shard));
+  if (shard == NULL) {
+    return NULL;
+  }
+  shard->max_targets = metrics->max_targets;
+  shard->capacity = table_size(metrics->max_targets);
+  shard->keys = calloc(shard->capacity, sizeof(*shard->keys));
+  shard->targets = calloc(shard->capacity, sizeof(*shard->targets));
+  if (shard->keys == NULL || shard->targets == NULL) {
+    free(shard->keys);
+    free(shard->targets);
+    free(shard);
+    return NULL;
+  }
+
+  shard->next = __atomic_load_n(&metrics->shards, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&metrics->shards, &shard->next, shard, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+
+  return shard;
+}
+
+void lifx_metrics_add(lifx_metrics_shard_t *shard, uint64_t target,
+                      lifx_metric metric, uint64_t n) {
+  if (shard == NULL || metric >= LIFX_METRIC_COUNT) {
+    return;
+  }
+
+  METRICS_BUMP(&shard->global.values[metric], n);
+  lifx_metrics_counters_t *counters = shard_target(shard, target);
+  if (counters != NULL) {
+    METRICS_BUMP(&counters->values[metric], n);
+  }
+}
+
+void lifx_metrics_sent(lifx_metrics_shard_t *shard, uint64_t target,
+                       uint16_t type) {
+  if (shard == NULL) {
+    return;
+  }
+
+  METRICS_BUMP(&shard->sent[type < LIFX_METRICS_TYPES ? type : 0], 1);
+  lifx_metrics_add(shard, target, LIFX_METRIC_SENT, 1);
+}
+
+void lifx_metrics_received(lifx_metrics_shard_t *shard, uint64_t target,
+                           uint16_t type) {
+  if (shard == NULL) {
+    return;
+  }
+
+  METRICS_BUMP(&shard->received[type < LIFX_METRICS_TYPES ? type : 0], 1);
+  lifx_metrics_add(shard, target, LIFX_METRIC_RECEIVED, 1);
+}
+
+static void counters_ack(lifx_metrics_counters_t *counters, uint64_t rtt) {
+  METRICS_BUMP(&counters->values[LIFX_METRIC_ACKS], 1);
+  METRICS_BUMP(&counters->values[LIFX_METRIC_ACK_RTT_SUM], rtt);
+  if (rtt > METRICS_LOAD(&counters->values[LIFX_METRIC_ACK_RTT_MAX])) {
+    __atomic_store_n(&counters->values[LIFX_METRIC_ACK_RTT_MAX], rtt,
+                     __ATOMIC_RELAXED);
+  }
+}
+
+void lifx_metrics_ack(lifx_metrics_shard_t *shard, uint64_t target,
+                      uint64_t rtt) {
+  if (shard == NULL) {
+    return;
+  }
+
+  METRICS_BUMP(&shard->ack_rtt[lifx_histogram_bucket(rtt)], 1);
+  counters_ack(&shard->global, rtt);
+  lifx_metrics_counters_t *counters = shard_target(shard, target);
+  if (counters != NULL) {
+    counters_ack(counters, rtt);
+  }
+}
+
+int lifx_metrics_snapshot_init(lifx_metrics_snapshot_t *snapshot,
+                               size_t max_targets) {
+  if (snapshot == NULL || max_targets == 0) {
+    return -1;
+  }
+
+  memset(snapshot, 0, sizeof(*snapshot));
+  snapshot->max_targets = max_targets;
+  snapshot->capacity = table_size(max_targets);
+  snapshot->keys = calloc(snapshot->capacity, sizeof(*snapshot->keys));
+  snapshot->targets = calloc(snapshot->capacity, sizeof(*snapshot->targets));
+  if (snapshot->keys == NULL || snapshot->targets == NULL) {
+    lifx_metrics_snapshot_free(snapshot);
+    return -1;
+  }
+
+  return 0;
+}
+
+void lifx_metrics_snapshot_free(lifx_metrics_snapshot_t *snapshot) {
+  if (snapshot == NULL) {
+    return;
+  }
+
+  free(snapshot->keys);
+  free(snapshot->targets);
+  memset(snapshot, 0, sizeof(*snapshot));
+}
+
+static void counters_merge(lifx_metrics_counters_t *dst,
+                           const lifx_metrics_counters_t *src) {
+  for (int i = 0; i < LIFX_METRIC_COUNT; ++i) {
+    uint64_t value = METRICS_LOAD(&src->values[i]);
+    if (i == LIFX_METRIC_ACK_RTT_MAX) {
+      if (value > dst->values[i]) {
+        dst->values[i] = value;
+      }
+      continue;
+    }
+    dst->values[i] += value;
+  }
+}
+
+void lifx_metrics_snapshot(const lifx_metrics_t *metrics,
+                           lifx_metrics_snapshot_t *snapshot) {
+  memset(&snapshot->global, 0, sizeof(snapshot->global));
+  memset(snapshot->sent, 0, sizeof(snapshot->sent));
+  memset(snapshot->received, 0, sizeof(snapshot->received));
+  memset(snapshot->keys, 0, snapshot->capacity * sizeof(*snapshot->keys));
+  memset(snapshot->targets, 0,
+         snapshot->capacity * sizeof(*snapshot->targets));
+  lifx_histogram_init(&snapshot->ack_rtt);
+  snapshot->count = 0;
+  snapshot->shards = 0;
+
+  const lifx_metrics_shard_t *shard =
+      __atomic_load_n(&metrics->shards, __ATOMIC_ACQUIRE);
+  for (; shard != NULL; shard = shard->next) {
+    counters_merge(&snapshot->global, &shard->global);
+    for (size_t i = 0; i < LIFX_METRICS_TYPES; ++i) {
+      snapshot->sent[i] += METRICS_LOAD(&shard->sent[i]);
+      snapshot->received[i] += METRICS_LOAD(&shard->received[i]);
+    }
+
+    lifx_histogram_t *histogram = &snapshot->ack_rtt;
+    for (size_t i = 0; i < LIFX_HISTOGRAM_BUCKETS; ++i) {
+      uint64_t count = METRICS_LOAD(&shard->ack_rtt[i]);
+      if (count == 0) {
+        continue;
+      }
+      histogram->counts[i] += count;
+      histogram->count += count;
+      uint64_t value = lifx_histogram_bucket_value(i);
+      if (value < histogram->min) {
+        histogram->min = value;
+      }
+    }
+
+    for (size_t i = 0; i < shard->capacity; ++i) {
+      uint64_t target = __atomic_load_n(&shard->keys[i], __ATOMIC_ACQUIRE);
+      if (target == 0) {
+        continue;
+      }
+      long slot = table_slot(snapshot->keys, snapshot->capacity, target,
+                             &snapshot->count, snapshot->max_targets);
+      if (slot != -1) {
+        counters_merge(&snapshot->targets[slot], &shard->targets[i]);
+      }
+    }
+    snapshot->shards++;
+  }
+
+  /* Buckets only bound the values, the sum and max are kept exactly */
+  lifx_histogram_t *histogram = &snapshot->ack_rtt;
+  histogram->sum = snapshot->global.values[LIFX_METRIC_ACK_RTT_SUM];
+  histogram->max = snapshot->global.values[LIFX_METRIC_ACK_RTT_MAX];
+  if (histogram->count > 0 && histogram->min > histogram->max) {
+    histogram->min = histogram->max;
+  }
+}
+
+const lifx_metrics_counters_t *
+lifx_metrics_snapshot_find(const lifx_metrics_snapshot_t *snapshot,
+                           const uint8_t target[8]) {
+  uint64_t key = lifx_load_le64(target);
+  if (key == 0) {
+    return NULL;
+  }
+
+  size_t mask = snapshot->capacity - 1;
+  size_t i = lifx_hash64(key) & mask;
+  while (snapshot->keys[i] != 0) {
+    if (snapshot->keys[i] == key) {
+      return &snapshot->targets[i];
+    }
+    i = (i + 1) & mask;
+  }
+  return NULL;
+}
+
+const lifx_metrics_counters_t *
+lifx_metrics_snapshot_next(const lifx_metrics_snapshot_t *snapshot,
+                           size_t *cursor, uint8_t target[8]) {
+  for (; *cursor < snapshot->capacity; ++*cursor) {
+    if (snapshot->keys[*cursor] != 0) {
+      lifx_store_le64(target, snapshot->keys[*cursor]);
+      return &snapshot->targets[(*cursor)++];
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,273 @@
+#include "mirror.h"
+#include "wire.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Slot of key, or of the empty slot ending its probe sequence */
+static size_t mirror_probe(const lifx_mirror_t *mirror, uint64_t key) {
+  size_t mask = mirror->capacity - 1;
+  size_t i = lifx_hash64(key) & mask;
+  while (mirror->keys[i] != 0 && mirror->keys[i] != key) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+int lifx_mirror_init(lifx_mirror_t *mirror, size_t max_devices,
+                     uint64_t interval, uint32_t source) {
+  if (mirror == NULL || max_devices == 0 || max_devices > UINT32_MAX ||
+      interval == 0) {
+    return -1;
+  }
+
+  memset(mirror, 0, sizeof(*mirror));
+  /* Keep the index at most half full so probes stay short */
+  size_t capacity = 1;
+  while (capacity < max_devices * 2) {
+    capacity <<= 1;
+  }
+
+  mirror->keys = calloc(capacity, sizeof(*mirror->keys));
+  mirror->rows = calloc(capacity, sizeof(*mirror->rows));
+  mirror->targets = calloc(max_devices, sizeof(*mirror->targets));
+  mirror->addrs = calloc(max_devices, sizeof(*mirror->addrs));
+  mirror->hue = calloc(max_devices, sizeof(*mirror->hue));
+  mirror->saturation = calloc(max_devices, sizeof(*mirror->saturation));
+  mirror->brightness = calloc(max_devices, sizeof(*mirror->brightness));
+  mirror->kelvin = calloc(max_devices, sizeof(*mirror->kelvin));
+  mirror->power = calloc(max_devices, sizeof(*mirror->power));
+  mirror->known = calloc(max_devices, sizeof(*mirror->known));
+  mirror->updated = calloc(max_devices, sizeof(*mirror->updated));
+  if (mirror->keys == NULL || mirror->rows == NULL ||
+      mirror->targets == NULL || mirror->addrs == NULL ||
+      mirror->hue == NULL || mirror->saturation == NULL ||
+      mirror->brightness == NULL || mirror->kelvin == NULL ||
+      mirror->power == NULL || mirror->known == NULL ||
+      mirror->updated == NULL) {
+    lifx_mirror_free(mirror);
+    return -1;
+  }
+  mirror->capacity = capacity;
+  mirror->max_devices = max_devices;
+  mirror->interval = interval;
+  mirror->source = source;
+
+  return 0;
+}
+
+void lifx_mirror_free(lifx_mirror_t *mirror) {
+  if (mirror == NULL) {
+    return;
+  }
+
+  free(mirror->keys);
+  free(mirror->rows);
+  free(mirror->targets);
+  free(mirror->addrs);
+  free(mirror->hue);
+  free(mirror->saturation);
+  free(mirror->brightness);
+  free(mirror->kelvin);
+  free(mirror->power);
+  free(mirror->known);
+  free(mirror->updated);
+  memset(mirror, 0, sizeof(*mirror));
+}
+
+int lifx_mirror_add(lifx_mirror_t *mirror, const uint8_t target[8],
+                    const struct sockaddr_in *addr) {
+  if (mirror == NULL || addr == NULL) {
+    return -1;
+  }
+  uint64_t key = lifx_load_le64(target);
+  if (key == 0) {
+    return -1;
+  }
+
+  size_t i = mirror_probe(mirror, key);
+  if (mirror->keys[i] == 0) {
+    if (mirror->count == mirror->max_devices) {
+      return -1;
+    }
+    mirror->keys[i] = key;
+    mirror->rows[i] = mirror->count;
+    mirror->targets[mirror->count++] = key;
+  }
+
+  uint32_t row = mirror->rows[i];
+  mirror->addrs[row] = *addr;
+  return row;
+}
+
+int lifx_mirror_sync(lifx_mirror_t *mirror, const lifx_registry_t *registry) {
+  if (mirror == NULL || registry == NULL) {
+    return -1;
+  }
+
+  size_t count = mirror->count;
+  size_t cursor = 0;
+  const lifx_device_t *device;
+  while ((device = lifx_registry_next(registry, &cursor)) != NULL) {
+    if (!(device->flags & LIFX_DEVICE_SERVICE)) {
+      continue;
+    }
+    if (lifx_mirror_add(mirror, device->target, &device->addr) == -1) {
+      return -1;
+    }
+  }
+
+  return mirror->count - count;
+}
+
+int lifx_mirror_find(const lifx_mirror_t *mirror, const uint8_t target[8]) {
+  uint64_t key = lifx_load_le64(target);
+  if (mirror == NULL || key == 0) {
+    return -1;
+  }
+
+  size_t i = mirror_probe(mirror, key);
+  return mirror->keys[i] == 0 ? -1 : (int)mirror->rows[i];
+}
+
+int lifx_mirror_subscribe(lifx_mirror_t *mirror,
+                          lifx_mirror_callback callback, void *ctx) {
+  if (mirror == NULL || callback == NULL ||
+      mirror->subscriber_count == LIFX_MIRROR_SUBSCRIBERS_MAX) {
+    return -1;
+  }
+
+  mirror->subscribers[mirror->subscriber_count++] =
+      (lifx_mirror_subscriber_t){callback, ctx};
+  return 0;
+}
+
+static int mirror_request(lifx_mirror_t *mirror, size_t row,
+                          lifx_scheduler_emit emit, void *ctx) {
+  lifx_frame_t frame = {
+      .header =
+          {
+              .source = mirror->source,
+              .sequence = mirror->sequence,
+              .type = Get,
+          },
+  };
+  lifx_store_le64(frame.header.target, mirror->targets[row]);
+  if (emit(ctx, &frame, &mirror->addrs[row]) == -1) {
+    return -1;
+  }
+  mirror->sequence++;
+  mirror->stats.polled++;
+  return 0;
+}
+
+int lifx_mirror_poll(lifx_mirror_t *mirror, uint64_t now,
+                     lifx_scheduler_emit emit, void *ctx) {
+  if (mirror == NULL || emit == NULL) {
+    return -1;
+  }
+  if (mirror->count == 0) {
+    return 0;
+  }
+  if (mirror->round_start == 0) {
+    mirror->round_start = now;
+  }
+
+  int emitted = 0;
+  while (now >= mirror->round_start) {
+    size_t due = (now - mirror->round_start) * mirror->count /
+                     mirror->interval +
+                 1;
+    if (due > mirror->count) {
+      due = mirror->count;
+    }
+    for (; mirror->cursor < due; ++mirror->cursor) {
+      if (mirror_request(mirror, mirror->cursor, emit, ctx) == -1) {
+        return emitted;
+      }
+      emitted++;
+    }
+    if (mirror->cursor < mirror->count) {
+      break;
+    }
+
+    /* A caller that fell a whole round behind starts over instead of
+     * sending every missed round back to back */
+    mirror->cursor = 0;
+    mirror->round_start += mirror->interval;
+    if (now >= mirror->round_start + mirror->interval) {
+      mirror->round_start = now;
+    }
+  }
+
+  return emitted;
+}
+
+int64_t lifx_mirror_next(const lifx_mirror_t *mirror, uint64_t now) {
+  if (mirror == NULL || mirror->count == 0) {
+    return -1;
+  }
+  if (mirror->round_start == 0) {
+    return 0;
+  }
+
+  uint64_t due = mirror->round_start +
+                 mirror->cursor * mirror->interval / mirror->count;
+  return due > now ? (int64_t)(due - now) : 0;
+}
+
+/* Store value in a field of row, returns flag when it changed */
+static uint8_t mirror_store(lifx_mirror_t *mirror, uint16_t *field,
+                            size_t row, uint8_t flag, uint16_t value) {
+  if ((mirror->known[row] & flag) && field[row] == value) {
+    return 0;
+  }
+  field[row] = value;
+  mirror->known[row] |= flag;
+  return flag;
+}
+
+int lifx_mirror_observe(lifx_mirror_t *mirror, const lifx_frame_t *frame,
+                        uint64_t now) {
+  if (mirror == NULL || frame == NULL) {
+    return 0;
+  }
+  lifx_message_type type = frame->header.type;
+  if (type != LightState && type != StatePower) {
+    return 0;
+  }
+  int found = lifx_mirror_find(mirror, frame->header.target);
+  if (found == -1) {
+    return 0;
+  }
+
+  size_t row = found;
+  uint8_t changed = 0;
+  if (type == LightState) {
+    const lifx_light_state_payload_t *state =
+        &frame->payload.light_state_payload;
+    changed |= mirror_store(mirror, mirror->hue, row, LIFX_MIRROR_HUE,
+                            state->hue);
+    changed |= mirror_store(mirror, mirror->saturation, row,
+                            LIFX_MIRROR_SATURATION, state->saturation);
+    changed |= mirror_store(mirror, mirror->brightness, row,
+                            LIFX_MIRROR_BRIGHTNESS, state->brightness);
+    changed |= mirror_store(mirror, mirror->kelvin, row, LIFX_MIRROR_KELVIN,
+                            state->kelvin);
+    changed |= mirror_store(mirror, mirror->power, row, LIFX_MIRROR_POWER,
+                            state->power);
+  } else {
+    changed |= mirror_store(mirror, mirror->power, row, LIFX_MIRROR_POWER,
+                            frame->payload.state_power_payload.level);
+  }
+  mirror->updated[row] = now;
+  mirror->stats.states++;
+
+  if (changed) {
+    mirror->stats.changes++;
+    for (size_t i = 0; i < mirror->subscriber_count; ++i) {
+      mirror->subscribers[i].callback(mirror->subscribers[i].ctx, mirror, row,
+                                      changed);
+    }
+  }
+  return changed;
+}
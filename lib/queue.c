@@ -0,0 +1,180 @@
+#include "queue.h"
+#include "ring.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+_Static_assert(offsetof(lifx_queue_cell_t, turn) == 0,
+               "cells start with their turn, see lifx_ring_t");
+
+static lifx_ring_t queue_ring(lifx_queue_t *queue) {
+  return (lifx_ring_t){
+      .cells = (uint8_t *)queue->cells,
+      .stride = sizeof(*queue->cells),
+      .mask = queue->mask,
+      .head = &queue->head,
+      .full = &queue->full,
+      .tail = &queue->tail,
+      .waiting = &queue->waiting,
+  };
+}
+
+int lifx_queue_init(lifx_queue_t *queue, size_t capacity) {
+  if (queue == NULL || capacity == 0) {
+    return -1;
+  }
+
+  memset(queue, 0, sizeof(*queue));
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  queue->mask = size - 1;
+  queue->cells = malloc(size * sizeof(*queue->cells));
+  if (queue->cells == NULL) {
+    return -1;
+  }
+  lifx_ring_t ring = queue_ring(queue);
+  lifx_ring_reset(&ring);
+
+  queue->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (queue->efd == -1) {
+    free(queue->cells);
+    queue->cells = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+void lifx_queue_free(lifx_queue_t *queue) {
+  if (queue == NULL) {
+    return;
+  }
+
+  if (queue->cells != NULL) {
+    close(queue->efd);
+  }
+  free(queue->cells);
+  memset(queue, 0, sizeof(*queue));
+  queue->efd = -1;
+}
+
+/* Hand a written cell to the consumer and wake it if it sleeps */
+static void queue_publish(lifx_queue_t *queue, lifx_queue_cell_t *cell,
+                          uint64_t pos) {
+  lifx_ring_t ring = queue_ring(queue);
+  if (lifx_ring_publish(&ring, cell, pos)) {
+    uint64_t one = 1;
+    /* Only fails when the counter is saturated, which wakes anyway */
+    (void)!write(queue->efd, &one, sizeof(one));
+  }
+}
+
+int lifx_queue_push(lifx_queue_t *queue, const lifx_frame_t *frame,
+                    const struct sockaddr_in *addr) {
+  if (queue == NULL || frame == NULL || addr == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  uint64_t pos;
+  lifx_ring_t ring = queue_ring(queue);
+  lifx_queue_cell_t *cell = lifx_ring_claim(&ring, &pos);
+  if (cell == NULL) {
+    return -1;
+  }
+  cell->command.addr = *addr;
+  cell->command.size = 0;
+  cell->command.frame = *frame;
+  queue_publish(queue, cell, pos);
+
+  return 0;
+}
+
+int lifx_queue_push_packet(lifx_queue_t *queue, const uint8_t *packet,
+                           size_t size, const struct sockaddr_in *addr) {
+  if (queue == NULL || packet == NULL || addr == NULL || size == 0 ||
+      size > FRAME_SIZE_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  uint64_t pos;
+  lifx_ring_t ring = queue_ring(queue);
+  lifx_queue_cell_t *cell = lifx_ring_claim(&ring, &pos);
+  if (cell == NULL) {
+    return -1;
+  }
+  cell->command.addr = *addr;
+  cell->command.size = size;
+  memcpy(cell->command.packet, packet, size);
+  queue_publish(queue, cell, pos);
+
+  return 0;
+}
+
+int lifx_queue_drain(lifx_queue_t *queue, lifx_batch_t *batch) {
+  if (queue == NULL || batch == NULL) {
+    return -1;
+  }
+
+  lifx_ring_t ring = queue_ring(queue);
+  lifx_queue_cell_t *cell;
+  int taken = 0;
+  while (batch->count < batch->capacity &&
+         (cell = lifx_ring_peek(&ring)) != NULL) {
+
+    const lifx_command_t *command = &cell->command;
+    int res = command->size == 0
+                  ? lifx_batch_add(batch, &command->frame, &command->addr)
+                  : lifx_batch_add_packet(batch, command->packet,
+                                          command->size, &command->addr);
+    if (res == -1) {
+      queue->invalid++;
+    }
+
+    lifx_ring_release(&ring, cell);
+    taken++;
+  }
+
+  return taken;
+}
+
+int lifx_queue_arm(lifx_queue_t *queue) {
+  lifx_ring_t ring = queue_ring(queue);
+  return lifx_ring_arm(&ring);
+}
+
+void lifx_queue_wake(lifx_queue_t *queue) {
+  uint64_t count;
+  (void)!read(queue->efd, &count, sizeof(count));
+  lifx_ring_t ring = queue_ring(queue);
+  lifx_ring_disarm(&ring);
+}
+
+int lifx_queue_wait(lifx_queue_t *queue, int timeout) {
+  if (queue == NULL) {
+    return -1;
+  }
+
+  if (lifx_queue_arm(queue)) {
+    return 1;
+  }
+
+  struct pollfd pfd = {
+      .fd = queue->efd,
+      .events = POLLIN,
+  };
+  int ready = poll(&pfd, 1, timeout);
+  lifx_queue_wake(queue);
+  if (ready == -1) {
+    return errno == EINTR ? 0 : -1;
+  }
+  return ready;
+}
+
+int lifx_queue_fd(const lifx_queue_t *queue) { return queue->efd; }
@@ -0,0 +1,165 @@
+#include "receiver.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+int lifx_receiver_init(lifx_receiver_t *receiver, size_t depth) {
+  if (receiver == NULL || depth == 0) {
+    return -1;
+  }
+
+  memset(receiver, 0, sizeof(*receiver));
+  receiver->buffers = malloc(depth * FRAME_SIZE_MAX);
+  receiver->iov = calloc(depth, sizeof(*receiver->iov));
+  receiver->msgs = calloc(depth, sizeof(*receiver->msgs));
+  receiver->names = calloc(depth, sizeof(*receiver->names));
+  receiver->frames = calloc(depth, sizeof(*receiver->frames));
+  receiver->views = calloc(depth, sizeof(*receiver->views));
+  receiver->addrs = calloc(depth, sizeof(*receiver->addrs));
+  if (receiver->buffers == NULL || receiver->iov == NULL ||
+      receiver->msgs == NULL || receiver->names == NULL ||
+      receiver->frames == NULL || receiver->views == NULL ||
+      receiver->addrs == NULL) {
+    lifx_receiver_free(receiver);
+    return -1;
+  }
+  receiver->depth = depth;
+
+  for (size_t i = 0; i < depth; ++i) {
+    receiver->iov[i].iov_base = receiver->buffers + i * FRAME_SIZE_MAX;
+    receiver->iov[i].iov_len = FRAME_SIZE_MAX;
+  }
+
+  return 0;
+}
+
+void lifx_receiver_free(lifx_receiver_t *receiver) {
+  if (receiver == NULL) {
+    return;
+  }
+
+  free(receiver->buffers);
+  free(receiver->iov);
+  free(receiver->msgs);
+  free(receiver->names);
+  free(receiver->frames);
+  free(receiver->views);
+  free(receiver->addrs);
+  memset(receiver, 0, sizeof(*receiver));
+}
+
+/* Wait for sfd and read up to depth datagrams, returns the amount read */
+static int receiver_read(lifx_receiver_t *receiver, int sfd, int timeout) {
+  if (timeout != 0) {
+    struct pollfd pfds = {
+        .fd = sfd,
+        .events = POLLIN,
+    };
+    int ready = poll(&pfds, 1, timeout);
+    if (ready == -1) {
+      return errno == EINTR ? 0 : -1;
+    }
+    if (ready == 0) {
+      return 0;
+    }
+  }
+
+  /* recvmmsg overwrites the lengths, so the headers are rebuilt each call */
+  for (size_t i = 0; i < receiver->depth; ++i) {
+    struct msghdr *hdr = &receiver->msgs[i].msg_hdr;
+    hdr->msg_name = &receiver->names[i];
+    hdr->msg_namelen = sizeof(receiver->names[i]);
+    hdr->msg_iov = &receiver->iov[i];
+    hdr->msg_iovlen = 1;
+    hdr->msg_control = NULL;
+    hdr->msg_controllen = 0;
+    hdr->msg_flags = 0;
+  }
+
+  int received =
+      recvmmsg(sfd, receiver->msgs, receiver->depth, MSG_DONTWAIT, NULL);
+  if (received == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return 0;
+    }
+    return -1;
+  }
+
+  return received;
+}
+
+/* Whether datagram i is whole, a larger one only left its start in the
+ * buffer and is dropped before anything looks at it */
+static int receiver_whole(lifx_receiver_t *receiver, int i) {
+  if (!(receiver->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+    return 1;
+  }
+  receiver->truncated++;
+  receiver->dropped++;
+  lifx_metrics_add(receiver->metrics, 0, LIFX_METRIC_DECODE_ERRORS, 1);
+  return 0;
+}
+
+int lifx_receiver_recv(lifx_receiver_t *receiver, int sfd, int timeout) {
+  if (receiver == NULL) {
+    return -1;
+  }
+  receiver->count = 0;
+
+  int received = receiver_read(receiver, sfd, timeout);
+  if (received == -1) {
+    return -1;
+  }
+
+  for (int i = 0; i < received; ++i) {
+    if (!receiver_whole(receiver, i)) {
+      continue;
+    }
+    uint8_t *packet = receiver->iov[i].iov_base;
+    lifx_frame_t *frame = &receiver->frames[receiver->count];
+    if (lifx_decode_frame(frame, &packet, receiver->msgs[i].msg_len) == -1) {
+      receiver->dropped++;
+      lifx_metrics_add(receiver->metrics, 0, LIFX_METRIC_DECODE_ERRORS, 1);
+      continue;
+    }
+    lifx_metrics_received(receiver->metrics,
+                          lifx_load_le64(frame->header.target),
+                          frame->header.type);
+    receiver->addrs[receiver->count] = receiver->names[i];
+    receiver->count++;
+  }
+
+  return receiver->count;
+}
+
+int lifx_receiver_recv_views(lifx_receiver_t *receiver, int sfd, int timeout) {
+  if (receiver == NULL) {
+    return -1;
+  }
+  receiver->count = 0;
+
+  int received = receiver_read(receiver, sfd, timeout);
+  if (received == -1) {
+    return -1;
+  }
+
+  for (int i = 0; i < received; ++i) {
+    if (!receiver_whole(receiver, i)) {
+      continue;
+    }
+    lifx_frame_view_t *view = &receiver->views[receiver->count];
+    if (lifx_view_init(view, receiver->iov[i].iov_base,
+                       receiver->msgs[i].msg_len) == -1) {
+      receiver->dropped++;
+      lifx_metrics_add(receiver->metrics, 0, LIFX_METRIC_DECODE_ERRORS, 1);
+      continue;
+    }
+    lifx_metrics_received(receiver->metrics, lifx_view_target_id(view),
+                          lifx_view_type(view));
+    receiver->addrs[receiver->count] = receiver->names[i];
+    receiver->count++;
+  }
+
+  return receiver->count;
+}
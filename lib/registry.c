@@ -0,0 +1,175 @@
+#include "registry.h"
+#include "wire.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Slot of key, or of the empty slot ending its probe sequence */
+static size_t registry_probe(const lifx_registry_t *registry, uint64_t key) {
+  size_t mask = registry->capacity - 1;
+  size_t i = lifx_hash64(key) & mask;
+  while (registry->keys[i] != 0 && registry->keys[i] != key) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+int lifx_registry_init(lifx_registry_t *registry, size_t max_devices) {
+  if (registry == NULL || max_devices == 0) {
+    return -1;
+  }
+
+  memset(registry, 0, sizeof(*registry));
+  /* Keep the table at most half full so probes stay short */
+  size_t capacity = 1;
+  while (capacity < max_devices * 2) {
+    capacity <<= 1;
+  }
+
+  registry->keys = calloc(capacity, sizeof(*registry->keys));
+  registry->devices = calloc(capacity, sizeof(*registry->devices));
+  if (registry->keys == NULL || registry->devices == NULL) {
+    lifx_registry_free(registry);
+    return -1;
+  }
+  registry->capacity = capacity;
+  registry->max_devices = max_devices;
+
+  return 0;
+}
+
+void lifx_registry_free(lifx_registry_t *registry) {
+  if (registry == NULL) {
+    return;
+  }
+
+  free(registry->keys);
+  free(registry->devices);
+  memset(registry, 0, sizeof(*registry));
+}
+
+uint64_t lifx_registry_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+lifx_device_t *lifx_registry_find(const lifx_registry_t *registry,
+                                  const uint8_t target[8]) {
+  uint64_t key = lifx_load_le64(target);
+  if (key == 0) {
+    return NULL;
+  }
+
+  size_t i = registry_probe(registry, key);
+  return registry->keys[i] == 0 ? NULL : &registry->devices[i];
+}
+
+lifx_device_t *lifx_registry_insert(lifx_registry_t *registry,
+                                    const uint8_t target[8]) {
+  uint64_t key = lifx_load_le64(target);
+  if (key == 0) {
+    return NULL;
+  }
+
+  size_t i = registry_probe(registry, key);
+  if (registry->keys[i] != 0) {
+    return &registry->devices[i];
+  }
+
+  if (registry->count == registry->max_devices) {
+    return NULL;
+  }
+
+  registry->keys[i] = key;
+  memset(&registry->devices[i], 0, sizeof(registry->devices[i]));
+  memcpy(registry->devices[i].target, target, 8);
+  registry->count++;
+
+  return &registry->devices[i];
+}
+
+int lifx_registry_remove(lifx_registry_t *registry, const uint8_t target[8]) {
+  uint64_t key = lifx_load_le64(target);
+  if (key == 0) {
+    return -1;
+  }
+
+  size_t mask = registry->capacity - 1;
+  size_t i = registry_probe(registry, key);
+  if (registry->keys[i] == 0) {
+    return -1;
+  }
+  registry->keys[i] = 0;
+  registry->count--;
+
+  /* Shift back every following entry whose probe sequence crossed i */
+  size_t j = i;
+  while (1) {
+    j = (j + 1) & mask;
+    if (registry->keys[j] == 0) {
+      return 0;
+    }
+    size_t home = lifx_hash64(registry->keys[j]) & mask;
+    if ((j > i && (home <= i || home > j)) ||
+        (j < i && (home <= i && home > j))) {
+      registry->keys[i] = registry->keys[j];
+      registry->devices[i] = registry->devices[j];
+      registry->keys[j] = 0;
+      i = j;
+    }
+  }
+}
+
+int lifx_registry_observe(lifx_registry_t *registry, const lifx_frame_t *frame,
+                          const struct sockaddr_in *from, uint64_t now) {
+  if (registry == NULL || frame == NULL) {
+    return -1;
+  }
+
+  int added = 0;
+  lifx_device_t *device;
+  if (frame->header.type == StateService) {
+    const lifx_state_service_payload_t *service =
+        &frame->payload.state_service_payload;
+    if (service->service != UDP || from == NULL) {
+      return 0;
+    }
+
+    size_t count = registry->count;
+    device = lifx_registry_insert(registry, frame->header.target);
+    if (device == NULL) {
+      return lifx_load_le64(frame->header.target) == 0 ? 0 : -1;
+    }
+    added = registry->count != count;
+    device->addr = *from;
+    device->addr.sin_port = htons(service->port);
+    device->flags |= LIFX_DEVICE_SERVICE;
+    device->flags &= ~LIFX_DEVICE_CACHED;
+  } else {
+    device = lifx_registry_find(registry, frame->header.target);
+    if (device == NULL) {
+      return 0;
+    }
+  }
+
+  if (frame->header.type == StateLabel) {
+    memcpy(device->label, frame->payload.state_label_payload.label,
+           sizeof(device->label));
+    device->flags |= LIFX_DEVICE_LABEL;
+  }
+  device->last_seen = now;
+
+  return added;
+}
+
+lifx_device_t *lifx_registry_next(const lifx_registry_t *registry,
+                                  size_t *cursor) {
+  while (*cursor < registry->capacity) {
+    size_t i = (*cursor)++;
+    if (registry->keys[i] != 0) {
+      return &registry->devices[i];
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,116 @@
+#ifndef RING_H
+#define RING_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bounded multi-producer single-consumer ring behind lifx_queue_t and the
+ * command cells of lifx_shm_t. It only touches the control words, so each
+ * keeps its own layout, in process memory or in a shared segment.
+ *
+ * Every cell starts with a uint64_t turn, the position the cell is next
+ * valid at: producers claim a position with a compare and swap on head,
+ * write the cell and then publish it by moving its turn to position + 1.
+ * The consumer reads cells in order and hands them back by moving their turn
+ * a lap ahead. A full ring fails instead of blocking.
+ *
+ * Producers only wake the consumer after it announced it is about to sleep,
+ * waking is up to the caller since the queue and the segment use different
+ * descriptors.
+ */
+typedef struct {
+  uint8_t *cells;
+  size_t stride;     /* bytes per cell */
+  uint64_t mask;     /* cells - 1, the amount is a power of 2 */
+  uint64_t *head;    /* next position producers claim */
+  uint64_t *full;    /* claims that found the ring full */
+  uint64_t *tail;    /* next position the consumer reads */
+  uint32_t *waiting; /* consumer is about to sleep */
+} lifx_ring_t;
+
+static inline uint64_t *lifx_ring_turn(const lifx_ring_t *ring,
+                                       uint64_t pos) {
+  return (uint64_t *)(ring->cells + (pos & ring->mask) * ring->stride);
+}
+
+/* Turn every cell to its first position */
+static inline void lifx_ring_reset(const lifx_ring_t *ring) {
+  for (uint64_t pos = 0; pos <= ring->mask; ++pos) {
+    *lifx_ring_turn(ring, pos) = pos;
+  }
+}
+
+/* Claim the cell at head, NULL with errno set to EAGAIN when the ring is
+ * full */
+static inline void *lifx_ring_claim(const lifx_ring_t *ring, uint64_t *pos) {
+  *pos = __atomic_load_n(ring->head, __ATOMIC_RELAXED);
+  while (1) {
+    uint64_t *turn = lifx_ring_turn(ring, *pos);
+    int64_t diff =
+        (int64_t)(__atomic_load_n(turn, __ATOMIC_ACQUIRE) - *pos);
+    if (diff == 0) {
+      /* On failure pos is reloaded with the current head */
+      if (__atomic_compare_exchange_n(ring->head, pos, *pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return turn;
+      }
+    } else if (diff < 0) {
+      /* The consumer has not read this cell a lap ago */
+      __atomic_add_fetch(ring->full, 1, __ATOMIC_RELAXED);
+      errno = EAGAIN;
+      return NULL;
+    } else {
+      *pos = __atomic_load_n(ring->head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/* Hand a written cell to the consumer, returns 1 when it sleeps and has to
+ * be woken */
+static inline int lifx_ring_publish(const lifx_ring_t *ring, void *cell,
+                                    uint64_t pos) {
+  /* Sequentially consistent with lifx_ring_arm: either the consumer sees
+   * this cell or this sees it waiting */
+  __atomic_store_n((uint64_t *)cell, pos + 1, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(ring->waiting, __ATOMIC_SEQ_CST) &&
+         __atomic_exchange_n(ring->waiting, 0, __ATOMIC_ACQ_REL);
+}
+
+/* The cell at tail once published, NULL when the ring is empty, consumer
+ * only */
+static inline void *lifx_ring_peek(const lifx_ring_t *ring) {
+  uint64_t *turn = lifx_ring_turn(ring, *ring->tail);
+  if (__atomic_load_n(turn, __ATOMIC_ACQUIRE) != *ring->tail + 1) {
+    return NULL;
+  }
+  return turn;
+}
+
+/* Hand the cell at tail back to the producer a lap ahead, consumer only */
+static inline void lifx_ring_release(const lifx_ring_t *ring, void *cell) {
+  __atomic_store_n((uint64_t *)cell, *ring->tail + ring->mask + 1,
+                   __ATOMIC_RELEASE);
+  ++*ring->tail;
+}
+
+/* Announce the consumer is about to sleep, returns 1 when a cell is already
+ * published and it should read instead */
+static inline int lifx_ring_arm(const lifx_ring_t *ring) {
+  __atomic_store_n(ring->waiting, 1, __ATOMIC_SEQ_CST);
+
+  const uint64_t *turn = lifx_ring_turn(ring, *ring->tail);
+  if (__atomic_load_n(turn, __ATOMIC_SEQ_CST) == *ring->tail + 1) {
+    __atomic_store_n(ring->waiting, 0, __ATOMIC_RELAXED);
+    return 1;
+  }
+  return 0;
+}
+
+/* The consumer woke up */
+static inline void lifx_ring_disarm(const lifx_ring_t *ring) {
+  __atomic_store_n(ring->waiting, 0, __ATOMIC_RELAXED);
+}
+
+#endif /* RING_H */
@@ -0,0 +1,116 @@
+#include "scene.h"
+#include <string.h>
+
+void lifx_scene_config_init(lifx_scene_config_t *config) {
+  if (config == NULL) {
+    return;
+  }
+
+  memset(config, 0, sizeof(*config));
+  config->hue = LIFX_SCENE_HUE_TOLERANCE;
+  config->saturation = LIFX_SCENE_SATURATION_TOLERANCE;
+  config->brightness = LIFX_SCENE_BRIGHTNESS_TOLERANCE;
+  config->kelvin = LIFX_SCENE_KELVIN_TOLERANCE;
+}
+
+static uint16_t distance(uint16_t a, uint16_t b) {
+  return a > b ? a - b : b - a;
+}
+
+/* Hue wraps, 65535 is next to 0 */
+static uint16_t hue_distance(uint16_t a, uint16_t b) {
+  uint16_t d = a - b;
+  uint16_t e = b - a;
+  return d < e ? d : e;
+}
+
+static int color_differs(const lifx_mirror_t *mirror, size_t row,
+                         const lifx_scene_light_t *light,
+                         const lifx_scene_config_t *config) {
+  if ((mirror->known[row] & LIFX_MIRROR_COLOR) != LIFX_MIRROR_COLOR) {
+    return 1;
+  }
+  return hue_distance(mirror->hue[row], light->hue) > config->hue ||
+         distance(mirror->saturation[row], light->saturation) >
+             config->saturation ||
+         distance(mirror->brightness[row], light->brightness) >
+             config->brightness ||
+         distance(mirror->kelvin[row], light->kelvin) > config->kelvin;
+}
+
+static int power_differs(const lifx_mirror_t *mirror, size_t row,
+                         const lifx_scene_light_t *light) {
+  if (!(mirror->known[row] & LIFX_MIRROR_POWER)) {
+    return 1;
+  }
+  return (mirror->power[row] == 0) != (light->power == 0);
+}
+
+int lifx_scene_apply(const lifx_mirror_t *mirror, lifx_scheduler_t *scheduler,
+                     const lifx_scene_light_t *lights, size_t n,
+                     const lifx_scene_config_t *config, uint64_t now,
+                     lifx_scene_stats_t *stats) {
+  lifx_scene_stats_t local;
+  if (stats == NULL) {
+    stats = &local;
+  }
+  memset(stats, 0, sizeof(*stats));
+  if (mirror == NULL || scheduler == NULL || (lights == NULL && n > 0)) {
+    return -1;
+  }
+  lifx_scene_config_t defaults;
+  if (config == NULL) {
+    lifx_scene_config_init(&defaults);
+    config = &defaults;
+  }
+
+  int queued = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const lifx_scene_light_t *light = &lights[i];
+    int found = lifx_mirror_find(mirror, light->target);
+    if (found == -1) {
+      stats->unknown++;
+      continue;
+    }
+    size_t row = found;
+    const struct sockaddr_in *addr = &mirror->addrs[row];
+
+    /* Color first, a light turning on then fades in from the new color */
+    int sent = 0;
+    if (light->power != 0 && color_differs(mirror, row, light, config)) {
+      lifx_set_color_payload_t payload = {
+          .hue = light->hue,
+          .saturation = light->saturation,
+          .brightness = light->brightness,
+          .kelvin = light->kelvin,
+          .duration = config->duration,
+      };
+      if (lifx_scheduler_set_color(scheduler, light->target, addr, &payload,
+                                   now) == -1) {
+        stats->refused++;
+      } else {
+        stats->colors++;
+        queued++;
+      }
+      sent = 1;
+    }
+    if (power_differs(mirror, row, light)) {
+      lifx_set_power_payload_t payload = {
+          .level = light->power == 0 ? 0 : UINT16_MAX,
+      };
+      if (lifx_scheduler_set_power(scheduler, light->target, addr, &payload,
+                                   now) == -1) {
+        stats->refused++;
+      } else {
+        stats->powers++;
+        queued++;
+      }
+      sent = 1;
+    }
+    if (!sent) {
+      stats->unchanged++;
+    }
+  }
+
+  return queued;
+}
@@ -0,0 +1,219 @@
+#include "scheduler.h"
+#include "client.h"
+#include "wire.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Find the device of target, adding it when absent. NULL when full. */
+static lifx_scheduled_device_t *device_get(lifx_scheduler_t *scheduler,
+                                           uint64_t target, uint64_t now) {
+  size_t mask = scheduler->capacity - 1;
+  size_t i = lifx_hash64(target) & mask;
+  while (scheduler->devices[i].used) {
+    if (scheduler->devices[i].target == target) {
+      return &scheduler->devices[i];
+    }
+    i = (i + 1) & mask;
+  }
+
+  if (scheduler->count == scheduler->max_devices) {
+    return NULL;
+  }
+
+  lifx_scheduled_device_t *device = &scheduler->devices[i];
+  device->used = 1;
+  device->target = target;
+  lifx_bucket_init(&device->bucket, scheduler->rate, scheduler->burst, now);
+  scheduler->count++;
+
+  return device;
+}
+
+int lifx_scheduler_init(lifx_scheduler_t *scheduler, size_t max_devices,
+                        uint32_t rate, uint32_t burst) {
+  if (scheduler == NULL || max_devices == 0 || burst == 0) {
+    return -1;
+  }
+
+  memset(scheduler, 0, sizeof(*scheduler));
+  /* Keep the table at most half full so probes stay short */
+  size_t capacity = 1;
+  while (capacity < max_devices * 2) {
+    capacity <<= 1;
+  }
+
+  scheduler->devices = calloc(capacity, sizeof(*scheduler->devices));
+  scheduler->active = calloc(max_devices, sizeof(*scheduler->active));
+  if (scheduler->devices == NULL || scheduler->active == NULL) {
+    lifx_scheduler_free(scheduler);
+    return -1;
+  }
+  scheduler->capacity = capacity;
+  scheduler->max_devices = max_devices;
+  scheduler->rate = rate;
+  scheduler->burst = burst;
+
+  return 0;
+}
+
+void lifx_scheduler_free(lifx_scheduler_t *scheduler) {
+  if (scheduler == NULL) {
+    return;
+  }
+
+  free(scheduler->devices);
+  free(scheduler->active);
+  memset(scheduler, 0, sizeof(*scheduler));
+}
+
+int lifx_scheduler_submit(lifx_scheduler_t *scheduler,
+                          const lifx_frame_t *frame,
+                          const struct sockaddr_in *addr, uint64_t now) {
+  if (scheduler == NULL || frame == NULL || addr == NULL) {
+    return -1;
+  }
+
+  uint64_t target = lifx_load_le64(frame->header.target);
+  lifx_scheduled_device_t *device = device_get(scheduler, target, now);
+  if (device == NULL) {
+    scheduler->stats.dropped++;
+    lifx_metrics_add(scheduler->metrics, target, LIFX_METRIC_DROPS, 1);
+    return -1;
+  }
+  device->addr = *addr;
+
+  /* Last writer wins: overwrite a queued state change in place */
+  lifx_message_type type = frame->header.type;
+  if (type == SetColor || type == SetPower) {
+    for (uint8_t i = 0; i < device->len; ++i) {
+      lifx_frame_t *queued =
+          &device->queue[(device->head + i) % LIFX_SCHEDULER_QUEUE];
+      if (queued->header.type == type) {
+        *queued = *frame;
+        scheduler->stats.coalesced++;
+        lifx_metrics_add(scheduler->metrics, target, LIFX_METRIC_COALESCED, 1);
+        return 1;
+      }
+    }
+  }
+
+  if (device->len == LIFX_SCHEDULER_QUEUE) {
+    scheduler->stats.dropped++;
+    lifx_metrics_add(scheduler->metrics, target, LIFX_METRIC_DROPS, 1);
+    return -1;
+  }
+
+  device->queue[(device->head + device->len) % LIFX_SCHEDULER_QUEUE] = *frame;
+  device->len++;
+  scheduler->stats.queued++;
+
+  if (!device->active) {
+    device->active = 1;
+    scheduler->active[scheduler->active_count++] = device - scheduler->devices;
+  }
+
+  return 0;
+}
+
+int lifx_scheduler_set_color(lifx_scheduler_t *scheduler,
+                             const uint8_t target[8],
+                             const struct sockaddr_in *addr,
+                             const lifx_set_color_payload_t *payload,
+                             uint64_t now) {
+  lifx_frame_t frame = {
+      .header =
+          {
+              .acknowledgement = 1,
+              .type = SetColor,
+          },
+      .payload =
+          {
+              .set_color_payload = *payload,
+          },
+  };
+  memcpy(frame.header.target, target, sizeof(frame.header.target));
+
+  return lifx_scheduler_submit(scheduler, &frame, addr, now);
+}
+
+int lifx_scheduler_set_power(lifx_scheduler_t *scheduler,
+                             const uint8_t target[8],
+                             const struct sockaddr_in *addr,
+                             const lifx_set_power_payload_t *payload,
+                             uint64_t now) {
+  lifx_frame_t frame = {
+      .header =
+          {
+              .acknowledgement = 1,
+              .type = SetPower,
+          },
+      .payload =
+          {
+              .set_power_payload = *payload,
+          },
+  };
+  memcpy(frame.header.target, target, sizeof(frame.header.target));
+
+  return lifx_scheduler_submit(scheduler, &frame, addr, now);
+}
+
+int lifx_scheduler_run(lifx_scheduler_t *scheduler, uint64_t now,
+                       lifx_scheduler_emit emit, void *ctx) {
+  if (scheduler == NULL || emit == NULL) {
+    return -1;
+  }
+
+  int emitted = 0;
+  size_t i = 0;
+  while (i < scheduler->active_count) {
+    lifx_scheduled_device_t *device =
+        &scheduler->devices[scheduler->active[i]];
+
+    while (device->len > 0 && lifx_bucket_take(&device->bucket, now)) {
+      if (emit(ctx, &device->queue[device->head], &device->addr) == -1) {
+        device->bucket.tokens += 1000; /* Nothing was sent */
+        return emitted;
+      }
+      device->head = (device->head + 1) % LIFX_SCHEDULER_QUEUE;
+      device->len--;
+      scheduler->stats.emitted++;
+      emitted++;
+    }
+
+    if (device->len == 0) {
+      device->active = 0;
+      scheduler->active[i] = scheduler->active[--scheduler->active_count];
+    } else {
+      ++i;
+    }
+  }
+
+  return emitted;
+}
+
+int64_t lifx_scheduler_next(const lifx_scheduler_t *scheduler, uint64_t now) {
+  int64_t next = -1;
+
+  for (size_t i = 0; i < scheduler->active_count; ++i) {
+    const lifx_scheduled_device_t *device =
+        &scheduler->devices[scheduler->active[i]];
+    uint64_t wait = lifx_bucket_wait(&device->bucket, now);
+    if (wait > INT64_MAX) {
+      continue;
+    }
+    if (next == -1 || (int64_t)wait < next) {
+      next = wait;
+    }
+  }
+
+  return next;
+}
+
+int lifx_scheduler_emit_client(void *ctx, const lifx_frame_t *frame,
+                               const struct sockaddr_in *addr) {
+  if (lifx_client_send(ctx, frame, addr, NULL, NULL) == -1) {
+    return -1;
+  }
+
+  return 0;
+}
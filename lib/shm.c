@@ -0,0 +1,422 @@
+#include "shm.h"
+#include "ring.h"
+#include "wire.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Sections of the segment start on their own cache line */
+#define SECTION_ALIGN 64
+/* Spins on a device list being written before checking the daemon lives */
+#define PUBLISH_SPINS 4096
+
+static size_t section_align(size_t offset) {
+  return (offset + SECTION_ALIGN - 1) & ~(size_t)(SECTION_ALIGN - 1);
+}
+
+_Static_assert(offsetof(lifx_shm_cell_t, turn) == 0,
+               "cells start with their turn, see lifx_ring_t");
+
+static lifx_ring_t shm_ring(const lifx_shm_t *shm) {
+  lifx_shm_header_t *header = shm->header;
+  return (lifx_ring_t){
+      .cells = (uint8_t *)shm->cells,
+      .stride = sizeof(*shm->cells),
+      .mask = header->cells - 1,
+      .head = &header->head,
+      .full = &header->full,
+      .tail = &header->tail,
+      .waiting = &header->waiting,
+  };
+}
+
+/* Tell the CPU this is a spin, so it frees the core for the writer */
+static inline void spin_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+static int daemon_gone(const lifx_shm_header_t *header) {
+  return kill(header->pid, 0) == -1 && errno == ESRCH;
+}
+
+static char *bell_path(const char *path) {
+  size_t n = strlen(path);
+  char *bell = malloc(n + sizeof(LIFX_SHM_BELL_SUFFIX));
+  if (bell == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  memcpy(bell, path, n);
+  memcpy(bell + n, LIFX_SHM_BELL_SUFFIX, sizeof(LIFX_SHM_BELL_SUFFIX));
+  return bell;
+}
+
+/* The segment at path was created by a daemon that is gone */
+static int segment_stale(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return 0;
+  }
+  lifx_shm_header_t header;
+  ssize_t n = pread(fd, &header, sizeof(header), 0);
+  close(fd);
+
+  return n == sizeof(header) &&
+         memcmp(header.magic, LIFX_SHM_MAGIC, sizeof(header.magic)) == 0 &&
+         daemon_gone(&header);
+}
+
+int lifx_shm_create(lifx_shm_t *shm, const char *path, size_t cells,
+                    size_t max_devices) {
+  if (shm == NULL || path == NULL || cells == 0 || max_devices == 0 ||
+      cells > UINT32_MAX / 2 || max_devices > UINT32_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(shm, 0, sizeof(*shm));
+  shm->bell = -1;
+  size_t count = 1;
+  while (count < cells) {
+    count <<= 1;
+  }
+  size_t cells_offset = section_align(sizeof(lifx_shm_header_t));
+  size_t devices_offset =
+      section_align(cells_offset + count * sizeof(lifx_shm_cell_t));
+  size_t size = devices_offset + max_devices * sizeof(lifx_device_t);
+
+  shm->path = strdup(path);
+  char *bell = bell_path(path);
+  if (shm->path == NULL || bell == NULL) {
+    free(bell);
+    free(shm->path);
+    shm->path = NULL;
+    errno = ENOMEM;
+    return -1;
+  }
+
+  int flags = O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC;
+  int fd = open(path, flags, 0660);
+  if (fd == -1 && errno == EEXIST && segment_stale(path)) {
+    unlink(path);
+    fd = open(path, flags, 0660);
+  }
+  if (fd == -1) {
+    goto fail;
+  }
+  if (ftruncate(fd, size) == -1) {
+    close(fd);
+    unlink(path);
+    goto fail;
+  }
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    unlink(path);
+    goto fail;
+  }
+  shm->size = size;
+  shm->header = map;
+  shm->cells = (lifx_shm_cell_t *)((uint8_t *)map + cells_offset);
+  shm->devices = (lifx_device_t *)((uint8_t *)map + devices_offset);
+
+  lifx_shm_header_t *header = shm->header;
+  header->header_size = sizeof(lifx_shm_header_t);
+  header->cell_size = sizeof(lifx_shm_cell_t);
+  header->device_size = sizeof(lifx_device_t);
+  header->cells = count;
+  header->max_devices = max_devices;
+  header->pid = getpid();
+  header->cells_offset = cells_offset;
+  header->devices_offset = devices_offset;
+  header->size = size;
+  lifx_ring_t ring = shm_ring(shm);
+  lifx_ring_reset(&ring);
+
+  /* The doorbell is opened for reading and writing so it never reports
+   * hang up while no client has it open */
+  unlink(bell);
+  if (mkfifo(bell, 0660) == -1) {
+    goto fail_mapped;
+  }
+  shm->bell = open(bell, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (shm->bell == -1) {
+    unlink(bell);
+    goto fail_mapped;
+  }
+  free(bell);
+
+  /* Clients check the magic, it goes in once the rest is written */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(header->magic, LIFX_SHM_MAGIC, sizeof(header->magic));
+
+  return 0;
+
+fail_mapped:
+  munmap(shm->header, shm->size);
+  unlink(path);
+fail:;
+  int saved = errno;
+  free(bell);
+  free(shm->path);
+  memset(shm, 0, sizeof(*shm));
+  shm->bell = -1;
+  errno = saved;
+  return -1;
+}
+
+void lifx_shm_destroy(lifx_shm_t *shm) {
+  if (shm == NULL || shm->header == NULL) {
+    return;
+  }
+
+  char *bell = bell_path(shm->path);
+  if (bell != NULL) {
+    unlink(bell);
+    free(bell);
+  }
+  unlink(shm->path);
+  free(shm->path);
+  shm->path = NULL;
+  lifx_shm_close(shm);
+}
+
+int lifx_shm_open(lifx_shm_t *shm, const char *path) {
+  if (shm == NULL || path == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(shm, 0, sizeof(*shm));
+  shm->bell = -1;
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+  if ((size_t)st.st_size < sizeof(lifx_shm_header_t)) {
+    close(fd);
+    errno = EPROTO;
+    return -1;
+  }
+  void *map =
+      mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  shm->header = map;
+  shm->size = st.st_size;
+
+  lifx_shm_header_t *header = shm->header;
+  if (memcmp(header->magic, LIFX_SHM_MAGIC, sizeof(header->magic)) != 0 ||
+      header->header_size != sizeof(lifx_shm_header_t) ||
+      header->cell_size != sizeof(lifx_shm_cell_t) ||
+      header->device_size != sizeof(lifx_device_t) ||
+      header->size != shm->size || header->cells == 0 ||
+      (header->cells & (header->cells - 1)) != 0 ||
+      header->cells_offset + (uint64_t)header->cells * sizeof(lifx_shm_cell_t) >
+          header->devices_offset ||
+      header->devices_offset +
+              (uint64_t)header->max_devices * sizeof(lifx_device_t) >
+          header->size) {
+    lifx_shm_close(shm);
+    errno = EPROTO;
+    return -1;
+  }
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  shm->cells = (lifx_shm_cell_t *)((uint8_t *)map + header->cells_offset);
+  shm->devices = (lifx_device_t *)((uint8_t *)map + header->devices_offset);
+
+  if (daemon_gone(header)) {
+    lifx_shm_close(shm);
+    errno = ENXIO;
+    return -1;
+  }
+
+  /* Holding a read end too means ringing a daemon that died never raises
+   * SIGPIPE, the byte just stays in the FIFO */
+  char *bell = bell_path(path);
+  if (bell == NULL) {
+    lifx_shm_close(shm);
+    return -1;
+  }
+  shm->bell = open(bell, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  int saved = errno;
+  free(bell);
+  if (shm->bell == -1) {
+    lifx_shm_close(shm);
+    errno = saved;
+    return -1;
+  }
+
+  return 0;
+}
+
+void lifx_shm_close(lifx_shm_t *shm) {
+  if (shm == NULL) {
+    return;
+  }
+
+  if (shm->header != NULL) {
+    munmap(shm->header, shm->size);
+  }
+  if (shm->bell != -1) {
+    close(shm->bell);
+  }
+  free(shm->path);
+  memset(shm, 0, sizeof(*shm));
+  shm->bell = -1;
+}
+
+int lifx_shm_submit(lifx_shm_t *shm, const lifx_frame_t *frame) {
+  if (shm == NULL || frame == NULL ||
+      lifx_load_le64(frame->header.target) == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  uint64_t pos;
+  lifx_ring_t ring = shm_ring(shm);
+  lifx_shm_cell_t *cell = lifx_ring_claim(&ring, &pos);
+  if (cell == NULL) {
+    return -1;
+  }
+  cell->frame = *frame;
+  if (lifx_ring_publish(&ring, cell, pos)) {
+    uint8_t one = 1;
+    /* Only fails when the FIFO is full, which wakes anyway */
+    (void)!write(shm->bell, &one, sizeof(one));
+  }
+
+  return 0;
+}
+
+int lifx_shm_set_color(lifx_shm_t *shm, const uint8_t target[8],
+                       const lifx_set_color_payload_t *payload) {
+  lifx_frame_t frame = {
+      .header =
+          {
+              .acknowledgement = 1,
+              .type = SetColor,
+          },
+      .payload =
+          {
+              .set_color_payload = *payload,
+          },
+  };
+  memcpy(frame.header.target, target, sizeof(frame.header.target));
+
+  return lifx_shm_submit(shm, &frame);
+}
+
+int lifx_shm_set_power(lifx_shm_t *shm, const uint8_t target[8],
+                       const lifx_set_power_payload_t *payload) {
+  lifx_frame_t frame = {
+      .header =
+          {
+              .acknowledgement = 1,
+              .type = SetPower,
+          },
+      .payload =
+          {
+              .set_power_payload = *payload,
+          },
+  };
+  memcpy(frame.header.target, target, sizeof(frame.header.target));
+
+  return lifx_shm_submit(shm, &frame);
+}
+
+int lifx_shm_devices(const lifx_shm_t *shm, lifx_device_t *devices,
+                     size_t n) {
+  if (shm == NULL || devices == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  lifx_shm_header_t *header = shm->header;
+  uint32_t spins = 0;
+  while (1) {
+    uint32_t version = __atomic_load_n(&header->version, __ATOMIC_ACQUIRE);
+    if (version & 1) {
+      /* A daemon killed while publishing leaves the version odd for good */
+      if (++spins % PUBLISH_SPINS == 0 && daemon_gone(header)) {
+        errno = ENXIO;
+        return -1;
+      }
+      spin_pause();
+      continue;
+    }
+    size_t count = __atomic_load_n(&header->count, __ATOMIC_RELAXED);
+    if (count > header->max_devices) {
+      count = header->max_devices;
+    }
+    if (count > n) {
+      count = n;
+    }
+    memcpy(devices, shm->devices, count * sizeof(*devices));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&header->version, __ATOMIC_RELAXED) == version) {
+      return count;
+    }
+  }
+}
+
+int lifx_shm_take(lifx_shm_t *shm, lifx_frame_t *frame) {
+  lifx_ring_t ring = shm_ring(shm);
+  lifx_shm_cell_t *cell = lifx_ring_peek(&ring);
+  if (cell == NULL) {
+    return 0;
+  }
+
+  *frame = cell->frame;
+  lifx_ring_release(&ring, cell);
+  return 1;
+}
+
+void lifx_shm_publish(lifx_shm_t *shm, const lifx_registry_t *registry) {
+  lifx_shm_header_t *header = shm->header;
+  uint32_t version = header->version;
+  __atomic_store_n(&header->version, version + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  size_t count = 0;
+  size_t cursor = 0;
+  const lifx_device_t *device;
+  while (count < header->max_devices &&
+         (device = lifx_registry_next(registry, &cursor)) != NULL) {
+    shm->devices[count++] = *device;
+  }
+  __atomic_store_n(&header->count, count, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&header->version, version + 2, __ATOMIC_RELEASE);
+}
+
+int lifx_shm_arm(lifx_shm_t *shm) {
+  lifx_ring_t ring = shm_ring(shm);
+  return lifx_ring_arm(&ring);
+}
+
+void lifx_shm_wake(lifx_shm_t *shm) {
+  uint8_t buf[64];
+  while (read(shm->bell, buf, sizeof(buf)) == sizeof(buf)) {
+  }
+  lifx_ring_t ring = shm_ring(shm);
+  lifx_ring_disarm(&ring);
+}
+
+int lifx_shm_fd(const lifx_shm_t *shm) { return shm->bell; }
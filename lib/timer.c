@@ -0,0 +1,153 @@
+#include "timer.h"
+#include <string.h>
+
+#define SLOT_MASK (LIFX_WHEEL_SLOTS - 1)
+
+static void list_push(lifx_timer_t *head, lifx_timer_t *timer) {
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+static void list_unlink(lifx_timer_t *timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = NULL;
+  timer->prev = NULL;
+}
+
+/* Put a timer in the lowest level whose span reaches its expiry */
+static void wheel_place(lifx_wheel_t *wheel, lifx_timer_t *timer) {
+  uint64_t delta = timer->expires - wheel->now;
+  int level = 0;
+  while (level < LIFX_WHEEL_LEVELS - 1 &&
+         delta >= (uint64_t)1 << (LIFX_WHEEL_BITS * (level + 1))) {
+    level++;
+  }
+
+  uint64_t expires = timer->expires;
+  if (level == LIFX_WHEEL_LEVELS - 1) {
+    /* Beyond the span of the wheel: park in the furthest slot and let the
+     * cascade place it again */
+    uint64_t span = (uint64_t)1 << (LIFX_WHEEL_BITS * LIFX_WHEEL_LEVELS);
+    if (delta >= span) {
+      expires = wheel->now + span - 1;
+    }
+  }
+
+  size_t slot = (expires >> (LIFX_WHEEL_BITS * level)) & SLOT_MASK;
+  list_push(&wheel->slots[level][slot], timer);
+}
+
+/* Move every timer of a slot down to the level that now fits it */
+static void wheel_cascade(lifx_wheel_t *wheel, int level, size_t slot) {
+  lifx_timer_t *head = &wheel->slots[level][slot];
+  lifx_timer_t list = {0};
+  if (head->next == head) {
+    return;
+  }
+
+  /* Detach first, placing may land back in this very slot */
+  list.next = head->next;
+  list.prev = head->prev;
+  list.next->prev = &list;
+  list.prev->next = &list;
+  head->next = head;
+  head->prev = head;
+
+  while (list.next != &list) {
+    lifx_timer_t *timer = list.next;
+    list_unlink(timer);
+    wheel_place(wheel, timer);
+  }
+}
+
+void lifx_wheel_init(lifx_wheel_t *wheel, uint64_t now) {
+  for (int level = 0; level < LIFX_WHEEL_LEVELS; ++level) {
+    for (int slot = 0; slot < LIFX_WHEEL_SLOTS; ++slot) {
+      lifx_timer_t *head = &wheel->slots[level][slot];
+      head->next = head;
+      head->prev = head;
+    }
+  }
+  wheel->now = now;
+  wheel->count = 0;
+}
+
+void lifx_wheel_add(lifx_wheel_t *wheel, lifx_timer_t *timer,
+                    uint64_t expires, lifx_timer_callback callback,
+                    void *ctx) {
+  lifx_wheel_cancel(wheel, timer);
+
+  if (expires <= wheel->now) {
+    expires = wheel->now + 1;
+  }
+  timer->expires = expires;
+  timer->callback = callback;
+  timer->ctx = ctx;
+  wheel_place(wheel, timer);
+  wheel->count++;
+}
+
+void lifx_wheel_cancel(lifx_wheel_t *wheel, lifx_timer_t *timer) {
+  if (timer->next == NULL) {
+    return;
+  }
+  list_unlink(timer);
+  wheel->count--;
+}
+
+size_t lifx_wheel_advance(lifx_wheel_t *wheel, uint64_t now) {
+  size_t fired = 0;
+
+  while (wheel->now < now) {
+    if (wheel->count == 0) {
+      wheel->now = now;
+      break;
+    }
+
+    uint64_t tick = ++wheel->now;
+
+    /* Cascade every level whose slot boundary this tick crosses, top down */
+    int levels = 0;
+    while (levels < LIFX_WHEEL_LEVELS - 1) {
+      uint64_t span = (uint64_t)1 << (LIFX_WHEEL_BITS * (levels + 1));
+      if ((tick & (span - 1)) != 0) {
+        break;
+      }
+      levels++;
+    }
+    for (int level = levels; level > 0; --level) {
+      wheel_cascade(wheel, level,
+                    (tick >> (LIFX_WHEEL_BITS * level)) & SLOT_MASK);
+    }
+
+    lifx_timer_t *head = &wheel->slots[0][tick & SLOT_MASK];
+    while (head->next != head) {
+      lifx_timer_t *timer = head->next;
+      list_unlink(timer);
+      wheel->count--;
+      fired++;
+      timer->callback(timer, timer->ctx);
+    }
+  }
+
+  return fired;
+}
+
+int64_t lifx_wheel_next(const lifx_wheel_t *wheel) {
+  if (wheel->count == 0) {
+    return -1;
+  }
+
+  for (int64_t i = 1; i < LIFX_WHEEL_SLOTS; ++i) {
+    const lifx_timer_t *head = &wheel->slots[0][(wheel->now + i) & SLOT_MASK];
+    if (head->next != head) {
+      return i;
+    }
+  }
+
+  /* Nothing close by, wake at the next cascade */
+  return LIFX_WHEEL_SLOTS - (wheel->now & SLOT_MASK);
+}
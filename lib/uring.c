@@ -0,0 +1,523 @@
+#include "uring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Frames submitted by one io_uring_enter when sending */
+#define SEND_ENTRIES 256
+/* Buffers the kernel receives into, at least twice the receive depth */
+#define RECV_BUFFERS_MIN 256
+/* A multishot recvmsg buffer: header, sender address, then the datagram */
+#define RECV_BUFFER_SIZE                                                       \
+  (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) +     \
+   FRAME_SIZE_MAX)
+/* Buffer group of the receive buffers */
+#define RECV_GROUP 0
+/* user_data of the poll on the watched descriptor, receives carry 0 */
+#define WATCH_TAG 1
+
+/* The mapped rings of one io_uring instance */
+typedef struct {
+  int fd;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sq_pending; /* local tail, published by ring_enter */
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  size_t sq_map_size;
+  void *cq_map;        /* same as sq_map when the kernel maps both at once */
+  size_t cq_map_size;
+  size_t sqes_size;
+} ring_t;
+
+struct lifx_uring {
+  ring_t recv;               /* multishot receive */
+  ring_t send;               /* batches of sends */
+  struct io_uring_buf_ring *buf_ring;
+  size_t buf_ring_size;      /* bytes mapped for buf_ring */
+  unsigned buf_count;        /* buffers, a power of 2 */
+  unsigned short buf_tail;   /* local tail of buf_ring */
+  uint8_t *buffers;          /* buf_count buffers of RECV_BUFFER_SIZE */
+  unsigned short *held;      /* buffers behind the current views */
+  size_t held_count;
+  struct msghdr msg;         /* layout of every multishot buffer */
+  int armed;                 /* the multishot receive is running */
+  int watching;              /* the poll on io->watch is armed */
+  int link;                  /* sends are linked, see lifx_uring_send */
+  int results[SEND_ENTRIES]; /* results of the sends in flight */
+};
+
+static int ring_setup(unsigned entries, struct io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ring_register(int fd, unsigned opcode, const void *arg,
+                         unsigned n) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+static int ring_enter_raw(int fd, unsigned submit, unsigned wait,
+                          unsigned flags, const void *arg, size_t size) {
+  return syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, size);
+}
+
+static void ring_free(ring_t *ring) {
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_map != NULL && ring->cq_map != ring->sq_map) {
+    munmap(ring->cq_map, ring->cq_map_size);
+  }
+  if (ring->sq_map != NULL) {
+    munmap(ring->sq_map, ring->sq_map_size);
+  }
+  if (ring->fd != -1) {
+    close(ring->fd);
+  }
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+static int ring_init(ring_t *ring, unsigned entries, unsigned cq_entries,
+                     int sfd) {
+  memset(ring, 0, sizeof(*ring));
+  struct io_uring_params params = {0};
+  /* Completions are only looked at from the thread submitting, so it need
+   * not be interrupted to run them */
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+  params.cq_entries = cq_entries;
+  ring->fd = ring_setup(entries, &params);
+  if (ring->fd == -1 && errno == EINVAL) {
+    params.flags &= ~IORING_SETUP_COOP_TASKRUN;
+    ring->fd = ring_setup(entries, &params);
+  }
+  if (ring->fd == -1) {
+    return -1;
+  }
+  /* Waiting with a timeout needs 5.11, older kernels use epoll */
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    errno = ENOSYS;
+    goto fail;
+  }
+
+  ring->sq_map_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_map_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_map_size > ring->sq_map_size) {
+      ring->sq_map_size = ring->cq_map_size;
+    }
+  }
+  ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED) {
+    ring->sq_map = NULL;
+    goto fail;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_map = ring->sq_map;
+  } else {
+    ring->cq_map =
+        mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) {
+      ring->cq_map = NULL;
+      goto fail;
+    }
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    goto fail;
+  }
+
+  uint8_t *sq = ring->sq_map;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->sq_pending = *ring->sq_tail;
+  uint8_t *cq = ring->cq_map;
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  /* The socket is looked up once instead of on every operation */
+  if (ring_register(ring->fd, IORING_REGISTER_FILES, &sfd, 1) == -1) {
+    goto fail;
+  }
+
+  return 0;
+
+fail:;
+  int saved = errno;
+  ring_free(ring);
+  errno = saved;
+  return -1;
+}
+
+/* Next free submission entry, cleared, its slot is index 0 of the sockets
+ * registered */
+static struct io_uring_sqe *ring_sqe(ring_t *ring, uint8_t opcode) {
+  unsigned index = ring->sq_pending & ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = 0;
+  sqe->flags = IOSQE_FIXED_FILE;
+  ring->sq_array[index] = index;
+  ring->sq_pending++;
+  return sqe;
+}
+
+/* Submit the pending entries and wait for wait completions, timeout is in
+ * milliseconds, -1 waits forever */
+static int ring_enter(lifx_io_t *io, ring_t *ring, unsigned wait,
+                      int timeout) {
+  unsigned submit = ring->sq_pending - *ring->sq_tail;
+  __atomic_store_n(ring->sq_tail, ring->sq_pending, __ATOMIC_RELEASE);
+
+  unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg = {0};
+  const void *argp = NULL;
+  size_t size = 0;
+  if (wait > 0 && timeout >= 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    flags |= IORING_ENTER_EXT_ARG;
+    argp = &arg;
+    size = sizeof(arg);
+  }
+
+  io->syscalls++;
+  int res = ring_enter_raw(ring->fd, submit, wait, flags, argp, size);
+  if (res == -1 && (errno == ETIME || errno == EINTR)) {
+    return 0;
+  }
+  return res;
+}
+
+static void buffer_give(struct lifx_uring *uring, unsigned short bid) {
+  struct io_uring_buf *buf =
+      &uring->buf_ring->bufs[uring->buf_tail & (uring->buf_count - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(uring->buffers + bid * RECV_BUFFER_SIZE);
+  buf->len = RECV_BUFFER_SIZE;
+  buf->bid = bid;
+  uring->buf_tail++;
+}
+
+static void buffers_publish(struct lifx_uring *uring) {
+  __atomic_store_n(&uring->buf_ring->tail, uring->buf_tail, __ATOMIC_RELEASE);
+}
+
+static void recv_arm(struct lifx_uring *uring) {
+  struct io_uring_sqe *sqe = ring_sqe(&uring->recv, IORING_OP_RECVMSG);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->addr = (uint64_t)(uintptr_t)&uring->msg;
+  sqe->len = 1;
+  sqe->buf_group = RECV_GROUP;
+  uring->armed = 1;
+}
+
+/* One shot poll, armed again only before sleeping so a descriptor the
+ * caller has not read yet does not complete it over and over */
+static void watch_arm(lifx_io_t *io) {
+  struct io_uring_sqe *sqe = ring_sqe(&io->uring->recv, IORING_OP_POLL_ADD);
+  sqe->fd = io->watch;
+  sqe->flags = 0;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = WATCH_TAG;
+  io->uring->watching = 1;
+}
+
+int lifx_uring_init(lifx_io_t *io) {
+  struct lifx_uring *uring = calloc(1, sizeof(*uring));
+  io->views = calloc(io->depth, sizeof(*io->views));
+  io->addrs = calloc(io->depth, sizeof(*io->addrs));
+  if (uring == NULL || io->views == NULL || io->addrs == NULL) {
+    /* LIFX_IO_AUTO falls back to epoll, which sets views and addrs itself */
+    free(uring);
+    free(io->views);
+    free(io->addrs);
+    io->views = NULL;
+    io->addrs = NULL;
+    errno = ENOMEM;
+    return -1;
+  }
+  io->uring = uring;
+  uring->recv.fd = -1;
+  uring->send.fd = -1;
+
+  unsigned count = RECV_BUFFERS_MIN;
+  while (count < io->depth * 2) {
+    count <<= 1;
+  }
+  if (count > 32768) {
+    errno = EINVAL;
+    goto fail;
+  }
+  uring->buf_count = count;
+  int flags = fcntl(io->sfd, F_GETFL);
+  if (flags == -1) {
+    goto fail;
+  }
+  uring->link = flags & O_NONBLOCK;
+
+  /* The completion queue holds a completion for every receive buffer */
+  if (ring_init(&uring->recv, 4, count, io->sfd) == -1 ||
+      ring_init(&uring->send, SEND_ENTRIES, SEND_ENTRIES, io->sfd) == -1) {
+    goto fail;
+  }
+
+  uring->buf_ring_size = count * sizeof(struct io_uring_buf);
+  uring->buf_ring = mmap(NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (uring->buf_ring == MAP_FAILED) {
+    uring->buf_ring = NULL;
+    goto fail;
+  }
+  uring->buffers = malloc((size_t)count * RECV_BUFFER_SIZE);
+  uring->held = calloc(io->depth, sizeof(*uring->held));
+  if (uring->buffers == NULL || uring->held == NULL) {
+    errno = ENOMEM;
+    goto fail;
+  }
+
+  struct io_uring_buf_reg reg = {
+      .ring_addr = (uint64_t)(uintptr_t)uring->buf_ring,
+      .ring_entries = count,
+      .bgid = RECV_GROUP,
+  };
+  if (ring_register(uring->recv.fd, IORING_REGISTER_PBUF_RING, &reg, 1) ==
+      -1) {
+    goto fail;
+  }
+  for (unsigned i = 0; i < count; ++i) {
+    buffer_give(uring, i);
+  }
+  buffers_publish(uring);
+
+  uring->msg.msg_namelen = sizeof(struct sockaddr_storage);
+  recv_arm(uring);
+  if (ring_enter(io, &uring->recv, 0, 0) == -1) {
+    goto fail;
+  }
+
+  return 0;
+
+fail:;
+  int saved = errno;
+  lifx_uring_free(io);
+  errno = saved;
+  return -1;
+}
+
+void lifx_uring_free(lifx_io_t *io) {
+  struct lifx_uring *uring = io->uring;
+  if (uring != NULL) {
+    /* Closing the ring cancels the multishot receive */
+    ring_free(&uring->recv);
+    ring_free(&uring->send);
+    if (uring->buf_ring != NULL) {
+      munmap(uring->buf_ring, uring->buf_ring_size);
+    }
+    free(uring->buffers);
+    free(uring->held);
+    free(uring);
+  }
+  free(io->views);
+  free(io->addrs);
+  io->uring = NULL;
+  io->views = NULL;
+  io->addrs = NULL;
+}
+
+/* Turn a multishot completion into a view, returns 1 when it is one */
+static int recv_complete(lifx_io_t *io, const struct io_uring_cqe *cqe) {
+  struct lifx_uring *uring = io->uring;
+  if (cqe->user_data == WATCH_TAG) {
+    uring->watching = 0;
+    return 0;
+  }
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    uring->armed = 0;
+  }
+  if (cqe->res < 0) {
+    /* Out of buffers only stops the receive, it is armed again below */
+    return cqe->res == -ENOBUFS ? 0 : cqe->res;
+  }
+  if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+    return 0;
+  }
+
+  unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+  uring->held[uring->held_count++] = bid;
+
+  uint8_t *buf = uring->buffers + bid * RECV_BUFFER_SIZE;
+  const struct io_uring_recvmsg_out *out = (const void *)buf;
+  uint8_t *name = buf + sizeof(*out);
+  uint8_t *payload = name + uring->msg.msg_namelen + uring->msg.msg_controllen;
+  lifx_frame_view_t *view = &io->views[io->count];
+  if ((out->flags & MSG_TRUNC) ||
+      lifx_view_init(view, payload, out->payloadlen) == -1) {
+    io->dropped++;
+    return 0;
+  }
+
+  size_t namelen = out->namelen;
+  if (namelen > sizeof(io->addrs[io->count])) {
+    namelen = sizeof(io->addrs[io->count]);
+  }
+  memset(&io->addrs[io->count], 0, sizeof(io->addrs[io->count]));
+  memcpy(&io->addrs[io->count], name, namelen);
+  io->count++;
+  return 1;
+}
+
+int lifx_uring_recv(lifx_io_t *io, int timeout) {
+  struct lifx_uring *uring = io->uring;
+  ring_t *ring = &uring->recv;
+
+  /* The views of the last call are done with, hand their buffers back */
+  for (size_t i = 0; i < uring->held_count; ++i) {
+    buffer_give(uring, uring->held[i]);
+  }
+  if (uring->held_count > 0) {
+    buffers_publish(uring);
+  }
+  uring->held_count = 0;
+  io->count = 0;
+
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  if (head == tail && timeout != 0) {
+    if (!uring->armed) {
+      recv_arm(uring);
+    }
+    if (io->watch != -1 && !uring->watching) {
+      watch_arm(io);
+    }
+    if (ring_enter(io, ring, 1, timeout) == -1) {
+      return -1;
+    }
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  }
+
+  int error = 0;
+  while (head != tail && uring->held_count < io->depth) {
+    int res = recv_complete(io, &ring->cqes[head & ring->cq_mask]);
+    head++;
+    if (res < 0) {
+      error = -res;
+      break;
+    }
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+  if (!uring->armed) {
+    recv_arm(uring);
+    if (ring_enter(io, ring, 0, 0) == -1) {
+      return -1;
+    }
+  }
+  if (error != 0) {
+    errno = error;
+    return -1;
+  }
+
+  return io->count;
+}
+
+int lifx_uring_send(lifx_io_t *io, lifx_batch_t *batch) {
+  struct lifx_uring *uring = io->uring;
+  ring_t *ring = &uring->send;
+  size_t start = batch->sent;
+
+  while (batch->sent < batch->count) {
+    unsigned n = batch->count - batch->sent;
+    if (n > ring->sq_entries) {
+      n = ring->sq_entries;
+    }
+
+    /* Frames are sent from the arena of the batch, which belongs to the
+     * caller and changes from call to call. Registering it would cost a
+     * syscall per batch, and the zero copy sends that take registered
+     * buffers cost more than copying a frame of a few dozen bytes, so only
+     * the receive buffers are registered.
+     *
+     * A send on a non-blocking socket fails when the buffer is full, linking
+     * makes it cancel the ones behind it so sending resumes in order. On a
+     * blocking socket sends wait for room instead and linking them would
+     * only slow them down. */
+    for (unsigned i = 0; i < n; ++i) {
+      struct io_uring_sqe *sqe = ring_sqe(ring, IORING_OP_SENDMSG);
+      sqe->addr = (uint64_t)(uintptr_t)&batch->msgs[batch->sent + i].msg_hdr;
+      sqe->len = 1;
+      sqe->user_data = i;
+      if (uring->link && i + 1 < n) {
+        sqe->flags |= IOSQE_IO_LINK;
+      }
+    }
+
+    unsigned done = 0;
+    while (done < n) {
+      if (ring_enter(io, ring, n - done, -1) == -1) {
+        return -1;
+      }
+      unsigned head = *ring->cq_head;
+      unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != tail; ++head) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        uring->results[cqe->user_data] = cqe->res;
+        done++;
+      }
+      __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    for (unsigned i = 0; i < n; ++i) {
+      int res = uring->results[i];
+      if (res < 0) {
+        if (res == -EAGAIN || res == -ECANCELED) {
+          return batch->sent - start;
+        }
+        errno = -res;
+        return -1;
+      }
+      batch->msgs[batch->sent].msg_len = res;
+      batch->sent++;
+    }
+  }
+
+  return batch->sent - start;
+}
+
+int lifx_uring_watch(lifx_io_t *io) {
+  watch_arm(io);
+  if (ring_enter(io, &io->uring->recv, 0, 0) == -1) {
+    io->uring->watching = 0;
+    io->watch = -1;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef URING_H
+#define URING_H
+
+#include "io.h"
+
+/*
+ * io_uring backend of lifx_io_t, built with LIFX_HAVE_IO_URING. Each
+ * returns -1 with errno set on failure, like the lifx_io_* calls they back.
+ */
+
+int lifx_uring_init(lifx_io_t *io);
+
+void lifx_uring_free(lifx_io_t *io);
+
+int lifx_uring_recv(lifx_io_t *io, int timeout);
+
+int lifx_uring_send(lifx_io_t *io, lifx_batch_t *batch);
+
+int lifx_uring_watch(lifx_io_t *io);
+
+#endif /* URING_H */
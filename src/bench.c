@@ -0,0 +1,518 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "frame.h"
+#include "histogram.h"
+#include "metrics.h"
+
+#define PORT 56700
+#define HOST "127.0.0.1"
+#define DURATION 5
+#define TARGETS 1000
+#define WINDOW 256
+/* The mix is unrolled into a cycle of at most this many requests */
+#define MIX_CYCLE_MAX 256
+
+/* Simulated lights have the targets D0:73:D5 followed by their index */
+#define TARGET_PREFIX "\xD0\x73\xD5"
+
+typedef enum {
+  KIND_SET_COLOR,
+  KIND_SET_POWER,
+  KIND_GET_LABEL,
+  KIND_ECHO,
+  KIND_COUNT,
+} request_kind;
+
+static const char *const kind_names[KIND_COUNT] = {
+    [KIND_SET_COLOR] = "setcolor",
+    [KIND_SET_POWER] = "setpower",
+    [KIND_GET_LABEL] = "getlabel",
+    [KIND_ECHO] = "echo",
+};
+
+typedef struct {
+  uint64_t sent;        /* requests handed to the client */
+  uint64_t completed;   /* requests answered */
+  uint64_t lost;        /* requests never answered */
+  lifx_histogram_t rtt; /* nanoseconds from first send to reply */
+} kind_stats_t;
+
+typedef struct bench bench_t;
+
+/* A request in flight, ctx of its callback */
+typedef struct pending pending_t;
+struct pending {
+  bench_t *bench;
+  uint64_t sent; /* nanoseconds */
+  request_kind kind;
+  pending_t *next; /* free list */
+};
+
+struct bench {
+  pending_t *pending; /* window requests */
+  pending_t *free;
+  size_t inflight;
+  kind_stats_t stats[KIND_COUNT];
+};
+
+/* Prints the client metrics every second while the bench runs */
+typedef struct {
+  pthread_t thread;
+  const lifx_metrics_t *metrics;
+  lifx_metrics_snapshot_t snapshot;
+  int stop;
+} monitor_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [OPTION]...\n"
+          "\n"
+          "\t-a, --address HOST  lights or simulator to load, defaults to %s\n"
+          "\t-p, --port PORT     defaults to %d\n"
+          "\t-n, --targets N     spread requests over N simulated targets,\n"
+          "\t                    defaults to %d\n"
+          "\t-f, --first N       index of the first target, defaults to 0\n"
+          "\t-r, --rate N        offered requests per second, 0 for as many\n"
+          "\t                    as the window allows, defaults to 0\n"
+          "\t-d, --duration S    seconds to send for, defaults to %d\n"
+          "\t-w, --window N      requests in flight at most, defaults to %d\n"
+          "\t-m, --mix MIX       request mix as KIND:WEIGHT,... where KIND is\n"
+          "\t                    setcolor, setpower, getlabel or echo,\n"
+          "\t                    defaults to every kind weighted 1\n"
+          "\t-t, --timeout MS    wait for a reply, defaults to %d\n"
+          "\t    --retries N     retransmissions, defaults to 0\n"
+          "\t    --metrics       print the client metrics every second\n",
+          name, HOST, PORT, TARGETS, DURATION, WINDOW,
+          LIFX_CLIENT_TIMEOUT_DEFAULT);
+}
+
+/*
+ * Unroll weights into a cycle of requests with smooth weighted round robin,
+ * so the kinds interleave instead of going out in runs. Returns the length
+ * of the cycle or -1 when mix does not parse.
+ */
+static int mix_parse(const char *mix, request_kind *cycle) {
+  int weights[KIND_COUNT] = {0};
+  int total = 0;
+
+  char *copy = strdup(mix);
+  if (copy == NULL) {
+    return -1;
+  }
+  char *save = NULL;
+  for (char *item = strtok_r(copy, ",", &save); item != NULL;
+       item = strtok_r(NULL, ",", &save)) {
+    char *weight = strchr(item, ':');
+    if (weight != NULL) {
+      *weight++ = '\0';
+    }
+
+    int kind = 0;
+    while (kind < KIND_COUNT && strcmp(item, kind_names[kind]) != 0) {
+      kind++;
+    }
+    if (kind == KIND_COUNT) {
+      free(copy);
+      return -1;
+    }
+    weights[kind] = weight == NULL ? 1 : atoi(weight);
+    if (weights[kind] < 0) {
+      free(copy);
+      return -1;
+    }
+  }
+  free(copy);
+
+  for (int kind = 0; kind < KIND_COUNT; ++kind) {
+    total += weights[kind];
+  }
+  if (total == 0 || total > MIX_CYCLE_MAX) {
+    return -1;
+  }
+
+  int credit[KIND_COUNT] = {0};
+  for (int i = 0; i < total; ++i) {
+    int best = 0;
+    for (int kind = 0; kind < KIND_COUNT; ++kind) {
+      credit[kind] += weights[kind];
+      if (credit[kind] > credit[best]) {
+        best = kind;
+      }
+    }
+    credit[best] -= total;
+    cycle[i] = best;
+  }
+
+  return total;
+}
+
+static void request_frame(lifx_frame_t *frame, request_kind kind,
+                          size_t target, uint64_t n) {
+  memset(frame, 0, sizeof(*frame));
+  memcpy(frame->header.target, TARGET_PREFIX, 3);
+  frame->header.target[3] = target >> 16;
+  frame->header.target[4] = target >> 8;
+  frame->header.target[5] = target;
+
+  switch (kind) {
+  case KIND_SET_COLOR:
+    frame->header.type = SetColor;
+    frame->header.acknowledgement = 1;
+    frame->payload.set_color_payload.hue = n * 97;
+    frame->payload.set_color_payload.saturation = UINT16_MAX;
+    frame->payload.set_color_payload.brightness = UINT16_MAX;
+    frame->payload.set_color_payload.kelvin = 3500;
+    break;
+  case KIND_SET_POWER:
+    frame->header.type = SetPower;
+    frame->header.acknowledgement = 1;
+    frame->payload.set_power_payload.level = n & 1 ? UINT16_MAX : 0;
+    break;
+  case KIND_GET_LABEL:
+    frame->header.type = GetLabel;
+    frame->header.response = 1;
+    break;
+  case KIND_ECHO:
+    frame->header.type = EchoRequest;
+    frame->header.response = 1;
+    snprintf((char *)frame->payload.echo_request_payload.echoing,
+             sizeof(frame->payload.echo_request_payload.echoing),
+             "lifx-bench %llu", (unsigned long long)n);
+    break;
+  default:
+    break;
+  }
+}
+
+static void on_reply(lifx_client_t *client, int status,
+                     const lifx_frame_t *reply, void *ctx) {
+  (void)client;
+  (void)reply;
+  pending_t *pending = ctx;
+  bench_t *bench = pending->bench;
+  kind_stats_t *stats = &bench->stats[pending->kind];
+
+  if (status == LIFX_CLIENT_OK) {
+    stats->completed++;
+    lifx_histogram_record(&stats->rtt, now_ns() - pending->sent);
+  } else {
+    stats->lost++;
+  }
+
+  pending->next = bench->free;
+  bench->free = pending;
+  bench->inflight--;
+}
+
+static void report_row(const char *name, const kind_stats_t *stats,
+                       double seconds) {
+  double loss = stats->sent == 0 ? 0 : 100.0 * stats->lost / stats->sent;
+  printf("%-9s %10llu %10.0f %7.3f%% %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+         (unsigned long long)stats->sent, stats->completed / seconds, loss,
+         lifx_histogram_quantile(&stats->rtt, 0.5) / 1e3,
+         lifx_histogram_quantile(&stats->rtt, 0.99) / 1e3,
+         lifx_histogram_quantile(&stats->rtt, 0.999) / 1e3,
+         lifx_histogram_mean(&stats->rtt) / 1e3,
+         stats->rtt.count == 0 ? 0 : stats->rtt.max / 1e3);
+}
+
+static void report(const bench_t *bench, double seconds, uint64_t offered) {
+  kind_stats_t total = {0};
+  lifx_histogram_init(&total.rtt);
+
+  printf("%-9s %10s %10s %8s %9s %9s %9s %9s %9s\n", "kind", "sent",
+         "replies/s", "loss", "p50 us", "p99 us", "p999 us", "mean us",
+         "max us");
+  for (int kind = 0; kind < KIND_COUNT; ++kind) {
+    const kind_stats_t *stats = &bench->stats[kind];
+    if (stats->sent == 0) {
+      continue;
+    }
+    report_row(kind_names[kind], stats, seconds);
+    total.sent += stats->sent;
+    total.completed += stats->completed;
+    total.lost += stats->lost;
+    lifx_histogram_merge(&total.rtt, &stats->rtt);
+  }
+  report_row("total", &total, seconds);
+
+  printf("\nsent %.0f requests/s over %.2f s", total.sent / seconds, seconds);
+  if (offered > total.sent) {
+    printf(", %llu offered requests found the window full",
+           (unsigned long long)(offered - total.sent));
+  }
+  printf("\n");
+}
+
+static void *monitor_run(void *arg) {
+  monitor_t *monitor = arg;
+  lifx_metrics_snapshot_t *snapshot = &monitor->snapshot;
+  uint64_t sent = 0;
+  uint64_t received = 0;
+
+  fprintf(stderr, "%8s %10s %10s %8s %8s %10s %10s\n", "metrics", "sent/s",
+          "recv/s", "retries", "timeouts", "ack p50 us", "ack p99 us");
+  while (!__atomic_load_n(&monitor->stop, __ATOMIC_RELAXED)) {
+    sleep(1);
+    lifx_metrics_snapshot(monitor->metrics, snapshot);
+    const uint64_t *values = snapshot->global.values;
+    fprintf(stderr, "%8s %10llu %10llu %8llu %8llu %10llu %10llu\n", "",
+            (unsigned long long)(values[LIFX_METRIC_SENT] - sent),
+            (unsigned long long)(values[LIFX_METRIC_RECEIVED] - received),
+            (unsigned long long)values[LIFX_METRIC_RETRIES],
+            (unsigned long long)values[LIFX_METRIC_TIMEOUTS],
+            (unsigned long long)lifx_histogram_quantile(&snapshot->ack_rtt,
+                                                        0.5),
+            (unsigned long long)lifx_histogram_quantile(&snapshot->ack_rtt,
+                                                        0.99));
+    sent = values[LIFX_METRIC_SENT];
+    received = values[LIFX_METRIC_RECEIVED];
+  }
+
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  const char *host = HOST;
+  long port = PORT;
+  long targets = TARGETS;
+  long first = 0;
+  double rate = 0;
+  double duration = DURATION;
+  long window = WINDOW;
+  const char *mix = "setcolor,setpower,getlabel,echo";
+  lifx_retry_policy_t policy = {
+      .timeout = LIFX_CLIENT_TIMEOUT_DEFAULT,
+      .max_timeout = LIFX_CLIENT_MAX_TIMEOUT_DEFAULT,
+      .retries = 0,
+  };
+
+  int metrics_on = 0;
+
+  enum { OPT_RETRIES = 256, OPT_METRICS };
+  static const struct option options[] = {
+      {"address", required_argument, NULL, 'a'},
+      {"port", required_argument, NULL, 'p'},
+      {"targets", required_argument, NULL, 'n'},
+      {"first", required_argument, NULL, 'f'},
+      {"rate", required_argument, NULL, 'r'},
+      {"duration", required_argument, NULL, 'd'},
+      {"window", required_argument, NULL, 'w'},
+      {"mix", required_argument, NULL, 'm'},
+      {"timeout", required_argument, NULL, 't'},
+      {"retries", required_argument, NULL, OPT_RETRIES},
+      {"metrics", no_argument, NULL, OPT_METRICS},
+      {"help", no_argument, NULL, 'h'},
+      {0},
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "a:p:n:f:r:d:w:m:t:h", options,
+                            NULL)) != -1) {
+    switch (opt) {
+    case 'a':
+      host = optarg;
+      break;
+    case 'p':
+      port = strtol(optarg, NULL, 10);
+      break;
+    case 'n':
+      targets = strtol(optarg, NULL, 10);
+      break;
+    case 'f':
+      first = strtol(optarg, NULL, 10);
+      break;
+    case 'r':
+      rate = strtod(optarg, NULL);
+      break;
+    case 'd':
+      duration = strtod(optarg, NULL);
+      break;
+    case 'w':
+      window = strtol(optarg, NULL, 10);
+      break;
+    case 'm':
+      mix = optarg;
+      break;
+    case 't':
+      policy.timeout = strtoul(optarg, NULL, 10);
+      break;
+    case OPT_RETRIES:
+      policy.retries = strtoul(optarg, NULL, 10);
+      break;
+    case OPT_METRICS:
+      metrics_on = 1;
+      break;
+    default:
+      usage(argv[0]);
+      exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+  if (port < 1 || port > 65535 || targets < 1 || first < 0 ||
+      first + targets > (1 << 24) || rate < 0 || duration <= 0 ||
+      window < 1 || policy.timeout == 0) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (policy.max_timeout < policy.timeout) {
+    policy.max_timeout = policy.timeout;
+  }
+
+  request_kind cycle[MIX_CYCLE_MAX];
+  int cycle_length = mix_parse(mix, cycle);
+  if (cycle_length == -1) {
+    fprintf(stderr, "failed to parse mix '%s'\n", mix);
+    exit(EXIT_FAILURE);
+  }
+
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+    fprintf(stderr, "failed to convert ip address to network '%s'\n", host);
+    exit(EXIT_FAILURE);
+  }
+
+  bench_t bench = {0};
+  bench.pending = calloc(window, sizeof(*bench.pending));
+  if (bench.pending == NULL) {
+    fprintf(stderr, "failed to allocate %ld requests\n", window);
+    exit(EXIT_FAILURE);
+  }
+  for (long i = window; i > 0; --i) {
+    bench.pending[i - 1].bench = &bench;
+    bench.pending[i - 1].next = bench.free;
+    bench.free = &bench.pending[i - 1];
+  }
+  for (int kind = 0; kind < KIND_COUNT; ++kind) {
+    lifx_histogram_init(&bench.stats[kind].rtt);
+  }
+
+  lifx_client_t client;
+  if (lifx_client_init(&client, getpid() | 1, window) == -1) {
+    perror("failed to start client");
+    exit(EXIT_FAILURE);
+  }
+
+  lifx_metrics_t metrics;
+  monitor_t monitor = {.metrics = &metrics};
+  if (metrics_on) {
+    if (lifx_metrics_init(&metrics, targets) == -1 ||
+        (client.metrics = lifx_metrics_shard(&metrics)) == NULL ||
+        lifx_metrics_snapshot_init(&monitor.snapshot, targets) == -1) {
+      fprintf(stderr, "failed to allocate metrics\n");
+      exit(EXIT_FAILURE);
+    }
+    if (pthread_create(&monitor.thread, NULL, monitor_run, &monitor) != 0) {
+      fprintf(stderr, "failed to start metrics thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  printf("loading %s:%ld, %ld targets from %ld, ", host, port, targets,
+         first);
+  if (rate == 0) {
+    printf("as fast as a window of %ld allows", window);
+  } else {
+    printf("%.0f requests/s", rate);
+  }
+  printf(" for %.1f s\n\n", duration);
+
+  uint64_t start = now_ns();
+  uint64_t end = start + duration * 1e9;
+  uint64_t offered = 0;
+  uint64_t n = 0;
+  uint64_t now = start;
+
+  while (now < end) {
+    /* Requests due by now, every one of them while the window has room */
+    uint64_t due = rate == 0 ? UINT64_MAX : (now - start) * rate / 1e9;
+    while (offered < due) {
+      if (bench.free == NULL) {
+        if (rate == 0) {
+          break;
+        }
+        offered = due;
+        break;
+      }
+
+      pending_t *pending = bench.free;
+      pending->kind = cycle[n % cycle_length];
+      pending->sent = now;
+
+      lifx_frame_t frame;
+      request_frame(&frame, pending->kind, first + n % targets, n);
+      if (lifx_client_send_policy(&client, &frame, &addr, &policy, on_reply,
+                                  pending) == -1) {
+        if (errno == ENOBUFS || errno == EBUSY) {
+          break;
+        }
+        perror("failed to send request");
+        exit(EXIT_FAILURE);
+      }
+      bench.free = pending->next;
+      bench.inflight++;
+      bench.stats[pending->kind].sent++;
+      offered++;
+      n++;
+    }
+
+    /* Wake up for the next request due, or for replies when the window is
+     * full */
+    int timeout = 1;
+    if (rate == 0) {
+      timeout = bench.free == NULL ? (int)((end - now) / 1000000) + 1 : 0;
+    } else {
+      uint64_t next = start + (offered + 1) * 1e9 / rate;
+      timeout = next > now ? (next - now) / 1000000 : 0;
+    }
+    if (lifx_client_poll(&client, timeout) == -1) {
+      perror("failed to poll client");
+      exit(EXIT_FAILURE);
+    }
+    now = now_ns();
+  }
+  double seconds = (now - start) / 1e9;
+
+  /* Give the last requests their full timeout, then count what is left as
+   * lost */
+  while (bench.inflight > 0) {
+    int completed = lifx_client_poll(&client, policy.max_timeout);
+    if (completed == -1) {
+      perror("failed to poll client");
+      exit(EXIT_FAILURE);
+    }
+    if (completed == 0 && lifx_wheel_next(&client.wheel) == -1) {
+      break;
+    }
+  }
+  if (metrics_on) {
+    __atomic_store_n(&monitor.stop, 1, __ATOMIC_RELAXED);
+    pthread_join(monitor.thread, NULL);
+  }
+  lifx_client_close(&client);
+
+  report(&bench, seconds, offered);
+  free(bench.pending);
+  if (metrics_on) {
+    lifx_metrics_snapshot_free(&monitor.snapshot);
+    lifx_metrics_free(&metrics);
+  }
+
+  return 0;
+}
@@ -0,0 +1,784 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "color.h"
+#include "frame.h"
+#include "view.h"
+#include "wire.h"
+
+#define ITERATIONS 1000000
+/* Cold runs touch this many frames in random order, well past the LLC */
+#define COLD_FRAMES (1 << 18)
+#define BATCH_FRAMES 64
+/* Pixels converted per call, a row of a large matrix install */
+#define COLOR_PIXELS 1024
+
+/* Every message type the library knows */
+#define MESSAGE_TYPE(name, id, size, member) {name, #name},
+static const struct {
+  lifx_message_type type;
+  const char *name;
+} message_types[] = {LIFX_MESSAGES(MESSAGE_TYPE)};
+#define MESSAGE_TYPES (sizeof(message_types) / sizeof(message_types[0]))
+
+/*
+ * Reference codec: the original byte at a time header path, kept here so the
+ * word at a time codec in the library can be checked and timed against it.
+ */
+
+static int ref_write(uint8_t *buf, int cursor, int capacity, uint64_t v,
+                     int n) {
+  if (cursor + n > capacity) {
+    return -1;
+  }
+  for (int i = 0; i < n; ++i) {
+    buf[cursor + i] = v >> (8 * i);
+  }
+  return cursor + n;
+}
+
+static uint64_t ref_read(const uint8_t *buf, int *cursor, int capacity,
+                         int n) {
+  if (*cursor + n > capacity) {
+    return 0;
+  }
+  uint64_t output = 0;
+  for (int i = 0; i < n; ++i) {
+    output |= (uint64_t)buf[*cursor + i] << (8 * i);
+  }
+  *cursor += n;
+  return output;
+}
+
+static int ref_encode_header(const lifx_header_t *header, uint8_t *buf,
+                             int n) {
+  int c = 0;
+  c = ref_write(buf, c, n, header->size, 2);
+  uint16_t protocol = FRAME_PROTOCOL;
+  protocol |= FRAME_ADDRESSABLE << 12;
+  protocol |= header->tagged << 13;
+  protocol |= FRAME_ORIGIN << 14;
+  c = ref_write(buf, c, n, protocol, 2);
+  c = ref_write(buf, c, n, header->source, 4);
+  for (int i = 0; i < 8; ++i) {
+    c = ref_write(buf, c, n, header->target[i], 1);
+  }
+  for (int i = 0; i < 6; ++i) {
+    c = ref_write(buf, c, n, FRAME_RESERVED, 1);
+  }
+  uint8_t flags = header->response | header->acknowledgement << 1;
+  c = ref_write(buf, c, n, flags, 1);
+  c = ref_write(buf, c, n, header->sequence, 1);
+  c = ref_write(buf, c, n, FRAME_RESERVED, 8);
+  c = ref_write(buf, c, n, header->type, 2);
+  c = ref_write(buf, c, n, FRAME_RESERVED, 2);
+  return c;
+}
+
+static int ref_decode_header(lifx_header_t *header, const uint8_t *buf,
+                             int n) {
+  int c = 0;
+  header->size = ref_read(buf, &c, n, 2);
+  uint16_t protocol = ref_read(buf, &c, n, 2);
+  header->tagged = (protocol & (1 << 13)) > 0;
+  header->source = ref_read(buf, &c, n, 4);
+  for (int i = 0; i < 8; ++i) {
+    header->target[i] = ref_read(buf, &c, n, 1);
+  }
+  ref_read(buf, &c, n, 6);
+  uint8_t flags = ref_read(buf, &c, n, 1);
+  header->response = (flags & 1) != 0;
+  header->acknowledgement = (flags & (1 << 1)) != 0;
+  header->sequence = ref_read(buf, &c, n, 1);
+  ref_read(buf, &c, n, 8);
+  header->type = ref_read(buf, &c, n, 2);
+  ref_read(buf, &c, n, 2);
+  return c;
+}
+
+/*
+ * SetColor payload, byte at a time like the original payload encoders. Kept
+ * out of line so it pays the same call overhead as the library codec.
+ */
+__attribute__((noinline)) static int
+ref_encode_frame(const lifx_frame_t *frame, uint8_t *buf, int n) {
+  const lifx_set_color_payload_t *color = &frame->payload.set_color_payload;
+  int c = ref_encode_header(&frame->header, buf, n);
+  c = ref_write(buf, c, n, FRAME_RESERVED, 1);
+  c = ref_write(buf, c, n, color->hue, 2);
+  c = ref_write(buf, c, n, color->saturation, 2);
+  c = ref_write(buf, c, n, color->brightness, 2);
+  c = ref_write(buf, c, n, color->kelvin, 2);
+  c = ref_write(buf, c, n, color->duration, 4);
+  return c;
+}
+
+/* StateService payload, byte at a time like the original payload decoders */
+__attribute__((noinline)) static int
+ref_decode_frame(lifx_frame_t *frame, const uint8_t *buf, int n) {
+  int c = ref_decode_header(&frame->header, buf, n);
+  frame->payload.state_service_payload.service = ref_read(buf, &c, n, 1);
+  frame->payload.state_service_payload.port = ref_read(buf, &c, n, 4);
+  return c;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static lifx_frame_t sample_frame(uint32_t i) {
+  lifx_frame_t frame = {
+      .header =
+          {
+              .size = LIFX_FRAME_SIZE(SetColor),
+              .tagged = i & 1,
+              .source = 0x12345678 ^ i,
+              .target = {0xD0, 0x73, 0xD5, i >> 16, i >> 8, i, 0, 0},
+              .response = (i >> 1) & 1,
+              .acknowledgement = (i >> 2) & 1,
+              .sequence = i,
+              .type = SetColor,
+          },
+      .payload =
+          {
+              .set_color_payload =
+                  {
+                      .hue = i * 7,
+                      .saturation = 65535,
+                      .brightness = i * 3,
+                      .kelvin = 3500,
+                      .duration = i,
+                  },
+          },
+  };
+  return frame;
+}
+
+/* A frame of any message type, with every payload field set from i */
+static lifx_frame_t typed_frame(uint16_t type, uint32_t i) {
+  lifx_frame_t frame = sample_frame(i);
+  frame.header.type = type;
+  frame.header.size = lifx_frame_size(frame.header.type);
+  memset(&frame.payload, 0, sizeof(frame.payload));
+
+  lifx_payload_t *payload = &frame.payload;
+  switch (frame.header.type) {
+  case StateService:
+    payload->state_service_payload.service = UDP;
+    payload->state_service_payload.port = 56700 + (i & 0xff);
+    break;
+  case SetPower:
+    payload->set_power_payload.level = i & 1 ? 65535 : 0;
+    break;
+  case StatePower:
+    payload->state_power_payload.level = i & 1 ? 65535 : 0;
+    break;
+  case StateLabel:
+    snprintf((char *)payload->state_label_payload.label,
+             sizeof(payload->state_label_payload.label), "Light %u", i);
+    break;
+  case EchoRequest:
+    snprintf((char *)payload->echo_request_payload.echoing,
+             sizeof(payload->echo_request_payload.echoing), "echo %u", i);
+    break;
+  case EchoResponse:
+    snprintf((char *)payload->echo_response_payload.echoing,
+             sizeof(payload->echo_response_payload.echoing), "echo %u", i);
+    break;
+  case SetColor:
+    payload->set_color_payload = sample_frame(i).payload.set_color_payload;
+    break;
+  case LightState: {
+    lifx_set_color_payload_t color = sample_frame(i).payload.set_color_payload;
+    payload->light_state_payload.hue = color.hue;
+    payload->light_state_payload.saturation = color.saturation;
+    payload->light_state_payload.brightness = color.brightness;
+    payload->light_state_payload.kelvin = color.kelvin;
+    payload->light_state_payload.power = i & 1 ? 65535 : 0;
+    snprintf((char *)payload->light_state_payload.label,
+             sizeof(payload->light_state_payload.label), "Light %u", i);
+    break;
+  }
+  default:
+    break;
+  }
+  return frame;
+}
+
+static int headers_equal(const lifx_header_t *a, const lifx_header_t *b) {
+  return a->size == b->size && a->tagged == b->tagged &&
+         a->source == b->source &&
+         memcmp(a->target, b->target, sizeof(a->target)) == 0 &&
+         a->response == b->response &&
+         a->acknowledgement == b->acknowledgement &&
+         a->sequence == b->sequence && a->type == b->type;
+}
+
+static int verify(void) {
+  uint8_t fast[FRAME_SIZE_MAX];
+  uint8_t ref[FRAME_SIZE_MAX];
+  uint8_t *p = fast;
+
+  for (uint32_t i = 0; i < 4096; ++i) {
+    lifx_frame_t frame = sample_frame(i * 2654435761u);
+    if (lifx_encode_frame(&frame, &p, sizeof(fast)) == -1) {
+      fprintf(stderr, "failed to encode frame %u\n", i);
+      return -1;
+    }
+    int size = ref_encode_frame(&frame, ref, sizeof(ref));
+    if (memcmp(fast, ref, size) != 0) {
+      fprintf(stderr, "encoded header mismatch for frame %u\n", i);
+      return -1;
+    }
+
+    lifx_header_template_t tmpl;
+    lifx_encode_header_template(&tmpl, &frame.header);
+    size = lifx_encode_templated_frame(&tmpl, frame.header.sequence,
+                                       frame.header.type, &frame.payload, &p,
+                                       sizeof(fast));
+    if (size == -1 || memcmp(fast, ref, size) != 0) {
+      fprintf(stderr, "templated frame mismatch for frame %u\n", i);
+      return -1;
+    }
+
+    /* StateService is the payload both directions of the codec understand */
+    frame.header.type = StateService;
+    frame.header.size = LIFX_FRAME_SIZE(StateService);
+    frame.payload.state_service_payload.service = UDP;
+    frame.payload.state_service_payload.port = 56700;
+    size = lifx_encode_frame(&frame, &p, sizeof(fast));
+    lifx_frame_t decoded;
+    lifx_frame_t reference;
+    if (lifx_decode_frame(&decoded, &p, size) == -1) {
+      fprintf(stderr, "failed to decode frame %u\n", i);
+      return -1;
+    }
+    ref_decode_frame(&reference, fast, size);
+    if (!headers_equal(&decoded.header, &reference.header) ||
+        !headers_equal(&decoded.header, &frame.header)) {
+      fprintf(stderr, "decoded header mismatch for frame %u\n", i);
+      return -1;
+    }
+
+    /* Every type survives a round trip, payload included */
+    for (size_t t = 0; t < MESSAGE_TYPES; ++t) {
+      frame = typed_frame(message_types[t].type, i);
+      size = lifx_encode_frame(&frame, &p, sizeof(fast));
+      if (size != frame.header.size ||
+          lifx_decode_frame(&decoded, &p, size) == -1) {
+        fprintf(stderr, "failed to round trip %s frame %u\n",
+                message_types[t].name, i);
+        return -1;
+      }
+      uint8_t *r = ref;
+      if (!headers_equal(&decoded.header, &frame.header) ||
+          lifx_encode_frame(&decoded, &r, sizeof(ref)) != size ||
+          memcmp(fast, ref, size) != 0) {
+        fprintf(stderr, "%s frame %u changed in a round trip\n",
+                message_types[t].name, i);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* Pixels in and out of range, grey, primaries and every hue sextant */
+static void sample_pixels(float *rgb, size_t channels, size_t n) {
+  static const float edges[][4] = {
+      {1, 0, 0, 1},          {0, 1, 0, 1},      {0, 0, 1, 1},
+      {1, 1, 0, 1},          {0, 1, 1, 1},      {1, 0, 1, 1},
+      {0, 0, 0, 1},          {1, 1, 1, 0.5f},   {0.5f, 0.5f, 0.5f, 1},
+      {2, -1, 0.5f, 3},      {1, 0, 0.0001f, 1},
+  };
+  size_t edge_count = sizeof(edges) / sizeof(edges[0]);
+  uint32_t x = 2463534242u;
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t c = 0; c < channels; ++c) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      rgb[i * channels + c] =
+          i < edge_count ? edges[i][c] : (x >> 8) / (float)(1 << 23) - 0.25f;
+    }
+  }
+}
+
+/* The sample pixels as 8 bit channels, rounded */
+static void sample_bytes(uint8_t *bytes, const float *rgb, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    float x = rgb[i] < 0 ? 0 : rgb[i] > 1 ? 1 : rgb[i];
+    bytes[i] = x * 255 + 0.5f;
+  }
+}
+
+/* Every kernel the CPU runs converts like the scalar one, bit for bit, and
+ * 8 bit pixels like the float pixels they stand for */
+static int verify_colors(void) {
+  static const lifx_set_color_payload_t primaries[] = {
+      {0, 65535, 65535, 3500, 0},
+      {21845, 65535, 65535, 3500, 0},
+      {43691, 65535, 65535, 3500, 0},
+  };
+  float rgb[COLOR_PIXELS * 4];
+  uint8_t bytes[COLOR_PIXELS * 4];
+  float scaled[COLOR_PIXELS * 4];
+  lifx_set_color_payload_t expected[COLOR_PIXELS];
+  lifx_set_color_payload_t expected8[COLOR_PIXELS];
+  lifx_set_color_payload_t got[COLOR_PIXELS];
+
+  for (size_t channels = 3; channels <= 4; ++channels) {
+    size_t count = COLOR_PIXELS * channels;
+    sample_pixels(rgb, channels, COLOR_PIXELS);
+    sample_bytes(bytes, rgb, count);
+    for (size_t i = 0; i < count; ++i) {
+      scaled[i] = bytes[i] * (1.0f / 255);
+    }
+    lifx_color_from_rgb_kernel(LIFX_COLOR_SCALAR, rgb, channels, COLOR_PIXELS,
+                               3500, 0, expected);
+    lifx_color_from_rgb_kernel(LIFX_COLOR_SCALAR, scaled, channels,
+                               COLOR_PIXELS, 3500, 0, expected8);
+    for (size_t i = 0; i < 3; ++i) {
+      if (memcmp(&expected[i], &primaries[i], sizeof(primaries[i])) != 0) {
+        fprintf(stderr, "primary %zu converted to %u %u %u\n", i,
+                expected[i].hue, expected[i].saturation,
+                expected[i].brightness);
+        return -1;
+      }
+    }
+
+    for (int k = LIFX_COLOR_SCALAR; k <= LIFX_COLOR_AVX2; ++k) {
+      if (!lifx_color_kernel_supported(k)) {
+        continue;
+      }
+      /* Odd lengths take the scalar tail of the vector kernels as well */
+      for (size_t n = COLOR_PIXELS - 13; n <= COLOR_PIXELS; n += 13) {
+        memset(got, 0, sizeof(got));
+        lifx_color_from_rgb_kernel(k, rgb, channels, n, 3500, 0, got);
+        if (memcmp(got, expected, n * sizeof(got[0])) != 0) {
+          fprintf(stderr, "%s kernel disagrees with scalar on %zu pixels\n",
+                  lifx_color_kernel_name(k), n);
+          return -1;
+        }
+        memset(got, 0, sizeof(got));
+        lifx_color_from_rgb8_kernel(k, bytes, channels, n, 3500, 0, got);
+        if (memcmp(got, expected8, n * sizeof(got[0])) != 0) {
+          fprintf(stderr,
+                  "%s kernel disagrees with scalar on %zu 8 bit pixels\n",
+                  lifx_color_kernel_name(k), n);
+          return -1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+static volatile uint32_t sink;
+static int json;
+static size_t iterations = ITERATIONS;
+
+/* Print one result, as a table row or as a JSON line */
+static void report(const char *bench, const char *type, const char *cache,
+                   double start, double end, size_t ops) {
+  double ns = (end - start) / ops;
+  if (json) {
+    printf("{\"bench\":\"%s\",\"type\":\"%s\",\"cache\":\"%s\",\"ops\":%zu,"
+           "\"ns_per_op\":%.3f,\"frames_per_sec\":%.0f}\n",
+           bench, type, cache, ops, ns, 1e9 / ns);
+    return;
+  }
+  printf("%-16s %-16s %-5s %8.2f ns/op %12.0f frames/s\n", bench, type, cache,
+         ns, 1e9 / ns);
+}
+
+/*
+ * Frames and buffers for cold cache runs. They are visited in a random order
+ * so neither the caches nor the prefetcher help.
+ */
+typedef struct {
+  lifx_frame_t *frames;
+  uint8_t *bufs;    /* COLD_FRAMES buffers of FRAME_SIZE_MAX bytes */
+  uint32_t *order;  /* permutation of the frames */
+  uint8_t *scratch; /* walked over to push the frames out of the caches */
+  size_t scratch_size;
+} cold_t;
+
+static int cold_init(cold_t *cold) {
+  cold->frames = calloc(COLD_FRAMES, sizeof(*cold->frames));
+  cold->bufs = calloc(COLD_FRAMES, FRAME_SIZE_MAX);
+  cold->order = calloc(COLD_FRAMES, sizeof(*cold->order));
+  cold->scratch_size = 64 << 20;
+  cold->scratch = calloc(cold->scratch_size, 1);
+  if (cold->frames == NULL || cold->bufs == NULL || cold->order == NULL ||
+      cold->scratch == NULL) {
+    return -1;
+  }
+  /* Fault the pages in now rather than in the first timed run */
+  memset(cold->bufs, 0xff, (size_t)COLD_FRAMES * FRAME_SIZE_MAX);
+
+  uint64_t x = 0x9E3779B97F4A7C15;
+  for (uint32_t i = 0; i < COLD_FRAMES; ++i) {
+    cold->order[i] = i;
+  }
+  for (uint32_t i = COLD_FRAMES - 1; i > 0; --i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    uint32_t j = x % (i + 1);
+    uint32_t t = cold->order[i];
+    cold->order[i] = cold->order[j];
+    cold->order[j] = t;
+  }
+  return 0;
+}
+
+static void cold_free(cold_t *cold) {
+  free(cold->frames);
+  free(cold->bufs);
+  free(cold->order);
+  free(cold->scratch);
+}
+
+static void cold_evict(cold_t *cold) {
+  for (size_t i = 0; i < cold->scratch_size; i += 64) {
+    cold->scratch[i]++;
+  }
+}
+
+static void bench_type(cold_t *cold, size_t type) {
+  const char *name = message_types[type].name;
+  uint8_t buf[FRAME_SIZE_MAX];
+  uint8_t *p = buf;
+  lifx_frame_t frame = typed_frame(message_types[type].type, 42);
+  lifx_frame_t decoded;
+  double start, end;
+
+  start = now_ns();
+  for (uint32_t i = 0; i < iterations; ++i) {
+    frame.header.sequence = i;
+    lifx_encode_frame(&frame, &p, sizeof(buf));
+    sink += buf[LIFX_OFFSET_SEQUENCE];
+  }
+  end = now_ns();
+  report("encode", name, "warm", start, end, iterations);
+
+  int size = lifx_encode_frame(&frame, &p, sizeof(buf));
+  start = now_ns();
+  for (uint32_t i = 0; i < iterations; ++i) {
+    buf[LIFX_OFFSET_SEQUENCE] = i;
+    lifx_decode_frame(&decoded, &p, size);
+    sink += decoded.header.sequence;
+  }
+  end = now_ns();
+  report("decode", name, "warm", start, end, iterations);
+
+  for (uint32_t i = 0; i < COLD_FRAMES; ++i) {
+    cold->frames[i] = typed_frame(message_types[type].type, i);
+  }
+  cold_evict(cold);
+  start = now_ns();
+  for (uint32_t i = 0; i < COLD_FRAMES; ++i) {
+    uint32_t j = cold->order[i];
+    uint8_t *q = cold->bufs + (size_t)j * FRAME_SIZE_MAX;
+    lifx_encode_frame(&cold->frames[j], &q, FRAME_SIZE_MAX);
+    sink += q[LIFX_OFFSET_SEQUENCE];
+  }
+  end = now_ns();
+  report("encode", name, "cold", start, end, COLD_FRAMES);
+
+  cold_evict(cold);
+  start = now_ns();
+  for (uint32_t i = 0; i < COLD_FRAMES; ++i) {
+    uint32_t j = cold->order[i];
+    uint8_t *q = cold->bufs + (size_t)j * FRAME_SIZE_MAX;
+    lifx_decode_frame(&cold->frames[j], &q, size);
+    sink += cold->frames[j].header.sequence;
+  }
+  end = now_ns();
+  report("decode", name, "cold", start, end, COLD_FRAMES);
+}
+
+/* The original byte at a time codec and the header template, on SetColor */
+static void bench_reference(void) {
+  uint8_t buf[FRAME_SIZE_MAX];
+  uint8_t *p = buf;
+  lifx_frame_t frame = sample_frame(42);
+  double start, end;
+
+  start = now_ns();
+  for (uint32_t i = 0; i < iterations; ++i) {
+    frame.header.sequence = i;
+    ref_encode_frame(&frame, buf, sizeof(buf));
+    sink += buf[LIFX_OFFSET_SEQUENCE];
+  }
+  end = now_ns();
+  report("encode-bytes", "SetColor", "warm", start, end, iterations);
+
+  lifx_header_template_t tmpl;
+  lifx_encode_header_template(&tmpl, &frame.header);
+  start = now_ns();
+  for (uint32_t i = 0; i < iterations; ++i) {
+    lifx_encode_templated_frame(&tmpl, i, SetColor, &frame.payload, &p,
+                                sizeof(buf));
+    sink += buf[LIFX_OFFSET_SEQUENCE];
+  }
+  end = now_ns();
+  report("encode-template", "SetColor", "warm", start, end, iterations);
+
+  frame.header.type = StateService;
+  frame.header.size = LIFX_FRAME_SIZE(StateService);
+  int size = lifx_encode_frame(&frame, &p, sizeof(buf));
+  lifx_frame_t decoded;
+
+  start = now_ns();
+  for (uint32_t i = 0; i < iterations; ++i) {
+    buf[LIFX_OFFSET_SEQUENCE] = i;
+    ref_decode_frame(&decoded, buf, size);
+    sink += decoded.header.sequence;
+  }
+  end = now_ns();
+  report("decode-bytes", "StateService", "warm", start, end, iterations);
+}
+
+/* Encoding a whole sendmmsg batch at a time, per frame */
+static int bench_batch(void) {
+  lifx_batch_t batch;
+  if (lifx_batch_init(&batch, BATCH_FRAMES) == -1) {
+    return -1;
+  }
+
+  lifx_frame_t frames[BATCH_FRAMES];
+  for (uint32_t i = 0; i < BATCH_FRAMES; ++i) {
+    frames[i] = sample_frame(i);
+  }
+  size_t rounds = iterations / BATCH_FRAMES;
+  double start, end;
+
+  start = now_ns();
+  for (size_t r = 0; r < rounds; ++r) {
+    lifx_batch_reset(&batch);
+    lifx_batch_encode(&batch, frames, NULL, BATCH_FRAMES);
+    sink += batch.arena[LIFX_OFFSET_SEQUENCE];
+  }
+  end = now_ns();
+  report("batch-encode", "SetColor", "warm", start, end,
+         rounds * BATCH_FRAMES);
+
+  lifx_header_template_t tmpl;
+  lifx_encode_header_template(&tmpl, &frames[0].header);
+  start = now_ns();
+  for (size_t r = 0; r < rounds; ++r) {
+    lifx_batch_reset(&batch);
+    for (uint32_t i = 0; i < BATCH_FRAMES; ++i) {
+      lifx_batch_add_templated(&batch, &tmpl, i, SetColor,
+                               &frames[i].payload, NULL);
+    }
+    sink += batch.arena[LIFX_OFFSET_SEQUENCE];
+  }
+  end = now_ns();
+  report("batch-template", "SetColor", "warm", start, end,
+         rounds * BATCH_FRAMES);
+
+  lifx_batch_free(&batch);
+  return 0;
+}
+
+/* RGB to SetColor payloads per kernel, then straight into a batch */
+static int bench_color(void) {
+  float *rgb = malloc(COLOR_PIXELS * 4 * sizeof(*rgb));
+  uint8_t *bytes = malloc(COLOR_PIXELS * 4);
+  lifx_set_color_payload_t *colors = malloc(COLOR_PIXELS * sizeof(*colors));
+  lifx_header_template_t *tmpls = malloc(COLOR_PIXELS * sizeof(*tmpls));
+  lifx_batch_t batch;
+  if (rgb == NULL || bytes == NULL || colors == NULL || tmpls == NULL ||
+      lifx_batch_init(&batch, COLOR_PIXELS) == -1) {
+    free(rgb);
+    free(bytes);
+    free(colors);
+    free(tmpls);
+    return -1;
+  }
+  size_t rounds = iterations / COLOR_PIXELS;
+  double start, end;
+
+  for (size_t channels = 3; channels <= 4; ++channels) {
+    sample_pixels(rgb, channels, COLOR_PIXELS);
+    sample_bytes(bytes, rgb, COLOR_PIXELS * channels);
+    for (int k = LIFX_COLOR_SCALAR; k <= LIFX_COLOR_AVX2; ++k) {
+      if (!lifx_color_kernel_supported(k)) {
+        continue;
+      }
+      start = now_ns();
+      for (size_t r = 0; r < rounds; ++r) {
+        lifx_color_from_rgb_kernel(k, rgb, channels, COLOR_PIXELS, 3500, 0,
+                                   colors);
+        sink += colors[r % COLOR_PIXELS].hue;
+      }
+      end = now_ns();
+      report(channels == 3 ? "rgb-to-hsbk" : "rgba-to-hsbk",
+             lifx_color_kernel_name(k), "warm", start, end,
+             rounds * COLOR_PIXELS);
+
+      start = now_ns();
+      for (size_t r = 0; r < rounds; ++r) {
+        lifx_color_from_rgb8_kernel(k, bytes, channels, COLOR_PIXELS, 3500, 0,
+                                    colors);
+        sink += colors[r % COLOR_PIXELS].hue;
+      }
+      end = now_ns();
+      report(channels == 3 ? "rgb8-to-hsbk" : "rgba8-to-hsbk",
+             lifx_color_kernel_name(k), "warm", start, end,
+             rounds * COLOR_PIXELS);
+    }
+  }
+
+  for (uint32_t i = 0; i < COLOR_PIXELS; ++i) {
+    lifx_frame_t frame = sample_frame(i);
+    lifx_encode_header_template(&tmpls[i], &frame.header);
+  }
+  start = now_ns();
+  for (size_t r = 0; r < rounds; ++r) {
+    lifx_batch_reset(&batch);
+    lifx_color_from_rgb(rgb, 4, COLOR_PIXELS, 3500, 0, colors);
+    lifx_batch_add_colors(&batch, tmpls, r, colors, NULL, COLOR_PIXELS);
+    sink += batch.arena[LIFX_OFFSET_SEQUENCE];
+  }
+  end = now_ns();
+  report("rgba-to-batch", lifx_color_kernel_name(lifx_color_kernel_best()),
+         "warm", start, end, rounds * COLOR_PIXELS);
+
+  lifx_batch_free(&batch);
+  free(tmpls);
+  free(colors);
+  free(bytes);
+  free(rgb);
+  return 0;
+}
+
+/* Zero copy reads, what a reply router needs: type, source and sequence */
+static int bench_view(cold_t *cold) {
+  uint8_t buf[FRAME_SIZE_MAX];
+  uint8_t *p = buf;
+  lifx_frame_t frame = typed_frame(StateService, 42);
+  int size = lifx_encode_frame(&frame, &p, sizeof(buf));
+  lifx_frame_view_t view;
+  lifx_frame_t decoded;
+  double start, end;
+  /* The loops below only time views of this frame, it has to be valid */
+  if (size <= 0 || lifx_view_init(&view, buf, size) == -1) {
+    return -1;
+  }
+
+  start = now_ns();
+  for (uint32_t i = 0; i < iterations; ++i) {
+    buf[LIFX_OFFSET_SEQUENCE] = i;
+    lifx_view_init(&view, buf, size);
+    sink += lifx_view_type(&view) + lifx_view_source(&view) +
+            lifx_view_sequence(&view);
+  }
+  end = now_ns();
+  report("view-route", "StateService", "warm", start, end, iterations);
+
+  start = now_ns();
+  for (uint32_t i = 0; i < iterations; ++i) {
+    buf[LIFX_OFFSET_SEQUENCE] = i;
+    lifx_view_init(&view, buf, size);
+    lifx_view_decode(&view, &decoded);
+    sink += decoded.header.sequence;
+  }
+  end = now_ns();
+  report("view-decode", "StateService", "warm", start, end, iterations);
+
+  for (uint32_t i = 0; i < COLD_FRAMES; ++i) {
+    frame = typed_frame(StateService, i);
+    uint8_t *q = cold->bufs + (size_t)i * FRAME_SIZE_MAX;
+    if (lifx_encode_frame(&frame, &q, FRAME_SIZE_MAX) != size) {
+      return -1;
+    }
+  }
+  cold_evict(cold);
+  start = now_ns();
+  for (uint32_t i = 0; i < COLD_FRAMES; ++i) {
+    const uint8_t *q = cold->bufs + (size_t)cold->order[i] * FRAME_SIZE_MAX;
+    lifx_view_init(&view, q, size);
+    sink += lifx_view_type(&view) + lifx_view_source(&view) +
+            lifx_view_sequence(&view);
+  }
+  end = now_ns();
+  report("view-route", "StateService", "cold", start, end, COLD_FRAMES);
+  return 0;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-j] [-n ITERATIONS]\n\n"
+          "\t-j  print one JSON object per result instead of a table\n"
+          "\t-n  iterations of every warm cache run, at least %d, defaults "
+          "to %d\n",
+          name, COLOR_PIXELS, ITERATIONS);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "jn:h")) != -1) {
+    switch (opt) {
+    case 'j':
+      json = 1;
+      break;
+    case 'n':
+      iterations = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+      exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+  /* Batched runs go by whole batches, the largest being COLOR_PIXELS */
+  if (iterations < COLOR_PIXELS) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (verify() == -1 || verify_colors() == -1) {
+    exit(EXIT_FAILURE);
+  }
+  if (!json) {
+    printf("reference and library codecs agree, so do the color kernels up "
+           "to %s\n\n",
+           lifx_color_kernel_name(lifx_color_kernel_best()));
+  }
+
+  cold_t cold;
+  if (cold_init(&cold) == -1) {
+    fprintf(stderr, "failed to allocate cold cache frames\n");
+    exit(EXIT_FAILURE);
+  }
+
+  bench_reference();
+  for (size_t type = 0; type < MESSAGE_TYPES; ++type) {
+    bench_type(&cold, type);
+  }
+  if (bench_batch() == -1) {
+    fprintf(stderr, "failed to allocate batch\n");
+    exit(EXIT_FAILURE);
+  }
+  if (bench_view(&cold) == -1) {
+    fprintf(stderr, "failed to encode a StateService to view\n");
+    exit(EXIT_FAILURE);
+  }
+  if (bench_color() == -1) {
+    fprintf(stderr, "failed to allocate pixels\n");
+    exit(EXIT_FAILURE);
+  }
+
+  cold_free(&cold);
+  return 0;
+}
@@ -0,0 +1,127 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "registry.h"
+#include "shm.h"
+
+#define MAX_DEVICES 1024
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-s PATH] COMMAND\n\n"
+          "\t-s  shared segment of lifxd, defaults to %s\n\n"
+          "Where COMMAND is one of\n"
+          "\tlist                               devices lifxd knows\n"
+          "\tpower TARGET on|off\n"
+          "\tcolor TARGET HUE SAT BRI KELVIN [MS]\n",
+          name, LIFX_SHM_PATH_DEFAULT);
+}
+
+/* Target as printed by list, 16 hexadecimal digits */
+static int target_parse(const char *text, uint8_t target[8]) {
+  if (strlen(text) != 16) {
+    return -1;
+  }
+  for (int i = 0; i < 8; ++i) {
+    unsigned byte;
+    if (sscanf(text + i * 2, "%2x", &byte) != 1) {
+      return -1;
+    }
+    target[i] = byte;
+  }
+  return 0;
+}
+
+static int list(const lifx_shm_t *shm) {
+  lifx_device_t *devices = calloc(MAX_DEVICES, sizeof(*devices));
+  if (devices == NULL) {
+    fprintf(stderr, "failed to allocate devices\n");
+    return -1;
+  }
+
+  int count = lifx_shm_devices(shm, devices, MAX_DEVICES);
+  if (count == -1) {
+    perror("devices");
+    free(devices);
+    return -1;
+  }
+  for (int i = 0; i < count; ++i) {
+    char ip[INET_ADDRSTRLEN] = {0};
+    for (int j = 0; j < 8; ++j) {
+      printf("%02X", devices[i].target[j]);
+    }
+    printf(" %s:%d %s\n",
+           inet_ntop(AF_INET, &devices[i].addr.sin_addr, ip,
+                     INET_ADDRSTRLEN),
+           ntohs(devices[i].addr.sin_port), devices[i].label);
+  }
+  printf("%d devices\n", count);
+
+  free(devices);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *path = LIFX_SHM_PATH_DEFAULT;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "+s:h")) != -1) {
+    switch (opt) {
+    case 's':
+      path = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  const char *command = argv[optind];
+  int args = argc - optind - 1;
+  char **arg = argv + optind + 1;
+
+  lifx_shm_t shm;
+  if (lifx_shm_open(&shm, path) == -1) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+
+  int res = 0;
+  uint8_t target[8];
+  if (strcmp(command, "list") == 0 && args == 0) {
+    res = list(&shm);
+  } else if (strcmp(command, "power") == 0 && args == 2 &&
+             target_parse(arg[0], target) == 0 &&
+             (strcmp(arg[1], "on") == 0 || strcmp(arg[1], "off") == 0)) {
+    lifx_set_power_payload_t payload = {
+        .level = strcmp(arg[1], "on") == 0 ? 65535 : 0,
+    };
+    res = lifx_shm_set_power(&shm, target, &payload);
+  } else if (strcmp(command, "color") == 0 && (args == 5 || args == 6) &&
+             target_parse(arg[0], target) == 0) {
+    lifx_set_color_payload_t payload = {
+        .hue = strtoul(arg[1], NULL, 10),
+        .saturation = strtoul(arg[2], NULL, 10),
+        .brightness = strtoul(arg[3], NULL, 10),
+        .kelvin = strtoul(arg[4], NULL, 10),
+        .duration = args == 6 ? strtoul(arg[5], NULL, 10) : 0,
+    };
+    res = lifx_shm_set_color(&shm, target, &payload);
+  } else {
+    lifx_shm_close(&shm);
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (res == -1) {
+    perror(command);
+  }
+
+  lifx_shm_close(&shm);
+  return res == -1 ? EXIT_FAILURE : 0;
+}
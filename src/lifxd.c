@@ -0,0 +1,374 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "cache.h"
+#include "discovery.h"
+#include "io.h"
+#include "registry.h"
+#include "scheduler.h"
+#include "shm.h"
+
+#define PORT 56700
+#define MAX_DEVICES 1024
+#define RING_CELLS 4096
+#define RECV_DEPTH 64
+#define BATCH_DEPTH 64
+#define REDISCOVER 60 /* seconds between discovery rounds */
+/* Milliseconds a device only seen again waits to be published, new devices
+ * and labels are published right away */
+#define PUBLISH_INTERVAL 100
+/* Milliseconds at most to wait for a full socket to take frames again */
+#define SEND_WAIT 10
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int signal) {
+  (void)signal;
+  stop = 1;
+}
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-s PATH] [-c CACHE] [-e EXPECTED] [-i SECONDS] "
+          "[-r RATE] [-b BURST]\n"
+          "          [-o BACKEND]\n\n"
+          "\t-s  shared segment clients attach to, defaults to %s\n"
+          "\t-c  device cache to start from and update\n"
+          "\t-e  stop the first discovery once this many devices answered\n"
+          "\t-i  seconds between discovery rounds, defaults to %d\n"
+          "\t-r  frames per second per device, defaults to %d\n"
+          "\t-b  frames a device may receive back to back, defaults to %d\n"
+          "\t-o  socket I/O, auto, epoll or io_uring, defaults to auto\n",
+          name, LIFX_SHM_PATH_DEFAULT, REDISCOVER,
+          LIFX_SCHEDULER_RATE_DEFAULT, LIFX_SCHEDULER_BURST_DEFAULT);
+}
+
+typedef struct {
+  lifx_io_t *io;
+  lifx_batch_t *batch;
+} sender_t;
+
+/* Send what is batched, returns -1 when the socket is full or failed */
+static int sender_flush(sender_t *sender) {
+  if (lifx_io_send(sender->io, sender->batch) == -1) {
+    return -1;
+  }
+  if (sender->batch->sent < sender->batch->count) {
+    return -1;
+  }
+  lifx_batch_reset(sender->batch);
+  return 0;
+}
+
+/* lifx_scheduler_emit batching frames for lifx_io_send */
+static int sender_emit(void *ctx, const lifx_frame_t *frame,
+                       const struct sockaddr_in *addr) {
+  sender_t *sender = ctx;
+  if (sender->batch->count == sender->batch->capacity &&
+      sender_flush(sender) == -1) {
+    return -1;
+  }
+  /* A frame that does not encode is dropped rather than stall its device */
+  lifx_batch_add(sender->batch, frame, addr);
+  return 0;
+}
+
+static void device_print(const lifx_device_t *device, void *ctx) {
+  (void)ctx;
+  char ip[INET_ADDRSTRLEN] = {0};
+  for (int i = 0; i < 8; ++i) {
+    printf("%02X", device->target[i]);
+  }
+  printf(" %s:%d\n",
+         inet_ntop(AF_INET, &device->addr.sin_addr, ip, INET_ADDRSTRLEN),
+         ntohs(device->addr.sin_port));
+}
+
+/* Ask a device for its label, clients see it once the reply comes in */
+static void label_request(lifx_scheduler_t *scheduler,
+                          const lifx_device_t *device, uint32_t source,
+                          uint64_t now) {
+  lifx_frame_t frame = {
+      .header =
+          {
+              .source = source,
+              .type = GetLabel,
+          },
+  };
+  memcpy(frame.header.target, device->target, sizeof(device->target));
+  lifx_scheduler_submit(scheduler, &frame, &device->addr, now);
+}
+
+int main(int argc, char **argv) {
+  const char *path = LIFX_SHM_PATH_DEFAULT;
+  const char *cache = NULL;
+  uint32_t expected = 0;
+  uint64_t rediscover = REDISCOVER;
+  uint32_t rate = LIFX_SCHEDULER_RATE_DEFAULT;
+  uint32_t burst = LIFX_SCHEDULER_BURST_DEFAULT;
+  lifx_io_backend backend = LIFX_IO_AUTO;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:c:e:i:r:b:o:h")) != -1) {
+    switch (opt) {
+    case 's':
+      path = optarg;
+      break;
+    case 'c':
+      cache = optarg;
+      break;
+    case 'e':
+      expected = strtoul(optarg, NULL, 10);
+      break;
+    case 'i':
+      rediscover = strtoull(optarg, NULL, 10);
+      break;
+    case 'r':
+      rate = strtoul(optarg, NULL, 10);
+      break;
+    case 'b':
+      burst = strtoul(optarg, NULL, 10);
+      break;
+    case 'o':
+      if (lifx_io_backend_parse(optarg, &backend) == -1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    default:
+      usage(argv[0]);
+      exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+  if (rediscover == 0 || rate == 0 || burst == 0) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  lifx_registry_t registry;
+  lifx_scheduler_t scheduler;
+  lifx_batch_t batch;
+  if (lifx_registry_init(&registry, MAX_DEVICES) == -1 ||
+      lifx_scheduler_init(&scheduler, MAX_DEVICES, rate, burst) == -1 ||
+      lifx_batch_init(&batch, BATCH_DEPTH) == -1) {
+    fprintf(stderr, "failed to allocate daemon state\n");
+    exit(EXIT_FAILURE);
+  }
+  if (cache != NULL) {
+    int loaded = lifx_cache_load(&registry, cache);
+    if (loaded == -1) {
+      printf("no usable cache at %s\n", cache);
+    } else {
+      printf("loaded %d cached devices\n", loaded);
+    }
+  }
+
+  lifx_shm_t shm;
+  if (lifx_shm_create(&shm, path, RING_CELLS, MAX_DEVICES) == -1) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  lifx_shm_publish(&shm, &registry);
+
+  uint32_t source = getpid() | 1;
+  lifx_discovery_config_t config;
+  lifx_discovery_config_init(&config);
+  config.source = source;
+  config.port = PORT;
+  config.expected = expected;
+  config.backend = backend;
+  config.callback = device_print;
+  config.refresh = rediscover * 1000;
+  config.stale = config.refresh;
+  config.dead = config.refresh * 3;
+  if (lifx_discover(&registry, &config) == -1) {
+    perror("discover");
+    lifx_shm_destroy(&shm);
+    exit(EXIT_FAILURE);
+  }
+  lifx_shm_publish(&shm, &registry);
+  size_t cursor = 0;
+  const lifx_device_t *known;
+  while ((known = lifx_registry_next(&registry, &cursor)) != NULL) {
+    if (!(known->flags & LIFX_DEVICE_LABEL)) {
+      label_request(&scheduler, known, source, now_ms());
+    }
+  }
+
+  int sfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  int yes = 1;
+  if (sfd == -1 ||
+      setsockopt(sfd, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes)) == -1) {
+    perror("socket");
+    lifx_shm_destroy(&shm);
+    exit(EXIT_FAILURE);
+  }
+  lifx_io_t io;
+  if (lifx_io_init(&io, sfd, RECV_DEPTH, backend) == -1 ||
+      lifx_io_watch(&io, lifx_shm_fd(&shm)) == -1) {
+    perror("io");
+    lifx_shm_destroy(&shm);
+    exit(EXIT_FAILURE);
+  }
+  sender_t sender = {
+      .io = &io,
+      .batch = &batch,
+  };
+
+  lifx_discovery_t discovery;
+  lifx_discovery_init(&discovery, &config, now_ms());
+
+  struct sigaction action = {0};
+  action.sa_handler = on_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  printf("serving %zu devices on %s using %s, interrupt to stop\n",
+         registry.count, path, lifx_io_backend_name(io.backend));
+
+  uint64_t taken = 0;
+  uint64_t published = 0;
+  int dirty = 0;
+  while (!stop) {
+    uint64_t now = now_ms();
+
+    /* Devices move, new ones show up and others go away, keep asking */
+    int removed =
+        lifx_discovery_step(&discovery, &registry, now, sender_emit, &sender);
+    if (removed > 0) {
+      printf("removed %d devices gone for %llu seconds\n", removed,
+             (unsigned long long)rediscover * 3);
+      lifx_shm_publish(&shm, &registry);
+      published = now;
+      dirty = 0;
+    }
+
+    /* Frames of every client share the per device queues and limits */
+    lifx_frame_t frame;
+    while (lifx_shm_take(&shm, &frame)) {
+      taken++;
+      const lifx_device_t *device =
+          lifx_registry_find(&registry, frame.header.target);
+      if (device == NULL) {
+        __atomic_add_fetch(&shm.header->unknown, 1, __ATOMIC_RELAXED);
+        continue;
+      }
+      frame.header.source = source;
+      lifx_scheduler_submit(&scheduler, &frame, &device->addr, now);
+    }
+
+    if (lifx_scheduler_run(&scheduler, now, sender_emit, &sender) == -1 ||
+        lifx_io_send(&io, &batch) == -1) {
+      perror("send");
+      break;
+    }
+    if (batch.sent == batch.count) {
+      lifx_batch_reset(&batch);
+    }
+
+    if (dirty && now >= published + PUBLISH_INTERVAL) {
+      lifx_shm_publish(&shm, &registry);
+      published = now;
+      dirty = 0;
+    }
+
+    int64_t timeout = lifx_discovery_next(&discovery, now);
+    int64_t next = lifx_scheduler_next(&scheduler, now);
+    if (next != -1 && next < timeout) {
+      timeout = next;
+    }
+    if (dirty && published + PUBLISH_INTERVAL - now < (uint64_t)timeout) {
+      timeout = published + PUBLISH_INTERVAL - now;
+    }
+    /* Clients only ring the doorbell once the daemon is about to sleep */
+    int armed = 0;
+    if (lifx_shm_arm(&shm)) {
+      timeout = 0;
+    } else {
+      armed = 1;
+    }
+    /* The socket is full, nothing can be sent before it drains. Sleep until
+     * it does instead of retrying, replies wait in the socket meanwhile. */
+    if (batch.count > 0 && armed) {
+      struct pollfd pfds[] = {
+          {.fd = sfd, .events = POLLOUT},
+          {.fd = lifx_shm_fd(&shm), .events = POLLIN},
+      };
+      if (poll(pfds, 2, SEND_WAIT) == -1 && errno != EINTR) {
+        perror("poll");
+        break;
+      }
+      timeout = 0;
+    }
+
+    int count = lifx_io_recv(&io, timeout);
+    if (armed) {
+      lifx_shm_wake(&shm);
+    }
+    if (count == -1) {
+      perror("recv");
+      break;
+    }
+
+    int changed = 0;
+    for (int i = 0; i < count; ++i) {
+      const lifx_frame_view_t *view = &io.views[i];
+      lifx_frame_t reply;
+      if (io.addrs[i].ss_family != AF_INET ||
+          lifx_view_decode(view, &reply) == -1) {
+        continue;
+      }
+      int res = lifx_registry_observe(&registry, &reply,
+                                      (struct sockaddr_in *)&io.addrs[i],
+                                      lifx_registry_now());
+      if (res == 1) {
+        lifx_device_t *device =
+            lifx_registry_find(&registry, reply.header.target);
+        label_request(&scheduler, device, source, now);
+        device_print(device, NULL);
+      }
+      changed |= res == 1 || reply.header.type == StateLabel;
+      dirty = 1;
+    }
+    if (changed) {
+      lifx_shm_publish(&shm, &registry);
+      published = now_ms();
+      dirty = 0;
+    }
+  }
+
+  printf("\n%llu frames from clients, %llu for unknown devices, %llu refused "
+         "while full\n",
+         (unsigned long long)taken, (unsigned long long)shm.header->unknown,
+         (unsigned long long)shm.header->full);
+  printf("%llu sent, %llu coalesced, %llu dropped\n",
+         (unsigned long long)scheduler.stats.emitted,
+         (unsigned long long)scheduler.stats.coalesced,
+         (unsigned long long)scheduler.stats.dropped);
+
+  if (cache != NULL && lifx_cache_save(&registry, cache) == -1) {
+    perror("failed to save cache");
+  }
+  lifx_shm_destroy(&shm);
+  lifx_io_free(&io);
+  close(sfd);
+  lifx_batch_free(&batch);
+  lifx_scheduler_free(&scheduler);
+  lifx_registry_free(&registry);
+  return 0;
+}
@@ -66,7 +66,6 @@ int main(int argc, char **argv) {
 
   char *ip = argv[1];
   /* lifx_header_t header = { */
-  /*     .size = FRAME_HEADER_SIZE + 2, */
   /*     .tagged = 0, */
   /*     .source = 1234, */
   /*     .target = {0xD0, 0x73, 0xD5, 0x30, 0x9D, 0x57, 0, 0}, */
@@ -83,7 +82,6 @@ int main(int argc, char **argv) {
   /* }; */
 
   /* lifx_header_t header = { */
-  /*     .size = FRAME_HEADER_SIZE + 13, */
   /*     .tagged = 0, */
   /*     .source = 1234, */
   /*     .target = {0xD0, 0x73, 0xD5, 0x30, 0x9D, 0x57, 0, 0}, */
@@ -104,7 +102,6 @@ int main(int argc, char **argv) {
   /* }; */
 
   /* lifx_header_t header = { */
-  /*     .size = FRAME_HEADER_SIZE, */
   /*     .tagged = 0, */
   /*     .source = 1234, */
   /*     .target = {0xD0, 0x73, 0xD5, 0x30, 0x9D, 0x57, 0, 0}, */
@@ -116,7 +113,6 @@ int main(int argc, char **argv) {
   /* lifx_payload_t payload = {0}; */
 
   lifx_header_t header = {
-      .size = FRAME_HEADER_SIZE + 64,
       .tagged = 0,
       .source = 1234,
       .target = {0xD0, 0x73, 0xD5, 0x30, 0x9D, 0x57, 0, 0},
@@ -137,10 +133,10 @@ int main(int argc, char **argv) {
       .payload = payload,
   };
 
-  uint8_t p[header.size];
+  uint8_t p[LIFX_FRAME_SIZE(EchoRequest)];
   uint8_t *packet = p;
 
-  int size = lifx_encode_frame(&frame, &packet, header.size);
+  int size = lifx_encode_frame(&frame, &packet, sizeof(p));
   if (size == -1) {
     fprintf(stderr, "failed to encode frame\n");
     exit(EXIT_FAILURE);
@@ -180,7 +176,7 @@ int main(int argc, char **argv) {
     exit(EXIT_FAILURE);
   }
 
-  if (sendto(sfd, packet, frame.header.size, 0, (struct sockaddr *)&addr,
+  if (sendto(sfd, packet, size, 0, (struct sockaddr *)&addr,
              sizeof(addr)) == -1) {
     perror("sendto");
     close(sfd);
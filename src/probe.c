@@ -0,0 +1,363 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "cache.h"
+#include "discovery.h"
+#include "histogram.h"
+#include "receiver.h"
+#include "registry.h"
+#include "wire.h"
+
+#define PORT 56700
+#define MAX_DEVICES 1024
+#define INTERVAL 1000
+#define TIMEOUT 1000
+#define RECV_DEPTH 64
+#define BATCH_DEPTH 64
+
+/*
+ * What a probe carries in the echoing payload. The device sends it back
+ * untouched, so the reply says when and to whom its request went out.
+ */
+#define PROBE_MAGIC "LIFXPRB1"
+#define PROBE_OFFSET_SLOT 8   /* u32, index of the device in the table */
+#define PROBE_OFFSET_ROUND 12 /* u32, round the request was sent in */
+#define PROBE_OFFSET_SENT 16  /* u64, CLOCK_MONOTONIC nanoseconds */
+
+typedef struct {
+  uint8_t target[8];
+  struct sockaddr_in addr;
+  uint8_t label[33];
+  uint32_t answered;    /* last round answered, rounds count from 1 */
+  uint64_t sent;        /* requests sent */
+  uint64_t received;    /* first replies to a request */
+  uint64_t stale;       /* duplicate replies and replies to older rounds */
+  lifx_histogram_t rtt; /* nanoseconds */
+} probe_device_t;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int signal) {
+  (void)signal;
+  stop = 1;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-c CACHE] [-x] [-e EXPECTED] [-i MS] [-r ROUNDS] "
+          "[-t MS]\n\n"
+          "\t-c  device cache to start from and update\n"
+          "\t-x  probe the cached devices only, do not discover\n"
+          "\t-e  stop discovery once this many devices answered\n"
+          "\t-i  milliseconds between probes of a device, defaults to %d\n"
+          "\t-r  rounds of probes to send, 0 until interrupted, the default\n"
+          "\t-t  milliseconds to wait for the last replies, defaults to %d\n",
+          name, INTERVAL, TIMEOUT);
+}
+
+static int probe_send(int sfd, lifx_batch_t *batch, probe_device_t *devices,
+                      uint32_t slot, uint32_t round, uint32_t source) {
+  probe_device_t *device = &devices[slot];
+  lifx_frame_t frame = {
+      .header =
+          {
+              .tagged = 0,
+              .source = source,
+              .response = 1,
+              .acknowledgement = 0,
+              .sequence = round,
+              .type = EchoRequest,
+          },
+  };
+  memcpy(frame.header.target, device->target, sizeof(device->target));
+  uint8_t *echoing = frame.payload.echo_request_payload.echoing;
+  memcpy(echoing, PROBE_MAGIC, 8);
+  lifx_store_le32(echoing + PROBE_OFFSET_SLOT, slot);
+  lifx_store_le32(echoing + PROBE_OFFSET_ROUND, round);
+  lifx_store_le64(echoing + PROBE_OFFSET_SENT, now_ns());
+
+  if (batch->count == batch->capacity) {
+    if (lifx_batch_send(sfd, batch) == -1) {
+      return -1;
+    }
+    lifx_batch_reset(batch);
+  }
+  if (lifx_batch_add(batch, &frame, &device->addr) == -1) {
+    return -1;
+  }
+  device->sent++;
+  return 0;
+}
+
+/* Match echo replies to their device and record the round trip */
+static void probe_receive(lifx_receiver_t *receiver, probe_device_t *devices,
+                          size_t count, uint32_t source) {
+  uint64_t now = now_ns();
+  for (size_t i = 0; i < receiver->count; ++i) {
+    const lifx_frame_view_t *view = &receiver->views[i];
+    size_t n;
+    const uint8_t *echoing = lifx_view_payload(view, &n);
+    if (lifx_view_type(view) != EchoResponse ||
+        lifx_view_source(view) != source || n < 64 ||
+        memcmp(echoing, PROBE_MAGIC, 8) != 0) {
+      continue;
+    }
+
+    uint32_t slot = lifx_load_le32(echoing + PROBE_OFFSET_SLOT);
+    uint32_t round = lifx_load_le32(echoing + PROBE_OFFSET_ROUND);
+    uint64_t sent = lifx_load_le64(echoing + PROBE_OFFSET_SENT);
+    if (slot >= count || sent > now ||
+        memcmp(lifx_view_target(view), devices[slot].target, 6) != 0) {
+      continue;
+    }
+
+    probe_device_t *device = &devices[slot];
+    if (round <= device->answered) {
+      device->stale++;
+      continue;
+    }
+    device->answered = round;
+    device->received++;
+    lifx_histogram_record(&device->rtt, now - sent);
+  }
+}
+
+/* Worst tail latency first, devices that never answered before all */
+static int compare_p99(const void *a, const void *b) {
+  const probe_device_t *x = a;
+  const probe_device_t *y = b;
+  uint64_t px = x->rtt.count == 0 ? UINT64_MAX
+                                  : lifx_histogram_quantile(&x->rtt, 0.99);
+  uint64_t py = y->rtt.count == 0 ? UINT64_MAX
+                                  : lifx_histogram_quantile(&y->rtt, 0.99);
+  return px < py ? 1 : px > py ? -1 : 0;
+}
+
+static void report(probe_device_t *devices, size_t count) {
+  qsort(devices, count, sizeof(*devices), compare_p99);
+
+  lifx_histogram_t total;
+  lifx_histogram_init(&total);
+  uint64_t sent = 0;
+  uint64_t received = 0;
+
+  printf("%-16s %-20s %7s %8s %9s %9s %9s %9s\n", "target", "label", "sent",
+         "loss", "p50 ms", "p99 ms", "p999 ms", "max ms");
+  for (size_t i = 0; i < count; ++i) {
+    probe_device_t *device = &devices[i];
+    for (int j = 0; j < 8; ++j) {
+      printf("%02X", device->target[j]);
+    }
+    double loss = device->sent == 0
+                      ? 0
+                      : 100.0 * (device->sent - device->received) /
+                            device->sent;
+    printf(" %-20.20s %7llu %7.2f%% %9.2f %9.2f %9.2f %9.2f\n",
+           (char *)device->label, (unsigned long long)device->sent, loss,
+           lifx_histogram_quantile(&device->rtt, 0.5) / 1e6,
+           lifx_histogram_quantile(&device->rtt, 0.99) / 1e6,
+           lifx_histogram_quantile(&device->rtt, 0.999) / 1e6,
+           device->rtt.count == 0 ? 0 : device->rtt.max / 1e6);
+    lifx_histogram_merge(&total, &device->rtt);
+    sent += device->sent;
+    received += device->received;
+  }
+
+  printf("\n%zu devices, %llu probes, %.2f%% lost, p50 %.2f ms, p99 %.2f ms, "
+         "p999 %.2f ms\n",
+         count, (unsigned long long)sent,
+         sent == 0 ? 0 : 100.0 * (sent - received) / sent,
+         lifx_histogram_quantile(&total, 0.5) / 1e6,
+         lifx_histogram_quantile(&total, 0.99) / 1e6,
+         lifx_histogram_quantile(&total, 0.999) / 1e6);
+}
+
+int main(int argc, char **argv) {
+  const char *cache = NULL;
+  int discover = 1;
+  uint32_t expected = 0;
+  uint64_t interval = INTERVAL;
+  uint32_t rounds = 0;
+  uint64_t timeout = TIMEOUT;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:xe:i:r:t:h")) != -1) {
+    switch (opt) {
+    case 'c':
+      cache = optarg;
+      break;
+    case 'x':
+      discover = 0;
+      break;
+    case 'e':
+      expected = strtoul(optarg, NULL, 10);
+      break;
+    case 'i':
+      interval = strtoull(optarg, NULL, 10);
+      break;
+    case 'r':
+      rounds = strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      timeout = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+      exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+  if (interval == 0 || (!discover && cache == NULL)) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  lifx_registry_t registry;
+  if (lifx_registry_init(&registry, MAX_DEVICES) == -1) {
+    fprintf(stderr, "failed to allocate registry\n");
+    exit(EXIT_FAILURE);
+  }
+  if (cache != NULL) {
+    int loaded = lifx_cache_load(&registry, cache);
+    if (loaded == -1) {
+      printf("no usable cache at %s\n", cache);
+    } else {
+      printf("loaded %d cached devices\n", loaded);
+    }
+  }
+
+  uint32_t source = getpid() | 1;
+  if (discover) {
+    lifx_discovery_config_t config;
+    lifx_discovery_config_init(&config);
+    config.source = source;
+    config.port = PORT;
+    config.expected = expected;
+    if (lifx_discover(&registry, &config) == -1) {
+      perror("discover");
+      exit(EXIT_FAILURE);
+    }
+    if (cache != NULL && lifx_cache_save(&registry, cache) == -1) {
+      perror("failed to save cache");
+    }
+  }
+
+  size_t count = registry.count;
+  if (count == 0) {
+    fprintf(stderr, "no devices to probe\n");
+    exit(EXIT_FAILURE);
+  }
+  probe_device_t *devices = calloc(count, sizeof(*devices));
+  if (devices == NULL) {
+    fprintf(stderr, "failed to allocate %zu devices\n", count);
+    exit(EXIT_FAILURE);
+  }
+  size_t cursor = 0;
+  lifx_device_t *device;
+  for (size_t i = 0; (device = lifx_registry_next(&registry, &cursor)); ++i) {
+    memcpy(devices[i].target, device->target, sizeof(device->target));
+    memcpy(devices[i].label, device->label, sizeof(device->label));
+    devices[i].addr = device->addr;
+    lifx_histogram_init(&devices[i].rtt);
+  }
+  lifx_registry_free(&registry);
+
+  int sfd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sfd == -1) {
+    perror("socket");
+    exit(EXIT_FAILURE);
+  }
+  lifx_batch_t batch;
+  lifx_receiver_t receiver;
+  if (lifx_batch_init(&batch, BATCH_DEPTH) == -1 ||
+      lifx_receiver_init(&receiver, RECV_DEPTH) == -1) {
+    fprintf(stderr, "failed to allocate batch\n");
+    exit(EXIT_FAILURE);
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  printf("probing %zu devices every %llu ms, interrupt to stop\n", count,
+         (unsigned long long)interval);
+
+  /*
+   * Each round probes every device once. The probes are spread evenly over
+   * the round, device i going out i / count of the way through it.
+   */
+  uint64_t interval_ns = interval * 1000000;
+  uint64_t start = now_ns();
+  uint32_t round = 1;
+  size_t next = 0;
+  while (!stop && (rounds == 0 || round <= rounds)) {
+    uint64_t now = now_ns();
+    uint64_t round_start = start + (uint64_t)(round - 1) * interval_ns;
+    size_t due = now < round_start
+                     ? 0
+                     : (now - round_start) * count / interval_ns + 1;
+    if (due > count) {
+      due = count;
+    }
+    for (; next < due; ++next) {
+      if (probe_send(sfd, &batch, devices, next, round, source) == -1) {
+        perror("failed to send probe");
+        exit(EXIT_FAILURE);
+      }
+    }
+    if (lifx_batch_send(sfd, &batch) == -1) {
+      perror("failed to send probe");
+      exit(EXIT_FAILURE);
+    }
+    lifx_batch_reset(&batch);
+    if (next == count) {
+      next = 0;
+      round++;
+    }
+
+    /* Sleep until the next probe is due, handling replies meanwhile */
+    uint64_t wake = start + (uint64_t)(round - 1) * interval_ns +
+                    next * interval_ns / count;
+    now = now_ns();
+    int wait = wake > now ? (wake - now) / 1000000 : 0;
+    if (lifx_receiver_recv_views(&receiver, sfd, wait) == -1) {
+      if (stop) {
+        break;
+      }
+      perror("recvmmsg");
+      exit(EXIT_FAILURE);
+    }
+    probe_receive(&receiver, devices, count, source);
+  }
+
+  /* Let the last probes come back */
+  uint64_t deadline = now_ns() + timeout * 1000000;
+  uint64_t now;
+  while ((now = now_ns()) < deadline) {
+    if (lifx_receiver_recv_views(&receiver, sfd,
+                                 (deadline - now) / 1000000 + 1) == -1) {
+      break;
+    }
+    probe_receive(&receiver, devices, count, source);
+  }
+
+  printf("\n");
+  report(devices, count);
+
+  lifx_receiver_free(&receiver);
+  lifx_batch_free(&batch);
+  close(sfd);
+  free(devices);
+  return 0;
+}
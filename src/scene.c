@@ -0,0 +1,333 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "discovery.h"
+#include "mirror.h"
+#include "receiver.h"
+#include "registry.h"
+#include "scene.h"
+#include "scheduler.h"
+#include "wire.h"
+
+#define PORT 56700
+#define MAX_DEVICES 1024
+#define INTERVAL 1000
+#define RECV_DEPTH 64
+#define BATCH_DEPTH 64
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-e EXPECTED] [-i MS] [-d MS] [-r ROUNDS] SCENE\n\n"
+          "\t-e  stop discovery once this many devices answered\n"
+          "\t-i  milliseconds between polls of a light, defaults to %d\n"
+          "\t-d  milliseconds the lights take to change, defaults to 0\n"
+          "\t-r  times to apply the scene, one poll round apart, defaults "
+          "to 1\n\n"
+          "SCENE has one light per line, TARGET HUE SAT BRI KELVIN on|off,\n"
+          "where a TARGET of * stands for every light not listed\n",
+          name, INTERVAL);
+}
+
+typedef struct {
+  int sfd;
+  lifx_batch_t *batch;
+} sender_t;
+
+static int sender_flush(sender_t *sender) {
+  if (lifx_batch_send(sender->sfd, sender->batch) == -1) {
+    return -1;
+  }
+  lifx_batch_reset(sender->batch);
+  return 0;
+}
+
+/* lifx_scheduler_emit batching frames for lifx_batch_send */
+static int sender_emit(void *ctx, const lifx_frame_t *frame,
+                       const struct sockaddr_in *addr) {
+  sender_t *sender = ctx;
+  if (sender->batch->count == sender->batch->capacity &&
+      sender_flush(sender) == -1) {
+    return -1;
+  }
+  return lifx_batch_add(sender->batch, frame, addr);
+}
+
+/* Target as printed by discover, 16 hexadecimal digits */
+static int target_parse(const char *text, uint8_t target[8]) {
+  if (strlen(text) != 16) {
+    return -1;
+  }
+  for (int i = 0; i < 8; ++i) {
+    unsigned byte;
+    if (sscanf(text + i * 2, "%2x", &byte) != 1) {
+      return -1;
+    }
+    target[i] = byte;
+  }
+  return 0;
+}
+
+/*
+ * Read a scene for the mirrored lights, a * line fills in every light the
+ * file does not list. Returns the amount of lights or -1.
+ */
+static int scene_load(const char *path, const lifx_mirror_t *mirror,
+                      lifx_scene_light_t *lights) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+
+  uint8_t *listed = calloc(mirror->count, 1);
+  if (listed == NULL) {
+    fclose(file);
+    return -1;
+  }
+  lifx_scene_light_t fallback;
+  int has_fallback = 0;
+  size_t n = 0;
+  char line[256];
+  int res = 0;
+  while (res == 0 && fgets(line, sizeof(line), file) != NULL) {
+    char target[32], power[8];
+    unsigned hue, saturation, brightness, kelvin;
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+    if (sscanf(line, "%31s %u %u %u %u %7s", target, &hue, &saturation,
+               &brightness, &kelvin, power) != 6 ||
+        (strcmp(power, "on") != 0 && strcmp(power, "off") != 0)) {
+      res = -1;
+      break;
+    }
+    lifx_scene_light_t light = {
+        .hue = hue,
+        .saturation = saturation,
+        .brightness = brightness,
+        .kelvin = kelvin,
+        .power = strcmp(power, "on") == 0 ? UINT16_MAX : 0,
+    };
+    if (strcmp(target, "*") == 0) {
+      fallback = light;
+      has_fallback = 1;
+      continue;
+    }
+    int row;
+    if (target_parse(target, light.target) == -1) {
+      res = -1;
+    } else if ((row = lifx_mirror_find(mirror, light.target)) == -1) {
+      fprintf(stderr, "%s is not a known light\n", target);
+    } else if (!listed[row]) {
+      listed[row] = 1;
+      lights[n++] = light;
+    }
+  }
+  fclose(file);
+
+  for (size_t row = 0; res == 0 && has_fallback && row < mirror->count;
+       ++row) {
+    if (!listed[row]) {
+      lights[n] = fallback;
+      lifx_store_le64(lights[n++].target, mirror->targets[row]);
+    }
+  }
+  free(listed);
+  return res == -1 ? -1 : (int)n;
+}
+
+typedef struct {
+  int sfd;
+  lifx_receiver_t receiver;
+  lifx_batch_t batch;
+  sender_t sender;
+  uint32_t source;
+  lifx_mirror_t mirror;
+  lifx_scheduler_t scheduler;
+} session_t;
+
+/*
+ * Poll, send what the scheduler releases and learn from replies until
+ * deadline, or until every light is known and nothing is queued when until
+ * settled is set.
+ */
+static int session_run(session_t *session, uint64_t deadline, int settled) {
+  lifx_mirror_t *mirror = &session->mirror;
+  lifx_scheduler_t *scheduler = &session->scheduler;
+  uint64_t now;
+  while ((now = now_ms()) < deadline) {
+    lifx_mirror_poll(mirror, now, sender_emit, &session->sender);
+    lifx_scheduler_run(scheduler, now, sender_emit, &session->sender);
+    if (sender_flush(&session->sender) == -1) {
+      return -1;
+    }
+
+    size_t known = 0;
+    for (size_t i = 0; i < mirror->count; ++i) {
+      known += mirror->updated[i] != 0;
+    }
+    if (settled && known == mirror->count && scheduler->active_count == 0) {
+      return 0;
+    }
+
+    int64_t timeout = deadline - now;
+    int64_t next = lifx_mirror_next(mirror, now);
+    if (next != -1 && next < timeout) {
+      timeout = next;
+    }
+    next = lifx_scheduler_next(scheduler, now);
+    if (next != -1 && next < timeout) {
+      timeout = next;
+    }
+    int count =
+        lifx_receiver_recv(&session->receiver, session->sfd, timeout);
+    if (count == -1) {
+      return -1;
+    }
+    now = now_ms();
+    for (int i = 0; i < count; ++i) {
+      const lifx_frame_t *frame = &session->receiver.frames[i];
+      if (frame->header.source == session->source) {
+        lifx_mirror_observe(mirror, frame, now);
+      }
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  uint32_t expected = 0;
+  uint64_t interval = INTERVAL;
+  uint32_t duration = 0;
+  uint32_t rounds = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "e:i:d:r:h")) != -1) {
+    switch (opt) {
+    case 'e':
+      expected = strtoul(optarg, NULL, 10);
+      break;
+    case 'i':
+      interval = strtoull(optarg, NULL, 10);
+      break;
+    case 'd':
+      duration = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      rounds = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+      exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+  if (interval == 0 || rounds == 0 || optind + 1 != argc) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  lifx_registry_t registry;
+  if (lifx_registry_init(&registry, MAX_DEVICES) == -1) {
+    fprintf(stderr, "failed to allocate registry\n");
+    exit(EXIT_FAILURE);
+  }
+
+  session_t session = {
+      .source = getpid() | 1,
+  };
+  lifx_discovery_config_t config;
+  lifx_discovery_config_init(&config);
+  config.source = session.source;
+  config.port = PORT;
+  config.expected = expected;
+  if (lifx_discover(&registry, &config) == -1) {
+    perror("discover");
+    exit(EXIT_FAILURE);
+  }
+
+  if (lifx_mirror_init(&session.mirror, MAX_DEVICES, interval,
+                       session.source) == -1 ||
+      lifx_scheduler_init(&session.scheduler, MAX_DEVICES,
+                          LIFX_SCHEDULER_RATE_DEFAULT,
+                          LIFX_SCHEDULER_BURST_DEFAULT) == -1 ||
+      lifx_batch_init(&session.batch, BATCH_DEPTH) == -1 ||
+      lifx_receiver_init(&session.receiver, RECV_DEPTH) == -1) {
+    fprintf(stderr, "failed to allocate scene state\n");
+    exit(EXIT_FAILURE);
+  }
+  lifx_mirror_sync(&session.mirror, &registry);
+  lifx_registry_free(&registry);
+  if (session.mirror.count == 0) {
+    fprintf(stderr, "no lights to apply a scene to\n");
+    exit(EXIT_FAILURE);
+  }
+
+  lifx_scene_light_t *lights =
+      calloc(session.mirror.count, sizeof(*lights));
+  if (lights == NULL) {
+    fprintf(stderr, "failed to allocate scene\n");
+    exit(EXIT_FAILURE);
+  }
+  int n = scene_load(argv[optind], &session.mirror, lights);
+  if (n == -1) {
+    fprintf(stderr, "failed to read scene %s\n", argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+
+  session.sfd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (session.sfd == -1) {
+    perror("socket");
+    exit(EXIT_FAILURE);
+  }
+  session.sender = (sender_t){
+      .sfd = session.sfd,
+      .batch = &session.batch,
+  };
+
+  lifx_scene_config_t scene;
+  lifx_scene_config_init(&scene);
+  scene.duration = duration;
+
+  /* Learn the state of every light before the first diff */
+  if (session_run(&session, now_ms() + interval * 2, 1) == -1) {
+    perror("poll");
+    exit(EXIT_FAILURE);
+  }
+
+  for (uint32_t round = 1; round <= rounds; ++round) {
+    lifx_scene_stats_t stats;
+    uint64_t emitted = session.scheduler.stats.emitted;
+    lifx_scene_apply(&session.mirror, &session.scheduler, lights, n, &scene,
+                     now_ms(), &stats);
+    /* Send it, then give the mirror a round to see the result */
+    if (session_run(&session, now_ms() + interval, 0) == -1) {
+      perror("send");
+      exit(EXIT_FAILURE);
+    }
+    printf("round %u: %d lights, %u colors, %u powers, %u unchanged, "
+           "%u unknown, %u refused, %llu frames sent\n",
+           round, n, stats.colors, stats.powers, stats.unchanged,
+           stats.unknown, stats.refused,
+           (unsigned long long)(session.scheduler.stats.emitted - emitted));
+  }
+
+  free(lights);
+  close(session.sfd);
+  lifx_receiver_free(&session.receiver);
+  lifx_batch_free(&session.batch);
+  lifx_scheduler_free(&session.scheduler);
+  lifx_mirror_free(&session.mirror);
+  return 0;
+}
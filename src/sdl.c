@@ -1,14 +1,22 @@
 #include <arpa/inet.h>
-#include <poll.h>
+#include <getopt.h>
+#include <linux/filter.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "frame.h"
+#include "io.h"
+#include "sim.h"
 
 #define PORT 56700
 #define HOST "0.0.0.0"
+#define RECV_DEPTH 64
+#define REPLY_DEPTH 256
+#define THREADS_MAX 256
 
 void payload_print(const lifx_payload_t *payload, lifx_message_type type) {
   if (payload == NULL) {
@@ -29,6 +37,25 @@ void payload_print(const lifx_payload_t *payload, lifx_message_type type) {
     printf("echoing: %s\n", payload->echo_response_payload.echoing);
     break;
   }
+  case EchoRequest: {
+    printf("echoing: %s\n", payload->echo_request_payload.echoing);
+    break;
+  }
+  case SetPower: {
+    printf("level: %d\n", payload->set_power_payload.level);
+    break;
+  }
+  case SetColor: {
+    printf("hue: %d\n", payload->set_color_payload.hue);
+    printf("saturation: %d\n", payload->set_color_payload.saturation);
+    printf("brightness: %d\n", payload->set_color_payload.brightness);
+    printf("kelvin: %d\n", payload->set_color_payload.kelvin);
+    printf("duration: %u\n", payload->set_color_payload.duration);
+    break;
+  }
+  case GetService:
+  case GetLabel:
+  case Get:
   case Acknowledgement: {
     printf("NO PAYLOAD\n");
     break;
@@ -63,111 +90,372 @@ void frame_print(const lifx_frame_t *frame) {
   payload_print(&frame->payload, frame->header.type);
 }
 
-int main(void) {
+/*
+ * A worker thread of the multi-threaded mode. Every worker binds its own
+ * SO_REUSEPORT socket and answers what the kernel steers to it without
+ * logging anything.
+ */
+typedef struct {
+  pthread_t thread;
+  int sfd;
+  sim_t sim;
+  lifx_io_t io;
+  size_t received; /* frames received, published after every batch */
+} worker_t;
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-n DEVICES] [-p PORT] [-t THREADS] [-q] [--io BACKEND]\n"
+          "          [IMPAIRMENT]\n"
+          "\n"
+          "Where BACKEND is auto, epoll or io_uring, defaults to auto\n"
+          "\n"
+          "Where IMPAIRMENT is any of\n"
+          "\t--loss CHANCE       lose frames and replies\n"
+          "\t--latency MS        hold every reply back\n"
+          "\t--jitter MS         hold replies back up to this much more\n"
+          "\t--reorder CHANCE    hold a reply back behind later ones\n"
+          "\t--duplicate CHANCE  send a reply twice\n"
+          "\t--rate N            process at most N frames per second\n"
+          "\t--impaired CHANCE   impair only some devices, defaults to 1\n"
+          "\t--seed N            seed of every random choice\n",
+          name);
+}
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int sim_socket(long port, int reuseport) {
   struct in_addr ip;
   if (inet_pton(AF_INET, HOST, &ip) != 1) {
     fprintf(stderr, "failed to convert ip address to network '%s'\n", HOST);
-    exit(EXIT_FAILURE);
+    return -1;
   }
   struct sockaddr_in addr = {0};
   addr.sin_family = AF_INET;
   addr.sin_addr = ip;
-  addr.sin_port = htons(PORT);
+  addr.sin_port = htons(port);
 
   int sfd = socket(AF_INET, SOCK_DGRAM, 0);
   if (sfd == -1) {
     perror("socket");
-    exit(EXIT_FAILURE);
+    return -1;
+  }
+
+  int on = 1;
+  if (reuseport &&
+      setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+    perror("setsockopt SO_REUSEPORT");
+    close(sfd);
+    return -1;
   }
 
   if (bind(sfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
     perror("bind");
-    exit(EXIT_FAILURE);
+    close(sfd);
+    return -1;
   }
-  printf("Started software defined light on port %d!\n", PORT);
+
+  return sfd;
+}
+
+/*
+ * Steer every datagram to the worker owning its target. The kernel hands
+ * the filter the UDP payload, so the device index is at bytes 11 to 13 of
+ * the frame. Worker i owns devices i * shard up to (i + 1) * shard - 1.
+ * Broadcasts skip the filter and reach every worker, each answering tagged
+ * frames for the devices it owns. A tagged frame sent unicast carries the all
+ * zero target and only reaches worker 0 and its devices. When the result is
+ * not a worker, or the frame is too short, the kernel falls back to hashing
+ * the sender address.
+ */
+static int attach_shard_filter(int sfd, size_t shard) {
+  struct sock_filter code[] = {
+      /* A = index << 8, byte 14 of a simulated target is 0 */
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 11),
+      BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 8),
+      BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, shard),
+      BPF_STMT(BPF_RET | BPF_A, 0),
+  };
+  struct sock_fprog prog = {
+      .len = sizeof(code) / sizeof(code[0]),
+      .filter = code,
+  };
+
+  return setsockopt(sfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                    sizeof(prog));
+}
+
+static void *worker_run(void *arg) {
+  worker_t *worker = arg;
 
   while (1) {
-    uint8_t inbound_p[FRAME_SIZE_MAX] = {0};
-    uint8_t *inbound_packet = inbound_p;
-    struct sockaddr_storage storage = {0};
-    socklen_t storage_len = sizeof(storage);
-    char recv_ip[INET6_ADDRSTRLEN] = {0};
-    uint16_t recv_port = 0;
-
-    int size = recvfrom(sfd, inbound_packet, FRAME_SIZE_MAX, 0,
-                        (struct sockaddr *)&storage, &storage_len);
-    if (size == -1) {
-      perror("recvfrom");
+    int count = lifx_io_recv(&worker->io, sim_next(&worker->sim));
+    if (count == -1) {
+      perror("recv");
+      exit(EXIT_FAILURE);
+    }
+    if (sim_advance(&worker->sim, worker->sfd, now_ms()) == -1) {
+      perror("send");
       exit(EXIT_FAILURE);
     }
 
-    if (storage.ss_family == AF_INET) {
-      struct sockaddr_in *addr = (struct sockaddr_in *)&storage;
-      if (inet_ntop(AF_INET, &addr->sin_addr, recv_ip, INET6_ADDRSTRLEN) ==
-          NULL) {
-        perror("inet_ntop ipv4");
-        exit(EXIT_FAILURE);
+    for (int i = 0; i < count; ++i) {
+      lifx_frame_t frame;
+      if (lifx_view_decode(&worker->io.views[i], &frame) == -1) {
+        continue;
       }
-      recv_port = ntohs(addr->sin_port);
-    } else {
-      struct sockaddr_in6 *addr = (struct sockaddr_in6 *)&storage;
-      if (inet_ntop(AF_INET6, &addr->sin6_addr, recv_ip, INET6_ADDRSTRLEN) ==
-          NULL) {
-        perror("inet_ntop ipv6");
+      if (sim_handle(&worker->sim, worker->sfd, &frame,
+                     (struct sockaddr_in *)&worker->io.addrs[i]) == -1) {
+        perror("send");
         exit(EXIT_FAILURE);
       }
-      recv_port = ntohs(addr->sin6_port);
     }
-    printf("received message from %s on port %d\n", recv_ip, recv_port);
 
-    lifx_frame_t inbound_frame = {0};
-    if (lifx_decode_frame(&inbound_frame, &inbound_packet, size) == -1) {
-      fprintf(stderr, "failed to decode lifx packet\n");
+    if (sim_flush(&worker->sim, worker->sfd) == -1) {
+      perror("send");
+      exit(EXIT_FAILURE);
+    }
+    __atomic_store_n(&worker->received, worker->received + count,
+                     __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+static void run_workers(sim_t *sim, long port, long threads,
+                        lifx_io_backend backend, int quiet) {
+  worker_t *workers = calloc(threads, sizeof(*workers));
+  if (workers == NULL) {
+    fprintf(stderr, "failed to allocate workers\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Sockets join the reuseport group in bind order, which the filter uses */
+  size_t shard = (sim->count + threads - 1) / threads;
+  for (long i = 0; i < threads; ++i) {
+    worker_t *worker = &workers[i];
+    worker->sfd = sim_socket(port, 1);
+    if (worker->sfd == -1) {
+      exit(EXIT_FAILURE);
+    }
+    size_t first = i * shard < sim->count ? i * shard : sim->count;
+    size_t owned = sim->count - first < shard ? sim->count - first : shard;
+    if (sim_share(&worker->sim, sim, first, owned, REPLY_DEPTH) == -1) {
+      fprintf(stderr, "failed to allocate worker\n");
+      exit(EXIT_FAILURE);
+    }
+    if (lifx_io_init(&worker->io, worker->sfd, RECV_DEPTH, backend) == -1) {
+      perror("failed to set up I/O");
+      exit(EXIT_FAILURE);
+    }
+    worker->sim.io = &worker->io;
+  }
+
+  if (attach_shard_filter(workers[0].sfd, shard) == -1) {
+    perror("failed to attach shard filter, falling back to hashing");
+  }
+
+  for (long i = 0; i < threads; ++i) {
+    if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) !=
+        0) {
+      fprintf(stderr, "failed to start worker\n");
       exit(EXIT_FAILURE);
     }
-    frame_print(&inbound_frame);
-
-    if (inbound_frame.header.type == GetService) {
-      lifx_frame_t frame = {
-          .header =
-              {
-                  .size = FRAME_HEADER_SIZE + 5,
-                  .tagged = 0,
-                  .target = "DEADBEEF",
-                  .source = inbound_frame.header.source,
-                  .sequence = inbound_frame.header.sequence,
-                  .acknowledgement = 0,
-                  .response = 0,
-                  .type = StateService,
-              },
-          .payload =
-              {
-                  .state_service_payload =
-                      {
-                          .service = UDP,
-                          .port = PORT,
-                      },
-              },
-      };
-
-      uint8_t p[FRAME_SIZE_MAX] = {0};
-      uint8_t *packet = p;
-      int size;
-      size = lifx_encode_frame(&frame, &packet, FRAME_SIZE_MAX);
-      if (size == -1) {
-        fprintf(stderr, "failed to encode lifx packet\n");
+  }
+  printf("Started %zu software defined lights on port %ld with %ld workers "
+         "using %s!\n",
+         sim->count, port, threads,
+         lifx_io_backend_name(workers[0].io.backend));
+
+  size_t last = 0;
+  while (1) {
+    sleep(1);
+    if (quiet) {
+      continue;
+    }
+
+    size_t received = 0;
+    for (long i = 0; i < threads; ++i) {
+      received += __atomic_load_n(&workers[i].received, __ATOMIC_RELAXED);
+    }
+    printf("%zu frames/s\n", received - last);
+    last = received;
+  }
+}
+
+int main(int argc, char **argv) {
+  long devices = 1;
+  long port = PORT;
+  long threads = 1;
+  int quiet = 0;
+  sim_impairment_t impairment = {0};
+  int impaired = 0;
+  double chance = 1;
+  uint64_t seed = 1;
+  lifx_io_backend backend = LIFX_IO_AUTO;
+
+  enum {
+    OPT_LOSS = 256,
+    OPT_LATENCY,
+    OPT_JITTER,
+    OPT_REORDER,
+    OPT_DUPLICATE,
+    OPT_RATE,
+    OPT_IMPAIRED,
+    OPT_SEED,
+    OPT_IO,
+  };
+  static const struct option options[] = {
+      {"loss", required_argument, NULL, OPT_LOSS},
+      {"latency", required_argument, NULL, OPT_LATENCY},
+      {"jitter", required_argument, NULL, OPT_JITTER},
+      {"reorder", required_argument, NULL, OPT_REORDER},
+      {"duplicate", required_argument, NULL, OPT_DUPLICATE},
+      {"rate", required_argument, NULL, OPT_RATE},
+      {"impaired", required_argument, NULL, OPT_IMPAIRED},
+      {"seed", required_argument, NULL, OPT_SEED},
+      {"io", required_argument, NULL, OPT_IO},
+      {"help", no_argument, NULL, 'h'},
+      {0},
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:p:t:qh", options, NULL)) != -1) {
+    /* Every long option but --seed sets up an impairment */
+    impaired |= opt >= OPT_LOSS && opt < OPT_SEED;
+    switch (opt) {
+    case 'n':
+      devices = strtol(optarg, NULL, 10);
+      break;
+    case 'p':
+      port = strtol(optarg, NULL, 10);
+      break;
+    case 't':
+      threads = strtol(optarg, NULL, 10);
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    case OPT_LOSS:
+      impairment.loss = strtod(optarg, NULL);
+      break;
+    case OPT_LATENCY:
+      impairment.latency = strtoul(optarg, NULL, 10);
+      break;
+    case OPT_JITTER:
+      impairment.jitter = strtoul(optarg, NULL, 10);
+      break;
+    case OPT_REORDER:
+      impairment.reorder = strtod(optarg, NULL);
+      break;
+    case OPT_DUPLICATE:
+      impairment.duplicate = strtod(optarg, NULL);
+      break;
+    case OPT_RATE:
+      impairment.rate = strtoul(optarg, NULL, 10);
+      break;
+    case OPT_IMPAIRED:
+      chance = strtod(optarg, NULL);
+      break;
+    case OPT_SEED:
+      seed = strtoull(optarg, NULL, 10);
+      break;
+    case OPT_IO:
+      if (lifx_io_backend_parse(optarg, &backend) == -1) {
+        usage(argv[0]);
         exit(EXIT_FAILURE);
       }
+      break;
+    default:
+      usage(argv[0]);
+      exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+  if (devices < 1 || devices > SIM_DEVICES_MAX || port < 1 || port > 65535 ||
+      threads < 1 || threads > THREADS_MAX) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
 
-      if (sendto(sfd, packet, size, 0, (struct sockaddr *)&storage,
-                 storage_len) != size) {
-        fprintf(stderr, "failed to send response packet\n");
+  sim_t sim;
+  if (sim_init(&sim, devices, port, REPLY_DEPTH) == -1) {
+    fprintf(stderr, "failed to allocate %ld virtual devices\n", devices);
+    exit(EXIT_FAILURE);
+  }
+  if (impaired) {
+    if (sim_impair(&sim, &impairment, chance, seed, now_ms()) == -1) {
+      fprintf(stderr, "failed to impair virtual devices\n");
+      exit(EXIT_FAILURE);
+    }
+    printf("Impairing devices with seed %llu\n", (unsigned long long)seed);
+  }
+
+  if (threads > 1) {
+    run_workers(&sim, port, threads, backend, quiet);
+  }
+
+  int sfd = sim_socket(port, 0);
+  if (sfd == -1) {
+    exit(EXIT_FAILURE);
+  }
+
+  lifx_io_t io;
+  if (lifx_io_init(&io, sfd, RECV_DEPTH, backend) == -1) {
+    perror("failed to set up I/O");
+    exit(EXIT_FAILURE);
+  }
+  sim.io = &io;
+  printf("Started %ld software defined lights on port %ld using %s!\n",
+         devices, port, lifx_io_backend_name(io.backend));
+
+  while (1) {
+    int count = lifx_io_recv(&io, sim_next(&sim));
+    if (count == -1) {
+      perror("recv");
+      exit(EXIT_FAILURE);
+    }
+    if (sim_advance(&sim, sfd, now_ms()) == -1) {
+      perror("send");
+      exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < count; ++i) {
+      struct sockaddr_in *from = (struct sockaddr_in *)&io.addrs[i];
+      lifx_frame_t inbound_frame;
+      if (lifx_view_decode(&io.views[i], &inbound_frame) == -1) {
+        continue;
+      }
+
+      if (!quiet) {
+        char recv_ip[INET_ADDRSTRLEN] = {0};
+        if (inet_ntop(AF_INET, &from->sin_addr, recv_ip, INET_ADDRSTRLEN) ==
+            NULL) {
+          perror("inet_ntop ipv4");
+          exit(EXIT_FAILURE);
+        }
+        printf("received message from %s on port %d\n", recv_ip,
+               ntohs(from->sin_port));
+        frame_print(&inbound_frame);
+      }
+
+      if (sim_handle(&sim, sfd, &inbound_frame, from) == -1) {
+        perror("send");
         exit(EXIT_FAILURE);
       }
-      printf("sent state service response!\n");
+    }
+
+    if (sim_flush(&sim, sfd) == -1) {
+      perror("send");
+      exit(EXIT_FAILURE);
     }
   }
 
+  lifx_io_free(&io);
+  sim_free(&sim);
   close(sfd);
 
   return 0;
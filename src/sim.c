@@ -0,0 +1,478 @@
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_KELVIN_DEFAULT 3500
+
+/* Device state may be shared between worker threads */
+#define SIM_STORE(field, value)                                                \
+  __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define SIM_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+int sim_init(sim_t *sim, size_t count, uint16_t port, size_t depth) {
+  if (sim == NULL || count == 0 || count > SIM_DEVICES_MAX) {
+    return -1;
+  }
+
+  memset(sim, 0, sizeof(*sim));
+  sim->devices = calloc(count, sizeof(*sim->devices));
+  if (sim->devices == NULL) {
+    return -1;
+  }
+  if (lifx_batch_init(&sim->replies, depth) == -1) {
+    free(sim->devices);
+    sim->devices = NULL;
+    return -1;
+  }
+  sim->count = count;
+  sim->last = count;
+  sim->port = port;
+
+  for (size_t i = 0; i < count; ++i) {
+    sim_device_t *device = &sim->devices[i];
+    sim_target(device->target, i);
+    device->brightness = UINT16_MAX;
+    device->kelvin = SIM_KELVIN_DEFAULT;
+    device->power = UINT16_MAX;
+    snprintf((char *)device->label, sizeof(device->label), "Sim Light %zu",
+             i);
+  }
+
+  return 0;
+}
+
+/* splitmix64, spreads a seed into an independent random state */
+static uint64_t sim_mix(uint64_t x) {
+  x += 0x9E3779B97F4A7C15;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+  x ^= x >> 31;
+  /* xorshift gets stuck at 0 */
+  return x == 0 ? 1 : x;
+}
+
+/* xorshift64* */
+static uint64_t sim_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545F4914F6CDD1D;
+}
+
+/* Returns 1 with the given chance */
+static int sim_chance(uint64_t *state, double chance) {
+  if (chance <= 0) {
+    return 0;
+  }
+  return (sim_random(state) >> 11) * 0x1.0p-53 < chance;
+}
+
+static int sim_delayed_init(sim_t *sim, uint64_t now) {
+  if (sim->delayed == NULL) {
+    sim->delayed = calloc(SIM_DELAYED_MAX, sizeof(*sim->delayed));
+    if (sim->delayed == NULL) {
+      return -1;
+    }
+  }
+
+  sim->delayed_free = NULL;
+  for (size_t i = SIM_DELAYED_MAX; i > 0; --i) {
+    sim->delayed[i - 1].next = sim->delayed_free;
+    sim->delayed_free = &sim->delayed[i - 1];
+  }
+  lifx_wheel_init(&sim->wheel, now);
+  sim->now = now;
+
+  return 0;
+}
+
+int sim_share(sim_t *sim, const sim_t *owner, size_t first, size_t count,
+              size_t depth) {
+  if (sim == NULL || owner == NULL || owner->devices == NULL ||
+      first + count > owner->count) {
+    return -1;
+  }
+
+  memset(sim, 0, sizeof(*sim));
+  if (lifx_batch_init(&sim->replies, depth) == -1) {
+    return -1;
+  }
+  sim->devices = owner->devices;
+  sim->count = owner->count;
+  sim->first = first;
+  sim->last = first + count;
+  sim->port = owner->port;
+  sim->shared = 1;
+
+  if (owner->delayed != NULL) {
+    sim->seed = owner->seed;
+    sim->rng = sim_mix(owner->seed + SIM_DEVICES_MAX + first);
+    if (sim_delayed_init(sim, owner->now) == -1) {
+      lifx_batch_free(&sim->replies);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int sim_impair(sim_t *sim, const sim_impairment_t *impairment, double chance,
+               uint64_t seed, uint64_t now) {
+  if (sim == NULL || impairment == NULL || sim->shared) {
+    return -1;
+  }
+
+  if (sim_delayed_init(sim, now) == -1) {
+    return -1;
+  }
+  sim->impairment = *impairment;
+  sim->seed = seed;
+  sim->rng = sim_mix(seed + SIM_DEVICES_MAX);
+
+  /* Bulbs buffer about a quarter of a second worth of frames */
+  uint32_t burst = impairment->rate / 4 + 1;
+  uint64_t pick = sim_mix(seed);
+  for (size_t i = 0; i < sim->count; ++i) {
+    sim_device_t *device = &sim->devices[i];
+    if (chance < 1 && !sim_chance(&pick, chance)) {
+      device->impairment = NULL;
+      continue;
+    }
+    device->impairment = &sim->impairment;
+    device->rng = sim_mix(seed + i + 1);
+    lifx_bucket_init(&device->bucket, impairment->rate, burst, now);
+  }
+
+  return 0;
+}
+
+void sim_free(sim_t *sim) {
+  if (sim == NULL) {
+    return;
+  }
+
+  lifx_batch_free(&sim->replies);
+  free(sim->delayed);
+  sim->delayed = NULL;
+  if (!sim->shared) {
+    free(sim->devices);
+  }
+  sim->devices = NULL;
+  sim->count = 0;
+}
+
+void sim_target(uint8_t target[8], size_t index) {
+  memcpy(target, SIM_TARGET_PREFIX, 3);
+  target[3] = index >> 16;
+  target[4] = index >> 8;
+  target[5] = index;
+  target[6] = 0;
+  target[7] = 0;
+}
+
+sim_device_t *sim_find(sim_t *sim, const uint8_t target[8]) {
+  if (memcmp(target, SIM_TARGET_PREFIX, 3) != 0 || target[6] != 0 ||
+      target[7] != 0) {
+    return NULL;
+  }
+
+  size_t index = (size_t)target[3] << 16 | (size_t)target[4] << 8 | target[5];
+  if (index >= sim->count) {
+    return NULL;
+  }
+  return &sim->devices[index];
+}
+
+/* Queue a reply, flushing the queue first when it is full */
+static int sim_queue(sim_t *sim, int sfd, const lifx_frame_t *frame,
+                     const struct sockaddr_in *to) {
+  if (sim->replies.count == sim->replies.capacity &&
+      sim_flush(sim, sfd) == -1) {
+    return -1;
+  }
+  if (lifx_batch_add(&sim->replies, frame, to) == -1) {
+    return -1;
+  }
+  sim->stats.replies++;
+
+  return 1;
+}
+
+static void sim_release(lifx_timer_t *timer, void *ctx) {
+  (void)timer;
+  sim_delayed_t *delayed = ctx;
+  sim_t *sim = delayed->sim;
+
+  if (sim_queue(sim, sim->sfd, &delayed->frame, &delayed->to) == -1) {
+    sim->failed = 1;
+  }
+  delayed->next = sim->delayed_free;
+  sim->delayed_free = delayed;
+}
+
+/* Queue a reply once delay milliseconds have passed */
+static int sim_hold(sim_t *sim, int sfd, const lifx_frame_t *frame,
+                    const struct sockaddr_in *to, uint64_t delay) {
+  sim_delayed_t *delayed = sim->delayed_free;
+  if (delay == 0 || delayed == NULL) {
+    return sim_queue(sim, sfd, frame, to);
+  }
+
+  sim->delayed_free = delayed->next;
+  delayed->sim = sim;
+  delayed->frame = *frame;
+  delayed->to = *to;
+  lifx_wheel_add(&sim->wheel, &delayed->timer, sim->now + delay, sim_release,
+                 delayed);
+  sim->stats.delayed++;
+
+  return 1;
+}
+
+/* Random state used for the impairment of device */
+static uint64_t *sim_rng(sim_t *sim, sim_device_t *device) {
+  size_t index = device - sim->devices;
+  if (index >= sim->first && index < sim->last) {
+    return &device->rng;
+  }
+  return &sim->rng;
+}
+
+/* Returns 1 when device gets to process a frame */
+static int sim_admit(sim_t *sim, sim_device_t *device) {
+  const sim_impairment_t *impairment = device->impairment;
+  if (impairment == NULL) {
+    return 1;
+  }
+
+  uint64_t *rng = sim_rng(sim, device);
+  if (sim_chance(rng, impairment->loss)) {
+    sim->stats.lost++;
+    return 0;
+  }
+  if (impairment->rate != 0 && rng == &device->rng &&
+      !lifx_bucket_take(&device->bucket, sim->now)) {
+    sim->stats.limited++;
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Queue a reply from device, returns the amount of copies queued */
+static int sim_reply(sim_t *sim, int sfd, sim_device_t *device,
+                     const lifx_frame_t *request, lifx_message_type type,
+                     const lifx_payload_t *payload,
+                     const struct sockaddr_in *to) {
+  lifx_frame_t frame = {
+      .header =
+          {
+              .tagged = 0,
+              .source = request->header.source,
+              .response = 0,
+              .acknowledgement = 0,
+              .sequence = request->header.sequence,
+              .type = type,
+          },
+  };
+  memcpy(frame.header.target, device->target, sizeof(frame.header.target));
+  if (payload != NULL) {
+    frame.payload = *payload;
+  }
+
+  const sim_impairment_t *impairment = device->impairment;
+  if (impairment == NULL) {
+    return sim_queue(sim, sfd, &frame, to);
+  }
+
+  uint64_t *rng = sim_rng(sim, device);
+  int copies = 1;
+  if (sim_chance(rng, impairment->duplicate)) {
+    sim->stats.duplicated++;
+    copies = 2;
+  }
+
+  int queued = 0;
+  for (int i = 0; i < copies; ++i) {
+    if (sim_chance(rng, impairment->loss)) {
+      sim->stats.lost++;
+      continue;
+    }
+
+    uint64_t delay = impairment->latency;
+    if (impairment->jitter != 0) {
+      delay += sim_random(rng) % (impairment->jitter + 1);
+    }
+    if (sim_chance(rng, impairment->reorder)) {
+      delay += SIM_REORDER_HOLD;
+    }
+    if (sim_hold(sim, sfd, &frame, to, delay) == -1) {
+      return -1;
+    }
+    queued++;
+  }
+
+  return queued;
+}
+
+/* Answer with the current state of a device, what Get and a SetColor
+ * asking for a response get */
+static int sim_light_state(sim_t *sim, int sfd, sim_device_t *device,
+                           const lifx_frame_t *frame,
+                           const struct sockaddr_in *to) {
+  lifx_payload_t out;
+  out.light_state_payload.hue = SIM_LOAD(device->hue);
+  out.light_state_payload.saturation = SIM_LOAD(device->saturation);
+  out.light_state_payload.brightness = SIM_LOAD(device->brightness);
+  out.light_state_payload.kelvin = SIM_LOAD(device->kelvin);
+  out.light_state_payload.power = SIM_LOAD(device->power);
+  memcpy(out.light_state_payload.label, device->label, sizeof(device->label));
+  return sim_reply(sim, sfd, device, frame, LightState, &out, to);
+}
+
+/* Apply a frame to one device, returns the amount of replies queued */
+static int sim_apply(sim_t *sim, int sfd, sim_device_t *device,
+                     const lifx_frame_t *frame,
+                     const struct sockaddr_in *from) {
+  const lifx_payload_t *in = &frame->payload;
+  lifx_payload_t out;
+  int queued = 0;
+
+  if (!sim_admit(sim, device)) {
+    return 0;
+  }
+
+  /* Real bulbs acknowledge before they answer */
+  if (frame->header.acknowledgement) {
+    queued =
+        sim_reply(sim, sfd, device, frame, Acknowledgement, NULL, from);
+    if (queued == -1) {
+      return -1;
+    }
+  }
+
+  int res = 0;
+  switch (frame->header.type) {
+  case GetService:
+    out.state_service_payload.service = UDP;
+    out.state_service_payload.port = sim->port;
+    res = sim_reply(sim, sfd, device, frame, StateService, &out, from);
+    break;
+  case SetColor:
+    SIM_STORE(device->hue, in->set_color_payload.hue);
+    SIM_STORE(device->saturation, in->set_color_payload.saturation);
+    SIM_STORE(device->brightness, in->set_color_payload.brightness);
+    SIM_STORE(device->kelvin, in->set_color_payload.kelvin);
+    if (frame->header.response) {
+      res = sim_light_state(sim, sfd, device, frame, from);
+    }
+    break;
+  case SetPower:
+    /* Bulbs report power as either fully off or fully on */
+    SIM_STORE(device->power,
+              in->set_power_payload.level == 0 ? 0 : UINT16_MAX);
+    if (frame->header.response) {
+      out.state_power_payload.level = SIM_LOAD(device->power);
+      res = sim_reply(sim, sfd, device, frame, StatePower, &out, from);
+    }
+    break;
+  case GetLabel:
+    memcpy(out.state_label_payload.label, device->label,
+           sizeof(device->label));
+    res = sim_reply(sim, sfd, device, frame, StateLabel, &out, from);
+    break;
+  case Get:
+    res = sim_light_state(sim, sfd, device, frame, from);
+    break;
+  case EchoRequest:
+    memcpy(out.echo_response_payload.echoing, in->echo_request_payload.echoing,
+           sizeof(out.echo_response_payload.echoing));
+    res = sim_reply(sim, sfd, device, frame, EchoResponse, &out, from);
+    break;
+  default:
+    sim->stats.ignored++;
+    break;
+  }
+  if (res == -1) {
+    return -1;
+  }
+
+  return queued + res;
+}
+
+int sim_advance(sim_t *sim, int sfd, uint64_t now) {
+  if (sim == NULL) {
+    return -1;
+  }
+
+  sim->now = now;
+  sim->sfd = sfd;
+  if (sim->delayed != NULL) {
+    lifx_wheel_advance(&sim->wheel, now);
+  }
+  if (sim->failed) {
+    sim->failed = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+int64_t sim_next(const sim_t *sim) {
+  if (sim == NULL || sim->delayed == NULL) {
+    return -1;
+  }
+  return lifx_wheel_next(&sim->wheel);
+}
+
+int sim_handle(sim_t *sim, int sfd, const lifx_frame_t *frame,
+               const struct sockaddr_in *from) {
+  if (sim == NULL || frame == NULL) {
+    return -1;
+  }
+
+  static const uint8_t all[8] = {0};
+  if (!frame->header.tagged &&
+      memcmp(frame->header.target, all, sizeof(all)) != 0) {
+    sim_device_t *device = sim_find(sim, frame->header.target);
+    if (device == NULL) {
+      sim->stats.ignored++;
+      return 0;
+    }
+    sim->stats.handled++;
+    return sim_apply(sim, sfd, device, frame, from);
+  }
+
+  /* A broadcast reaches every socket sharing the port, each sim answers for
+   * its own devices so every device answers once */
+  int queued = 0;
+  for (size_t i = sim->first; i < sim->last; ++i) {
+    int res = sim_apply(sim, sfd, &sim->devices[i], frame, from);
+    if (res == -1) {
+      return -1;
+    }
+    sim->stats.handled++;
+    queued += res;
+  }
+
+  return queued;
+}
+
+int sim_flush(sim_t *sim, int sfd) {
+  if (sim == NULL) {
+    return -1;
+  }
+
+  int sent = sim->io != NULL ? lifx_io_send(sim->io, &sim->replies)
+                             : lifx_batch_send(sfd, &sim->replies);
+  if (sent == -1) {
+    return -1;
+  }
+  /* Replies the socket had no room for are dropped, like a busy bulb would */
+  lifx_batch_reset(&sim->replies);
+
+  return sent;
+}
@@ -0,0 +1,215 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "batch.h"
+#include "bucket.h"
+#include "frame.h"
+#include "io.h"
+#include "timer.h"
+
+/* Virtual devices get the targets D0:73:D5:xx:xx:xx, xx being their index */
+#define SIM_TARGET_PREFIX "\xD0\x73\xD5"
+#define SIM_DEVICES_MAX (1 << 24)
+
+/* Replies held back by latency at once, further ones go out right away */
+#define SIM_DELAYED_MAX 16384
+/* Milliseconds a reordered reply is held back on top of its latency */
+#define SIM_REORDER_HOLD 10
+
+/*
+ * Network conditions of a virtual light. Chances are between 0 and 1.
+ */
+typedef struct {
+  double loss;      /* chance a frame, or a reply, is lost */
+  uint32_t latency; /* milliseconds every reply is held back */
+  uint32_t jitter;  /* up to this many milliseconds added to latency */
+  double reorder;   /* chance a reply is held back behind later ones */
+  double duplicate; /* chance a reply is sent twice */
+  uint32_t rate;    /* frames processed per second, 0 for no limit */
+} sim_impairment_t;
+
+/*
+ * A virtual light. Holds the state a real bulb reports back.
+ */
+typedef struct {
+  uint8_t target[8];
+  uint16_t hue;
+  uint16_t saturation;
+  uint16_t brightness;
+  uint16_t kelvin;
+  uint16_t power;
+  uint8_t label[33];
+  const sim_impairment_t *impairment; /* NULL when not impaired */
+  uint64_t rng;                       /* random state of the impairment */
+  lifx_bucket_t bucket;               /* processing rate cap */
+} sim_device_t;
+
+/* A reply held back by latency */
+typedef struct sim_delayed sim_delayed_t;
+struct sim_delayed {
+  lifx_timer_t timer;
+  struct sim *sim;
+  struct sockaddr_in to;
+  lifx_frame_t frame;
+  sim_delayed_t *next; /* next free reply */
+};
+
+/*
+ * A set of virtual lights answering on one socket. Replies are queued in a
+ * batch and flushed with sendmmsg. Several sims can share one set of devices
+ * through sim_share, one per worker thread, device state is then read and
+ * written with relaxed atomics.
+ *
+ * Every sim owns a range of the devices and is the only one using their
+ * impairment state. Tagged frames are answered by the devices it owns only,
+ * a broadcast is delivered to every socket of the group. Frames for devices
+ * it does not own are impaired with the random state of the sim and are not
+ * rate capped.
+ */
+typedef struct sim {
+  sim_device_t *devices;       /* devices[i] has index i */
+  size_t count;                /* amount of devices */
+  size_t first;                /* first device owned */
+  size_t last;                 /* one past the last device owned */
+  uint16_t port;               /* port reported in StateService */
+  int shared;                  /* devices are owned by another sim */
+  lifx_batch_t replies;        /* replies waiting for sim_flush */
+  sim_impairment_t impairment; /* impairment of the impaired devices */
+  uint64_t seed;               /* seed of every random state */
+  uint64_t rng;                /* random state for devices not owned */
+  uint64_t now;                /* milliseconds, set by sim_advance */
+  int sfd;                     /* socket of the last sim_advance */
+  lifx_io_t *io;               /* sends the replies instead of sfd when set */
+  int failed;                  /* a held back reply failed to queue */
+  lifx_wheel_t wheel;          /* replies held back by latency */
+  sim_delayed_t *delayed;      /* SIM_DELAYED_MAX replies, NULL if unused */
+  sim_delayed_t *delayed_free; /* free list of delayed */
+  struct {
+    size_t handled;    /* frames handled, once per addressed device */
+    size_t replies;    /* replies queued */
+    size_t ignored;    /* frames for other targets or unknown types */
+    size_t lost;       /* frames and replies lost on purpose */
+    size_t limited;    /* frames over the rate cap */
+    size_t delayed;    /* replies held back */
+    size_t duplicated; /* replies sent twice */
+  } stats;
+} sim_t;
+
+/**
+ * @brief Allocate a set of virtual devices.
+ *
+ * @param sim
+ * @param count amount of devices
+ * @param port port reported in StateService replies
+ * @param depth amount of replies queued before they are flushed
+ */
+int sim_init(sim_t *sim, size_t count, uint16_t port, size_t depth);
+
+/**
+ * @brief Set up a sim answering for the devices of another.
+ *
+ * The sim gets its own reply queue, stats and impairment state, and owns
+ * devices first up to first + count - 1. It must be freed before owner and
+ * set up after sim_impair is called on owner.
+ *
+ * @param sim
+ * @param owner sim allocated with sim_init
+ * @param first first device owned
+ * @param count amount of devices owned
+ * @param depth amount of replies queued before they are flushed
+ */
+int sim_share(sim_t *sim, const sim_t *owner, size_t first, size_t count,
+              size_t depth);
+
+/**
+ * @brief Impair some of the devices.
+ *
+ * Picks each device with the given chance and gives it the impairment. Every
+ * random choice, here and while handling frames, derives from seed so a run
+ * can be repeated exactly.
+ *
+ * @param sim
+ * @param impairment
+ * @param chance chance a device is impaired, 1 for every device
+ * @param seed
+ * @param now milliseconds
+ */
+int sim_impair(sim_t *sim, const sim_impairment_t *impairment, double chance,
+               uint64_t seed, uint64_t now);
+
+/**
+ * @brief Free the memory held by a set of virtual devices.
+ *
+ * @param sim
+ */
+void sim_free(sim_t *sim);
+
+/**
+ * @brief Write the target of the virtual device with a given index.
+ *
+ * @param target
+ * @param index
+ */
+void sim_target(uint8_t target[8], size_t index);
+
+/**
+ * @brief Find the device with a target.
+ *
+ * Returns NULL when the target is not hosted by sim.
+ *
+ * @param sim
+ * @param target
+ */
+sim_device_t *sim_find(sim_t *sim, const uint8_t target[8]);
+
+/**
+ * @brief Move the clock forward.
+ *
+ * Queues the held back replies that are due. Call it before handling frames
+ * received at now. Returns -1 when a reply failed to send.
+ *
+ * @param sim
+ * @param sfd
+ * @param now milliseconds
+ */
+int sim_advance(sim_t *sim, int sfd, uint64_t now);
+
+/**
+ * @brief Milliseconds until the next held back reply is due.
+ *
+ * Returns -1 when none is held back.
+ *
+ * @param sim
+ */
+int64_t sim_next(const sim_t *sim);
+
+/**
+ * @brief Handle a frame received from a controller.
+ *
+ * Tagged frames and frames sent to the all zero target are handled by every
+ * device. Replies are queued, and flushed on sfd when the queue fills up.
+ * Returns the amount of replies queued or -1 on error.
+ *
+ * @param sim
+ * @param sfd
+ * @param frame
+ * @param from sender of frame, replies go back to it
+ */
+int sim_handle(sim_t *sim, int sfd, const lifx_frame_t *frame,
+               const struct sockaddr_in *from);
+
+/**
+ * @brief Send every queued reply.
+ *
+ * Returns the amount of replies sent or -1 on error.
+ *
+ * @param sim
+ * @param sfd
+ */
+int sim_flush(sim_t *sim, int sfd);
+
+#endif /* SIM_H */
@@ -0,0 +1,204 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "discovery.h"
+#include "mirror.h"
+#include "receiver.h"
+#include "registry.h"
+#include "wire.h"
+
+#define PORT 56700
+#define MAX_DEVICES 1024
+#define INTERVAL 1000
+#define RECV_DEPTH 64
+#define BATCH_DEPTH 64
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int signal) {
+  (void)signal;
+  stop = 1;
+}
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-e EXPECTED] [-i MS] [-q]\n\n"
+          "\t-e  stop discovery once this many devices answered\n"
+          "\t-i  milliseconds between polls of a light, defaults to %d\n"
+          "\t-q  only count changes, do not print them\n",
+          name, INTERVAL);
+}
+
+typedef struct {
+  int sfd;
+  lifx_batch_t *batch;
+} sender_t;
+
+/* lifx_scheduler_emit batching Get frames, polls are spread thin enough to
+ * need no rate limit of their own */
+static int sender_emit(void *ctx, const lifx_frame_t *frame,
+                       const struct sockaddr_in *addr) {
+  sender_t *sender = ctx;
+  if (sender->batch->count == sender->batch->capacity) {
+    if (lifx_batch_send(sender->sfd, sender->batch) == -1) {
+      return -1;
+    }
+    lifx_batch_reset(sender->batch);
+  }
+  return lifx_batch_add(sender->batch, frame, addr);
+}
+
+static void change_print(void *ctx, const lifx_mirror_t *mirror, size_t row,
+                         uint8_t changed) {
+  (void)ctx;
+  uint8_t target[8];
+  lifx_store_le64(target, mirror->targets[row]);
+  for (int i = 0; i < 8; ++i) {
+    printf("%02X", target[i]);
+  }
+  if (changed & LIFX_MIRROR_COLOR) {
+    printf(" color %u %u %u %u", mirror->hue[row], mirror->saturation[row],
+           mirror->brightness[row], mirror->kelvin[row]);
+  }
+  if (changed & LIFX_MIRROR_POWER) {
+    printf(" power %s", mirror->power[row] == 0 ? "off" : "on");
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  uint32_t expected = 0;
+  uint64_t interval = INTERVAL;
+  int quiet = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "e:i:qh")) != -1) {
+    switch (opt) {
+    case 'e':
+      expected = strtoul(optarg, NULL, 10);
+      break;
+    case 'i':
+      interval = strtoull(optarg, NULL, 10);
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      usage(argv[0]);
+      exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+  if (interval == 0) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  lifx_registry_t registry;
+  if (lifx_registry_init(&registry, MAX_DEVICES) == -1) {
+    fprintf(stderr, "failed to allocate registry\n");
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t source = getpid() | 1;
+  lifx_discovery_config_t config;
+  lifx_discovery_config_init(&config);
+  config.source = source;
+  config.port = PORT;
+  config.expected = expected;
+  if (lifx_discover(&registry, &config) == -1) {
+    perror("discover");
+    exit(EXIT_FAILURE);
+  }
+
+  lifx_mirror_t mirror;
+  if (lifx_mirror_init(&mirror, MAX_DEVICES, interval, source) == -1) {
+    fprintf(stderr, "failed to allocate mirror\n");
+    exit(EXIT_FAILURE);
+  }
+  lifx_mirror_sync(&mirror, &registry);
+  lifx_registry_free(&registry);
+  if (mirror.count == 0) {
+    fprintf(stderr, "no devices to watch\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!quiet) {
+    lifx_mirror_subscribe(&mirror, change_print, NULL);
+  }
+
+  int sfd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sfd == -1) {
+    perror("socket");
+    exit(EXIT_FAILURE);
+  }
+  lifx_batch_t batch;
+  lifx_receiver_t receiver;
+  if (lifx_batch_init(&batch, BATCH_DEPTH) == -1 ||
+      lifx_receiver_init(&receiver, RECV_DEPTH) == -1) {
+    fprintf(stderr, "failed to allocate batch\n");
+    exit(EXIT_FAILURE);
+  }
+  sender_t sender = {
+      .sfd = sfd,
+      .batch = &batch,
+  };
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  printf("watching %zu lights every %llu ms, interrupt to stop\n",
+         mirror.count, (unsigned long long)interval);
+
+  while (!stop) {
+    uint64_t now = now_ms();
+    lifx_mirror_poll(&mirror, now, sender_emit, &sender);
+    if (lifx_batch_send(sfd, &batch) == -1) {
+      perror("failed to send poll");
+      exit(EXIT_FAILURE);
+    }
+    lifx_batch_reset(&batch);
+
+    int count = lifx_receiver_recv(&receiver, sfd,
+                                   lifx_mirror_next(&mirror, now_ms()));
+    if (count == -1) {
+      if (stop) {
+        break;
+      }
+      perror("recvmmsg");
+      exit(EXIT_FAILURE);
+    }
+    now = now_ms();
+    for (int i = 0; i < count; ++i) {
+      if (receiver.frames[i].header.source == source) {
+        lifx_mirror_observe(&mirror, &receiver.frames[i], now);
+      }
+    }
+  }
+
+  size_t known = 0;
+  for (size_t i = 0; i < mirror.count; ++i) {
+    known += mirror.updated[i] != 0;
+  }
+  printf("\n%llu polls, %llu states, %llu changes, %zu of %zu lights known\n",
+         (unsigned long long)mirror.stats.polled,
+         (unsigned long long)mirror.stats.states,
+         (unsigned long long)mirror.stats.changes, known, mirror.count);
+
+  lifx_receiver_free(&receiver);
+  lifx_batch_free(&batch);
+  close(sfd);
+  lifx_mirror_free(&mirror);
+  return 0;
+}